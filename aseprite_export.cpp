@@ -0,0 +1,1269 @@
+/*
+ * aseprite_export.cpp - public domain
+ *
+ * A command line batch exporter built on aseprite_importer.cpp.  It takes
+ * .ase files and directories of them, and writes texture atlases (TGA), the
+ * metadata to go with them (frame rects, trim offsets, durations, tags and
+ * slices, as JSON or binary), and optionally every frame on its own and a
+ * cooked blob per file (see AsepriteSerialize).  Files are parsed, inflated,
+ * composited and trimmed in parallel on the library's batch pipeline.
+ *
+ * Build (tinfl.c must be next to aseprite_importer.cpp):
+ *   c++ -O2 aseprite_export.cpp -o aseprite_export -lpthread
+ *   cl /O2 aseprite_export.cpp
+ *
+ * Usage: aseprite_export [options] <file.ase or directory>...
+ *   -o <dir>     output directory (default .)
+ *   -n <name>    name of the atlas and metadata files (default atlas)
+ *   -j <count>   worker threads (default one per CPU)
+ *   -p <size>    largest atlas page (default 2048)
+ *   -P <pixels>  padding between frames in the atlas (default 1)
+ *   -s <scale>   whole number upscale (default 1)
+ *   -t           trim transparent borders off the frames
+ *   -m <count>   a convex mesh per frame with at most this many vertices
+ *   -b           binary metadata instead of JSON
+ *   -c           write a cooked blob per file (<name>.asec)
+ *   -f           write every frame as its own TGA (<name>_<frame>.tga)
+ *   -d <spread>  write a signed distance field of every frame, reaching 0 and
+ *                255 this many pixels from the edge (<name>_<frame>_sdf.tga)
+ *   -l <layer>   take the distance fields from just this layer
+ *   -v           print what was done and how long it took
+ *
+ * Directories are searched recursively for .ase and .aseprite files.  A
+ * file's name in the output is its path relative to the directory it was
+ * found in, without the extension.  Frames with identical pixels share one
+ * rect in the atlas.
+ *
+ * Meshes (see AsepriteBuildSpriteMesh) cover every visible pixel of a frame
+ * with less transparent area than its rect.  Vertices are in output pixels
+ * from the frame's top left (after trimming), clockwise, and the triangles
+ * are a fan around the first vertex.
+ *
+ * Distance fields (see AsepriteComputeSDF) are 8 bit grayscale TGAs the size
+ * of the (scaled, untrimmed) canvas, so a glow or outline has room around the
+ * sprite.  128 is the edge.  With -l, files without that layer get none.
+ *
+ * Binary metadata (<name>.bin) is little endian.  Strings are a u16 length
+ * followed by that many bytes.
+ *   "ASEM" u32 version (2)
+ *   u32 page count, then per page: u16 width, u16 height
+ *   u32 file count, then per file:
+ *     string name, u16 width, u16 height
+ *     u32 frame count, then per frame: s16 page (-1 when empty), u16 x, u16 y,
+ *       u16 width, u16 height, s16 trim x, s16 trim y, u16 duration (ms),
+ *       u8 mesh vertex count (0 without -m), then per vertex: f32 x, f32 y,
+ *       f32 u, f32 v
+ *     u32 tag count, then per tag: string name, u16 from, u16 to, u8 direction
+ *     u32 slice count, then per slice: string name, u32 key count, then per
+ *       key: u32 frame, s32 x, s32 y, u32 width, u32 height, s32 pivot x,
+ *       s32 pivot y
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <assert.h>
+#include <math.h>
+
+#define Assert assert
+#include "aseprite_importer.cpp"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <time.h>
+#endif
+
+struct export_options
+{
+	const char *OutDir;
+	const char *Name;
+	int NumThreads;
+	int PageSize;
+	int Padding;
+	int Scale;
+	int MeshVertices;
+	float Spread;
+	const char *Layer;
+	bool Trim;
+	bool Binary;
+	bool Cook;
+	bool FrameImages;
+	bool Verbose;
+};
+
+// A frame as it goes into the atlas: the (trimmed, scaled) pixels and where
+// they came from in the canvas.  Alias points at an identical earlier frame.
+
+struct export_frame
+{
+	uint8_t *Pixels;
+	int Width;
+	int Height;
+	int TrimX;
+	int TrimY;
+	int Duration;
+	aseprite_cache_key Hash;
+	export_frame *Alias;
+	aseprite_sprite_mesh Mesh;
+	int Page;
+	int X;
+	int Y;
+};
+
+struct export_tag
+{
+	char *Name;
+	int FromFrame;
+	int ToFrame;
+	int LoopDirection;
+};
+
+struct export_slice
+{
+	char *Name;
+	int NumKeys;
+	aseprite_slice_key *Keys;
+};
+
+struct export_file
+{
+	char *Path;
+	char *Name;
+	bool Failed;
+	int Width;
+	int Height;
+	int NumFrames;
+	export_frame *Frames;
+	int NumTags;
+	export_tag *Tags;
+	int NumSlices;
+	export_slice *Slices;
+};
+
+struct export_page
+{
+	int Width;
+	int Height;
+};
+
+struct exporter
+{
+	export_options Options;
+	int NumFiles;
+	int MaxFiles;
+	export_file *Files;
+	aseprite_mutex Lock;
+	int NumPages;
+	export_page *Pages;
+};
+
+double
+ExportSeconds()
+{
+#ifdef _WIN32
+	LARGE_INTEGER Counter, Frequency;
+	QueryPerformanceCounter(&Counter);
+	QueryPerformanceFrequency(&Frequency);
+	return (double)Counter.QuadPart/(double)Frequency.QuadPart;
+#else
+	struct timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (double)Now.tv_sec + (double)Now.tv_nsec*1e-9;
+#endif
+}
+
+char *
+ExportJoinPath(const char *Directory, const char *Name, const char *Suffix)
+{
+	size_t Length = strlen(Directory) + strlen(Name) + strlen(Suffix) + 2;
+	char *Result = (char *)malloc(Length);
+	if (Result)
+		snprintf(Result, Length, "%s/%s%s", Directory, Name, Suffix);
+	return Result;
+}
+
+// The name with directory separators flattened, for files in the output dir.
+
+char *
+ExportFlatName(const char *Name)
+{
+	char *Result = AsepriteCopyString(Name);
+	for (char *At = Result; At && *At; At++)
+	{
+		if (*At == '/' || *At == '\\')
+			*At = '_';
+	}
+	return Result;
+}
+
+bool
+ExportIsAseprite(const char *Path)
+{
+	const char *Dot = strrchr(Path, '.');
+	if (!Dot)
+		return false;
+	char Extension[16];
+	int Length = 0;
+	for (Dot++; *Dot && Length < 15; Dot++)
+		Extension[Length++] = (char)((*Dot >= 'A' && *Dot <= 'Z') ? *Dot - 'A' + 'a' : *Dot);
+	Extension[Length] = '\0';
+	return (strcmp(Extension, "ase") == 0 || strcmp(Extension, "aseprite") == 0);
+}
+
+void
+ExportAddFile(exporter *Exporter, const char *Path, const char *Name)
+{
+	if (Exporter->NumFiles == Exporter->MaxFiles)
+	{
+		Exporter->MaxFiles = Exporter->MaxFiles ? Exporter->MaxFiles*2 : 64;
+		Exporter->Files = (export_file *)realloc(Exporter->Files, Exporter->MaxFiles*sizeof(export_file));
+	}
+	export_file *File = Exporter->Files + Exporter->NumFiles++;
+	memset(File, 0, sizeof(export_file));
+	File->Path = AsepriteCopyString(Path);
+	File->Name = AsepriteCopyString(Name);
+	char *Dot = strrchr(File->Name, '.');
+	if (Dot && !strpbrk(Dot, "/\\"))
+		*Dot = '\0';
+}
+
+// Adds every .ase under Directory.  Prefix is the name of Directory relative
+// to the root that was passed on the command line.
+
+void
+ExportAddDirectory(exporter *Exporter, const char *Directory, const char *Prefix)
+{
+#ifdef _WIN32
+	char *Pattern = ExportJoinPath(Directory, "*", "");
+	WIN32_FIND_DATAA Found;
+	HANDLE Find = FindFirstFileA(Pattern, &Found);
+	free(Pattern);
+	if (Find == INVALID_HANDLE_VALUE)
+		return;
+	do
+	{
+		const char *Entry = Found.cFileName;
+		bool IsDirectory = (Found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+	DIR *Handle = opendir(Directory);
+	if (!Handle)
+		return;
+	struct dirent *Found;
+	while ((Found = readdir(Handle)) != 0)
+	{
+		const char *Entry = Found->d_name;
+		char *EntryPath = ExportJoinPath(Directory, Entry, "");
+		struct stat Info;
+		bool IsDirectory = (EntryPath && stat(EntryPath, &Info) == 0 && S_ISDIR(Info.st_mode));
+		free(EntryPath);
+#endif
+		if (strcmp(Entry, ".") != 0 && strcmp(Entry, "..") != 0)
+		{
+			char *Path = ExportJoinPath(Directory, Entry, "");
+			char *Name = *Prefix ? ExportJoinPath(Prefix, Entry, "") : AsepriteCopyString(Entry);
+			if (!Path || !Name)
+				fprintf(stderr, "aseprite_export: out of memory, skipping %s\n", Entry);
+			else if (IsDirectory)
+				ExportAddDirectory(Exporter, Path, Name);
+			else if (ExportIsAseprite(Entry))
+				ExportAddFile(Exporter, Path, Name);
+			free(Path);
+			free(Name);
+		}
+#ifdef _WIN32
+	} while (FindNextFileA(Find, &Found));
+	FindClose(Find);
+#else
+	}
+	closedir(Handle);
+#endif
+}
+
+int
+ExportCompareFiles(const void *A, const void *B)
+{
+	return strcmp(((export_file *)A)->Name, ((export_file *)B)->Name);
+}
+
+// TGA sizes are 16 bits, anything bigger can't be written.
+
+bool
+ExportFitsTGA(int Width, int Height)
+{
+	return (Width <= 0xFFFF && Height <= 0xFFFF);
+}
+
+bool
+ExportWriteTGAHeader(FILE *Handle, int Width, int Height, uint8_t ImageType, uint8_t BitsPerPixel, uint8_t Descriptor)
+{
+	if (!ExportFitsTGA(Width, Height))
+		return false;
+	uint8_t Header[18] = {};
+	Header[2] = ImageType;
+	Header[12] = (uint8_t)Width;
+	Header[13] = (uint8_t)(Width >> 8);
+	Header[14] = (uint8_t)Height;
+	Header[15] = (uint8_t)(Height >> 8);
+	Header[16] = BitsPerPixel;
+	Header[17] = Descriptor;
+	return (fwrite(Header, 1, sizeof(Header), Handle) == sizeof(Header));
+}
+
+bool
+ExportWriteTGA(const char *Path, const uint8_t *Pixels, int Width, int Height)
+{
+	FILE *Handle = fopen(Path, "wb");
+	if (!Handle)
+		return false;
+
+	//Uncompressed true color, 8 bits of alpha, rows from the top
+	bool Result = ExportWriteTGAHeader(Handle, Width, Height, 2, 32, 0x28);
+
+	uint8_t *Row = (uint8_t *)malloc((size_t)Width*4 + 1);
+	Result = Result && Row;
+	for (int Y = 0; Result && Y < Height; Y++)
+	{
+		const uint8_t *Source = Pixels + (size_t)Y*Width*4;
+		for (int X = 0; X < Width; X++)
+		{
+			Row[X*4 + 0] = Source[X*4 + 2];
+			Row[X*4 + 1] = Source[X*4 + 1];
+			Row[X*4 + 2] = Source[X*4 + 0];
+			Row[X*4 + 3] = Source[X*4 + 3];
+		}
+		Result = (fwrite(Row, 4, Width, Handle) == (size_t)Width);
+	}
+	free(Row);
+	Result = (fclose(Handle) == 0) && Result;
+	return Result;
+}
+
+bool
+ExportWriteGrayTGA(const char *Path, const uint8_t *Pixels, int Width, int Height)
+{
+	FILE *Handle = fopen(Path, "wb");
+	if (!Handle)
+		return false;
+
+	//Uncompressed grayscale, rows from the top
+	bool Result = ExportWriteTGAHeader(Handle, Width, Height, 3, 8, 0x20);
+	Result = Result && (fwrite(Pixels, 1, (size_t)Width*Height, Handle) == (size_t)Width*Height);
+	Result = (fclose(Handle) == 0) && Result;
+	return Result;
+}
+
+export_file *
+ExportGetFile(aseprite_batch_file *BatchFile)
+{
+	exporter *Exporter = (exporter *)BatchFile->UserData;
+	return Exporter->Files + BatchFile->Index;
+}
+
+// Frames of one file fail on several workers at once, only the first says so.
+
+void
+ExportFailFile(exporter *Exporter, export_file *File, const char *Reason)
+{
+	AsepriteLock(&Exporter->Lock);
+	if (!File->Failed)
+		fprintf(stderr, "aseprite_export: couldn't export %s: %s\n", File->Path, Reason);
+	File->Failed = true;
+	AsepriteUnlock(&Exporter->Lock);
+}
+
+// The scaled canvas has to fit in a TGA, and keeps every size below in an int.
+
+bool
+ExportFitsScale(aseprite_file *Parsed, int Scale)
+{
+	return ((int64_t)Parsed->Header.WidthInPixels*Scale <= 0xFFFF &&
+			(int64_t)Parsed->Header.HeightInPixels*Scale <= 0xFFFF);
+}
+
+// The distance field of a frame (or of the -l layer in it), at output scale.
+
+void
+ExportWriteSDF(exporter *Exporter, aseprite_batch_file *BatchFile, int FrameNumber)
+{
+	export_options *Options = &Exporter->Options;
+	export_file *File = ExportGetFile(BatchFile);
+	aseprite_file *Parsed = &BatchFile->File;
+	aseprite_export_options Export = {};
+	Export.FrameNumber = FrameNumber;
+	Export.Scale = Options->Scale;
+	if (Options->Layer)
+	{
+		int LayerIndex = AsepriteFindLayer(Parsed, Options->Layer);
+		if (LayerIndex < 0)
+			return;
+		if (LayerIndex >= 64)
+		{
+			if (FrameNumber == 0)
+				fprintf(stderr, "aseprite_export: layer %s of %s is past the 64th, skipping its distance fields\n", Options->Layer, File->Path);
+			return;
+		}
+		Export.LayerMask = (uint64_t)1 << LayerIndex;
+	}
+
+	//The composited frame is already there unless it needs scaling or a layer
+	int Width, Height;
+	AsepriteExportFrameSize(Parsed, &Export, &Width, &Height);
+	uint8_t *Pixels = (uint8_t *)BatchFile->Frames[FrameNumber];
+	if (Export.LayerMask || Export.Scale > 1)
+	{
+		Pixels = (uint8_t *)malloc((size_t)Width*Height*4);
+		if (Pixels)
+			AsepriteExportFrame(Parsed, &Export, Pixels);
+	}
+	uint8_t *Field = Pixels ? (uint8_t *)malloc((size_t)Width*Height + 1) : 0;
+	if (!Field)
+		ExportFailFile(Exporter, File, "out of memory for a distance field");
+	else if (AsepriteComputeSDF(Pixels, Width, Height, Width*4, 0, Options->Spread, Field, Width))
+	{
+		char *Flat = ExportFlatName(File->Name);
+		char Suffix[32];
+		snprintf(Suffix, sizeof(Suffix), "_%d_sdf.tga", FrameNumber);
+		char *Path = Flat ? ExportJoinPath(Options->OutDir, Flat, Suffix) : 0;
+		if (!Path)
+			ExportFailFile(Exporter, File, "out of memory");
+		else if (!ExportWriteGrayTGA(Path, Field, Width, Height))
+			fprintf(stderr, "aseprite_export: couldn't write %s\n", Path);
+		free(Path);
+		free(Flat);
+	}
+	free(Field);
+	if (Pixels != BatchFile->Frames[FrameNumber])
+		free(Pixels);
+}
+
+// Runs on the batch workers, one task per frame: trims and scales the frame
+// into its own buffer, ready for packing.
+
+void
+ExportEncodeFrame(aseprite_batch_file *BatchFile, int FrameNumber)
+{
+	exporter *Exporter = (exporter *)BatchFile->UserData;
+	export_options *Options = &Exporter->Options;
+	export_file *File = ExportGetFile(BatchFile);
+	aseprite_file *Parsed = &BatchFile->File;
+
+	if (!ExportFitsScale(Parsed, Options->Scale))
+	{
+		ExportFailFile(Exporter, File, "too big for a TGA at this scale");
+		return;
+	}
+
+	//The frames of one file are encoded on several workers at once
+	AsepriteLock(&Exporter->Lock);
+	if (!File->Frames && !File->Failed)
+	{
+		File->Frames = (export_frame *)calloc(Parsed->NumFrames, sizeof(export_frame));
+		File->NumFrames = File->Frames ? Parsed->NumFrames : 0;
+	}
+	bool HasFrames = (File->Frames != 0);
+	AsepriteUnlock(&Exporter->Lock);
+	if (!HasFrames)
+	{
+		ExportFailFile(Exporter, File, "out of memory");
+		return;
+	}
+
+	int CanvasWidth = Parsed->Header.WidthInPixels;
+	int CanvasHeight = Parsed->Header.HeightInPixels;
+	uint8_t *Canvas = (uint8_t *)BatchFile->Frames[FrameNumber];
+	aseprite_rect Rect = {0, 0, CanvasWidth, CanvasHeight};
+	int *RowMinX = 0;
+	int *RowEndX = 0;
+	if (Options->MeshVertices)
+	{
+		RowMinX = (int *)malloc(sizeof(int)*CanvasHeight*2 + 1);
+		if (!RowMinX)
+		{
+			ExportFailFile(Exporter, File, "out of memory");
+			return;
+		}
+		RowEndX = RowMinX + CanvasHeight;
+	}
+	if (Options->Trim || RowMinX)
+	{
+		//One pass gives both the trimmed rect and the rows the mesh is made from
+		aseprite_rect Trimmed = AsepriteTrimRGBAEx(Canvas, CanvasWidth, CanvasHeight, CanvasWidth*4, RowMinX, RowEndX);
+		if (Options->Trim)
+			Rect = Trimmed;
+	}
+	export_frame *Frame = File->Frames + FrameNumber;
+	if (RowMinX)
+	{
+		AsepriteBuildSpriteMesh(Rect, RowMinX, RowEndX, Options->MeshVertices, &Frame->Mesh);
+		for (int Vertex = 0; Vertex < Frame->Mesh.NumVertices; Vertex++)
+		{
+			Frame->Mesh.Vertices[Vertex].X *= (float)Options->Scale;
+			Frame->Mesh.Vertices[Vertex].Y *= (float)Options->Scale;
+		}
+		free(RowMinX);
+	}
+	if (Options->Spread > 0.0f)
+		ExportWriteSDF(Exporter, BatchFile, FrameNumber);
+
+	int Scale = Options->Scale;
+	Frame->Duration = Parsed->Frames[FrameNumber].Header.FrameDuration;
+	Frame->TrimX = Rect.X*Scale;
+	Frame->TrimY = Rect.Y*Scale;
+	Frame->Width = Rect.Width*Scale;
+	Frame->Height = Rect.Height*Scale;
+	Frame->Page = -1;
+	if (Frame->Width == 0 || Frame->Height == 0)
+		return;
+
+	Frame->Pixels = (uint8_t *)malloc((size_t)Frame->Width*Frame->Height*4);
+	if (!Frame->Pixels)
+	{
+		ExportFailFile(Exporter, File, "out of memory");
+		return;
+	}
+	for (int Y = 0; Y < Frame->Height; Y++)
+	{
+		uint32_t *Source = (uint32_t *)(Canvas + ((size_t)(Rect.Y + Y/Scale)*CanvasWidth + Rect.X)*4);
+		uint32_t *Dest = (uint32_t *)(Frame->Pixels + (size_t)Y*Frame->Width*4);
+		for (int X = 0; X < Frame->Width; X++)
+			Dest[X] = Source[X/Scale];
+	}
+	Frame->Hash = AsepriteHashCacheKey(Frame->Pixels, (size_t)Frame->Width*Frame->Height*4, 0);
+
+	if (Options->FrameImages)
+	{
+		char *Flat = ExportFlatName(File->Name);
+		char Suffix[32];
+		snprintf(Suffix, sizeof(Suffix), "_%d.tga", FrameNumber);
+		char *Path = Flat ? ExportJoinPath(Options->OutDir, Flat, Suffix) : 0;
+		if (!Path)
+			ExportFailFile(Exporter, File, "out of memory");
+		else if (!ExportWriteTGA(Path, Frame->Pixels, Frame->Width, Frame->Height))
+			fprintf(stderr, "aseprite_export: couldn't write %s\n", Path);
+		free(Path);
+		free(Flat);
+	}
+}
+
+// Runs once per file after its frames: keeps the metadata (the parsed file is
+// freed when this returns) and writes the cooked blob.
+
+void
+ExportFinishFile(aseprite_batch_file *BatchFile)
+{
+	exporter *Exporter = (exporter *)BatchFile->UserData;
+	export_options *Options = &Exporter->Options;
+	export_file *File = ExportGetFile(BatchFile);
+	aseprite_file *Parsed = &BatchFile->File;
+	if (BatchFile->Status != AsepriteLoadStatus_Done)
+	{
+		fprintf(stderr, "aseprite_export: couldn't %s %s\n",
+				BatchFile->Status == AsepriteLoadStatus_ReadFailed ? "read" : "parse", File->Path);
+		File->Failed = true;
+		return;
+	}
+	//Files without frames never went through ExportEncodeFrame
+	if (!ExportFitsScale(Parsed, Options->Scale))
+		ExportFailFile(Exporter, File, "too big for a TGA at this scale");
+	if (File->Failed)
+		return;
+
+	int Scale = Options->Scale;
+	File->Width = Parsed->Header.WidthInPixels*Scale;
+	File->Height = Parsed->Header.HeightInPixels*Scale;
+
+	File->NumTags = Parsed->NumTags;
+	File->Tags = (export_tag *)calloc(Parsed->NumTags + 1, sizeof(export_tag));
+	for (int TagIndex = 0; TagIndex < Parsed->NumTags; TagIndex++)
+	{
+		aseprite_tag *Tag = Parsed->Tags + TagIndex;
+		File->Tags[TagIndex].Name = AsepriteCopyString(Tag->Name ? Tag->Name : "");
+		File->Tags[TagIndex].FromFrame = Tag->FromFrame;
+		File->Tags[TagIndex].ToFrame = Tag->ToFrame;
+		File->Tags[TagIndex].LoopDirection = Tag->LoopDirection;
+	}
+
+	File->NumSlices = Parsed->NumSlices;
+	File->Slices = (export_slice *)calloc(Parsed->NumSlices + 1, sizeof(export_slice));
+	for (int SliceIndex = 0; SliceIndex < Parsed->NumSlices; SliceIndex++)
+	{
+		aseprite_slice *Slice = Parsed->Slices + SliceIndex;
+		export_slice *Out = File->Slices + SliceIndex;
+		Out->Name = AsepriteCopyString(Slice->Name ? Slice->Name : "");
+		Out->NumKeys = Slice->NumKeys;
+		Out->Keys = (aseprite_slice_key *)malloc((Slice->NumKeys + 1)*sizeof(aseprite_slice_key));
+		for (int KeyIndex = 0; KeyIndex < Slice->NumKeys; KeyIndex++)
+		{
+			aseprite_slice_key Key = Parsed->SliceKeys[Slice->FirstKey + KeyIndex];
+			Key.X *= Scale;
+			Key.Y *= Scale;
+			Key.Width *= Scale;
+			Key.Height *= Scale;
+			Key.PivotX *= Scale;
+			Key.PivotY *= Scale;
+			Out->Keys[KeyIndex] = Key;
+		}
+	}
+
+	if (Options->Cook)
+	{
+		size_t Size = AsepriteSerialize(Parsed, 0, 0);
+		void *Blob = Size ? malloc(Size) : 0;
+		char *Flat = ExportFlatName(File->Name);
+		char *Path = Flat ? ExportJoinPath(Options->OutDir, Flat, ".asec") : 0;
+		FILE *Handle = (Path && Blob && AsepriteSerialize(Parsed, Blob, Size)) ? fopen(Path, "wb") : 0;
+		bool Written = Handle && fwrite(Blob, 1, Size, Handle) == Size;
+		if (Handle)
+			Written = (fclose(Handle) == 0) && Written;
+		if (!Path)
+			ExportFailFile(Exporter, File, "out of memory");
+		else if (!Written)
+			fprintf(stderr, "aseprite_export: couldn't write %s\n", Path);
+		free(Path);
+		free(Flat);
+		free(Blob);
+	}
+}
+
+// Points every frame at the first frame with the same pixels, so only that
+// one goes into the atlas.
+
+void
+ExportFindAliases(export_frame **Frames, int NumFrames)
+{
+	int NumSlots = 16;
+	while (NumSlots < NumFrames*2)
+		NumSlots *= 2;
+	export_frame **Slots = (export_frame **)calloc(NumSlots, sizeof(export_frame *));
+	for (int FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+	{
+		export_frame *Frame = Frames[FrameIndex];
+		uint32_t SlotIndex = (uint32_t)Frame->Hash.Hash[0] & (NumSlots - 1);
+		while (Slots[SlotIndex])
+		{
+			export_frame *Other = Slots[SlotIndex];
+			if (memcmp(&Other->Hash, &Frame->Hash, sizeof(Frame->Hash)) == 0 &&
+				Other->Width == Frame->Width && Other->Height == Frame->Height &&
+				memcmp(Other->Pixels, Frame->Pixels, (size_t)Frame->Width*Frame->Height*4) == 0)
+			{
+				Frame->Alias = Other;
+				break;
+			}
+			SlotIndex = (SlotIndex + 1) & (NumSlots - 1);
+		}
+		if (!Frame->Alias)
+			Slots[SlotIndex] = Frame;
+	}
+	free(Slots);
+}
+
+int
+ExportCompareHeights(const void *A, const void *B)
+{
+	export_frame *FrameA = *(export_frame **)A;
+	export_frame *FrameB = *(export_frame **)B;
+	if (FrameA->Height != FrameB->Height)
+		return FrameB->Height - FrameA->Height;
+	return FrameB->Width - FrameA->Width;
+}
+
+// Shelf packing: the frames go tallest first into rows across the page, and
+// a new page starts when a row doesn't fit.  A frame bigger than a page gets
+// a page of its own.  Pages are cropped to what they hold.
+
+void
+ExportPack(exporter *Exporter)
+{
+	int NumFrames = 0;
+	for (int FileIndex = 0; FileIndex < Exporter->NumFiles; FileIndex++)
+		NumFrames += Exporter->Files[FileIndex].NumFrames;
+	export_frame **Frames = (export_frame **)malloc((NumFrames + 1)*sizeof(export_frame *));
+	NumFrames = 0;
+	for (int FileIndex = 0; FileIndex < Exporter->NumFiles; FileIndex++)
+	{
+		export_file *File = Exporter->Files + FileIndex;
+		for (int FrameNumber = 0; !File->Failed && FrameNumber < File->NumFrames; FrameNumber++)
+		{
+			if (File->Frames[FrameNumber].Pixels)
+				Frames[NumFrames++] = File->Frames + FrameNumber;
+		}
+	}
+	ExportFindAliases(Frames, NumFrames);
+	qsort(Frames, NumFrames, sizeof(export_frame *), ExportCompareHeights);
+
+	int PageSize = Exporter->Options.PageSize;
+	int Padding = Exporter->Options.Padding;
+	int MaxPages = 0;
+	int Page = -1;
+	int ShelfX = 0, ShelfY = 0, ShelfHeight = 0;
+	for (int FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+	{
+		export_frame *Frame = Frames[FrameIndex];
+		if (Frame->Alias)
+			continue;
+
+		bool Oversized = (Frame->Width > PageSize || Frame->Height > PageSize);
+		if (ShelfX > 0 && ShelfX + Frame->Width > PageSize)
+		{
+			ShelfY += ShelfHeight + Padding;
+			ShelfX = 0;
+			ShelfHeight = 0;
+		}
+		if (Page < 0 || Oversized || ShelfY + Frame->Height > PageSize)
+		{
+			if (Exporter->NumPages == MaxPages)
+			{
+				MaxPages = MaxPages ? MaxPages*2 : 8;
+				Exporter->Pages = (export_page *)realloc(Exporter->Pages, MaxPages*sizeof(export_page));
+			}
+			Page = Exporter->NumPages++;
+			Exporter->Pages[Page].Width = 0;
+			Exporter->Pages[Page].Height = 0;
+			ShelfX = ShelfY = ShelfHeight = 0;
+		}
+
+		Frame->Page = Page;
+		Frame->X = ShelfX;
+		Frame->Y = ShelfY;
+		ShelfX += Frame->Width + Padding;
+		ShelfHeight = AsepriteMaxInt(ShelfHeight, Frame->Height);
+		export_page *Extent = Exporter->Pages + Page;
+		Extent->Width = AsepriteMaxInt(Extent->Width, Frame->X + Frame->Width);
+		Extent->Height = AsepriteMaxInt(Extent->Height, Frame->Y + Frame->Height);
+		//Nothing else goes on an oversized frame's page
+		if (Oversized)
+			ShelfY = PageSize + 1;
+	}
+
+	for (int FrameIndex = 0; FrameIndex < NumFrames; FrameIndex++)
+	{
+		export_frame *Frame = Frames[FrameIndex];
+		if (Frame->Alias)
+		{
+			Frame->Page = Frame->Alias->Page;
+			Frame->X = Frame->Alias->X;
+			Frame->Y = Frame->Alias->Y;
+		}
+	}
+	free(Frames);
+}
+
+bool
+ExportWritePages(exporter *Exporter)
+{
+	bool Result = true;
+	for (int Page = 0; Page < Exporter->NumPages; Page++)
+	{
+		export_page *Extent = Exporter->Pages + Page;
+		if (!ExportFitsTGA(Extent->Width, Extent->Height))
+		{
+			fprintf(stderr, "aseprite_export: page %d is %dx%d, too big for a TGA\n", Page, Extent->Width, Extent->Height);
+			Result = false;
+			continue;
+		}
+		uint8_t *Pixels = (uint8_t *)calloc((size_t)Extent->Width*Extent->Height + 1, 4);
+		if (!Pixels)
+		{
+			fprintf(stderr, "aseprite_export: out of memory for page %d\n", Page);
+			Result = false;
+			continue;
+		}
+		for (int FileIndex = 0; FileIndex < Exporter->NumFiles; FileIndex++)
+		{
+			export_file *File = Exporter->Files + FileIndex;
+			for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+			{
+				export_frame *Frame = File->Frames + FrameNumber;
+				if (Frame->Page != Page || Frame->Alias || !Frame->Pixels)
+					continue;
+				for (int Y = 0; Y < Frame->Height; Y++)
+					memcpy(Pixels + ((size_t)(Frame->Y + Y)*Extent->Width + Frame->X)*4,
+						   Frame->Pixels + (size_t)Y*Frame->Width*4, (size_t)Frame->Width*4);
+			}
+		}
+
+		char Suffix[32];
+		snprintf(Suffix, sizeof(Suffix), "_%d.tga", Page);
+		char *Path = ExportJoinPath(Exporter->Options.OutDir, Exporter->Options.Name, Suffix);
+		if (!Path)
+		{
+			fprintf(stderr, "aseprite_export: out of memory for page %d\n", Page);
+			Result = false;
+		}
+		else if (!ExportWriteTGA(Path, Pixels, Extent->Width, Extent->Height))
+		{
+			fprintf(stderr, "aseprite_export: couldn't write %s\n", Path);
+			Result = false;
+		}
+		free(Path);
+		free(Pixels);
+	}
+	return Result;
+}
+
+void
+ExportWriteJSONString(FILE *Handle, const char *String)
+{
+	fputc('"', Handle);
+	for (const uint8_t *At = (const uint8_t *)String; *At; At++)
+	{
+		if (*At == '"' || *At == '\\')
+			fprintf(Handle, "\\%c", *At);
+		else if (*At < 0x20)
+			fprintf(Handle, "\\u%04x", *At);
+		else
+			fputc(*At, Handle);
+	}
+	fputc('"', Handle);
+}
+
+const char *
+ExportLoopDirectionName(int LoopDirection)
+{
+	switch (LoopDirection)
+	{
+		case AsepriteLoopDirection_Reverse: return "reverse";
+		case AsepriteLoopDirection_PingPong: return "pingpong";
+		case AsepriteLoopDirection_PingPongReverse: return "pingpong_reverse";
+	}
+	return "forward";
+}
+
+void
+ExportWriteJSONMesh(exporter *Exporter, export_frame *Frame, FILE *Handle)
+{
+	aseprite_mesh_point UVs[ASEPRITE_MESH_MAX_VERTICES];
+	if (Frame->Page >= 0)
+	{
+		export_page *Page = Exporter->Pages + Frame->Page;
+		AsepriteGetSpriteMeshUVs(&Frame->Mesh, Frame->X, Frame->Y, Page->Width, Page->Height, 1.0f, UVs);
+	}
+	fprintf(Handle, ", \"vertices\": [");
+	for (int Vertex = 0; Vertex < Frame->Mesh.NumVertices; Vertex++)
+		fprintf(Handle, "%s%g, %g", Vertex ? ", " : "", Frame->Mesh.Vertices[Vertex].X, Frame->Mesh.Vertices[Vertex].Y);
+	fprintf(Handle, "], \"uvs\": [");
+	for (int Vertex = 0; Frame->Page >= 0 && Vertex < Frame->Mesh.NumVertices; Vertex++)
+		fprintf(Handle, "%s%g, %g", Vertex ? ", " : "", UVs[Vertex].X, UVs[Vertex].Y);
+	fprintf(Handle, "], \"indices\": [");
+	for (int Index = 0; Index < Frame->Mesh.NumIndices; Index++)
+		fprintf(Handle, "%s%d", Index ? ", " : "", Frame->Mesh.Indices[Index]);
+	fprintf(Handle, "]");
+}
+
+void
+ExportWriteJSON(exporter *Exporter, FILE *Handle)
+{
+	fprintf(Handle, "{\n\t\"pages\": [");
+	for (int Page = 0; Page < Exporter->NumPages; Page++)
+	{
+		char Suffix[32];
+		snprintf(Suffix, sizeof(Suffix), "_%d.tga", Page);
+		size_t Length = strlen(Exporter->Options.Name) + sizeof(Suffix);
+		char *Image = (char *)malloc(Length);
+		snprintf(Image, Length, "%s%s", Exporter->Options.Name, Suffix);
+		fprintf(Handle, "%s\n\t\t{\"image\": ", Page ? "," : "");
+		ExportWriteJSONString(Handle, Image);
+		fprintf(Handle, ", \"width\": %d, \"height\": %d}", Exporter->Pages[Page].Width, Exporter->Pages[Page].Height);
+		free(Image);
+	}
+	fprintf(Handle, "\n\t],\n\t\"files\": [");
+	bool First = true;
+	for (int FileIndex = 0; FileIndex < Exporter->NumFiles; FileIndex++)
+	{
+		export_file *File = Exporter->Files + FileIndex;
+		if (File->Failed)
+			continue;
+		fprintf(Handle, "%s\n\t\t{\n\t\t\t\"name\": ", First ? "" : ",");
+		First = false;
+		ExportWriteJSONString(Handle, File->Name);
+		fprintf(Handle, ",\n\t\t\t\"width\": %d,\n\t\t\t\"height\": %d,\n\t\t\t\"frames\": [", File->Width, File->Height);
+		for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+		{
+			export_frame *Frame = File->Frames + FrameNumber;
+			fprintf(Handle, "%s\n\t\t\t\t{\"page\": %d, \"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d, \"trimX\": %d, \"trimY\": %d, \"duration\": %d",
+					FrameNumber ? "," : "", Frame->Page, Frame->X, Frame->Y, Frame->Width, Frame->Height,
+					Frame->TrimX, Frame->TrimY, Frame->Duration);
+			if (Exporter->Options.MeshVertices)
+				ExportWriteJSONMesh(Exporter, Frame, Handle);
+			fprintf(Handle, "}");
+		}
+		fprintf(Handle, "\n\t\t\t],\n\t\t\t\"tags\": [");
+		for (int TagIndex = 0; TagIndex < File->NumTags; TagIndex++)
+		{
+			export_tag *Tag = File->Tags + TagIndex;
+			fprintf(Handle, "%s\n\t\t\t\t{\"name\": ", TagIndex ? "," : "");
+			ExportWriteJSONString(Handle, Tag->Name);
+			fprintf(Handle, ", \"from\": %d, \"to\": %d, \"direction\": \"%s\"}", Tag->FromFrame, Tag->ToFrame,
+					ExportLoopDirectionName(Tag->LoopDirection));
+		}
+		fprintf(Handle, "\n\t\t\t],\n\t\t\t\"slices\": [");
+		for (int SliceIndex = 0; SliceIndex < File->NumSlices; SliceIndex++)
+		{
+			export_slice *Slice = File->Slices + SliceIndex;
+			fprintf(Handle, "%s\n\t\t\t\t{\"name\": ", SliceIndex ? "," : "");
+			ExportWriteJSONString(Handle, Slice->Name);
+			fprintf(Handle, ", \"keys\": [");
+			for (int KeyIndex = 0; KeyIndex < Slice->NumKeys; KeyIndex++)
+			{
+				aseprite_slice_key *Key = Slice->Keys + KeyIndex;
+				fprintf(Handle, "%s{\"frame\": %d, \"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d, \"pivotX\": %d, \"pivotY\": %d}",
+						KeyIndex ? ", " : "", Key->FrameNumber, Key->X, Key->Y, Key->Width, Key->Height, Key->PivotX, Key->PivotY);
+			}
+			fprintf(Handle, "]}");
+		}
+		fprintf(Handle, "\n\t\t\t]\n\t\t}");
+	}
+	fprintf(Handle, "\n\t]\n}\n");
+}
+
+void
+ExportWriteU8(FILE *Handle, uint32_t Value)
+{
+	fputc((int)(Value & 0xFF), Handle);
+}
+
+void
+ExportWriteU16(FILE *Handle, uint32_t Value)
+{
+	ExportWriteU8(Handle, Value);
+	ExportWriteU8(Handle, Value >> 8);
+}
+
+void
+ExportWriteU32(FILE *Handle, uint32_t Value)
+{
+	ExportWriteU16(Handle, Value);
+	ExportWriteU16(Handle, Value >> 16);
+}
+
+void
+ExportWriteF32(FILE *Handle, float Value)
+{
+	uint32_t Bits;
+	memcpy(&Bits, &Value, sizeof(Bits));
+	ExportWriteU32(Handle, Bits);
+}
+
+void
+ExportWriteBinaryString(FILE *Handle, const char *String)
+{
+	size_t Length = strlen(String);
+	if (Length > 0xFFFF)
+		Length = 0xFFFF;
+	ExportWriteU16(Handle, (uint32_t)Length);
+	fwrite(String, 1, Length, Handle);
+}
+
+void
+ExportWriteBinary(exporter *Exporter, FILE *Handle)
+{
+	fwrite("ASEM", 1, 4, Handle);
+	ExportWriteU32(Handle, 2);
+	ExportWriteU32(Handle, Exporter->NumPages);
+	for (int Page = 0; Page < Exporter->NumPages; Page++)
+	{
+		ExportWriteU16(Handle, Exporter->Pages[Page].Width);
+		ExportWriteU16(Handle, Exporter->Pages[Page].Height);
+	}
+
+	int NumFiles = 0;
+	for (int FileIndex = 0; FileIndex < Exporter->NumFiles; FileIndex++)
+		NumFiles += !Exporter->Files[FileIndex].Failed;
+	ExportWriteU32(Handle, NumFiles);
+	for (int FileIndex = 0; FileIndex < Exporter->NumFiles; FileIndex++)
+	{
+		export_file *File = Exporter->Files + FileIndex;
+		if (File->Failed)
+			continue;
+		ExportWriteBinaryString(Handle, File->Name);
+		ExportWriteU16(Handle, File->Width);
+		ExportWriteU16(Handle, File->Height);
+		ExportWriteU32(Handle, File->NumFrames);
+		for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+		{
+			export_frame *Frame = File->Frames + FrameNumber;
+			ExportWriteU16(Handle, (uint32_t)Frame->Page);
+			ExportWriteU16(Handle, Frame->X);
+			ExportWriteU16(Handle, Frame->Y);
+			ExportWriteU16(Handle, Frame->Width);
+			ExportWriteU16(Handle, Frame->Height);
+			ExportWriteU16(Handle, (uint32_t)Frame->TrimX);
+			ExportWriteU16(Handle, (uint32_t)Frame->TrimY);
+			ExportWriteU16(Handle, Frame->Duration);
+			int NumVertices = (Frame->Page >= 0) ? Frame->Mesh.NumVertices : 0;
+			aseprite_mesh_point UVs[ASEPRITE_MESH_MAX_VERTICES];
+			if (NumVertices)
+			{
+				export_page *Page = Exporter->Pages + Frame->Page;
+				AsepriteGetSpriteMeshUVs(&Frame->Mesh, Frame->X, Frame->Y, Page->Width, Page->Height, 1.0f, UVs);
+			}
+			ExportWriteU8(Handle, NumVertices);
+			for (int Vertex = 0; Vertex < NumVertices; Vertex++)
+			{
+				ExportWriteF32(Handle, Frame->Mesh.Vertices[Vertex].X);
+				ExportWriteF32(Handle, Frame->Mesh.Vertices[Vertex].Y);
+				ExportWriteF32(Handle, UVs[Vertex].X);
+				ExportWriteF32(Handle, UVs[Vertex].Y);
+			}
+		}
+		ExportWriteU32(Handle, File->NumTags);
+		for (int TagIndex = 0; TagIndex < File->NumTags; TagIndex++)
+		{
+			export_tag *Tag = File->Tags + TagIndex;
+			ExportWriteBinaryString(Handle, Tag->Name);
+			ExportWriteU16(Handle, Tag->FromFrame);
+			ExportWriteU16(Handle, Tag->ToFrame);
+			ExportWriteU8(Handle, Tag->LoopDirection);
+		}
+		ExportWriteU32(Handle, File->NumSlices);
+		for (int SliceIndex = 0; SliceIndex < File->NumSlices; SliceIndex++)
+		{
+			export_slice *Slice = File->Slices + SliceIndex;
+			ExportWriteBinaryString(Handle, Slice->Name);
+			ExportWriteU32(Handle, Slice->NumKeys);
+			for (int KeyIndex = 0; KeyIndex < Slice->NumKeys; KeyIndex++)
+			{
+				aseprite_slice_key *Key = Slice->Keys + KeyIndex;
+				ExportWriteU32(Handle, Key->FrameNumber);
+				ExportWriteU32(Handle, (uint32_t)Key->X);
+				ExportWriteU32(Handle, (uint32_t)Key->Y);
+				ExportWriteU32(Handle, Key->Width);
+				ExportWriteU32(Handle, Key->Height);
+				ExportWriteU32(Handle, (uint32_t)Key->PivotX);
+				ExportWriteU32(Handle, (uint32_t)Key->PivotY);
+			}
+		}
+	}
+}
+
+bool
+ExportWriteMetadata(exporter *Exporter)
+{
+	char *Path = ExportJoinPath(Exporter->Options.OutDir, Exporter->Options.Name, Exporter->Options.Binary ? ".bin" : ".json");
+	if (!Path)
+	{
+		fprintf(stderr, "aseprite_export: out of memory for the metadata\n");
+		return false;
+	}
+	FILE *Handle = fopen(Path, "wb");
+	bool Result = (Handle != 0);
+	if (Handle)
+	{
+		if (Exporter->Options.Binary)
+			ExportWriteBinary(Exporter, Handle);
+		else
+			ExportWriteJSON(Exporter, Handle);
+		Result = (ferror(Handle) == 0);
+		Result = (fclose(Handle) == 0) && Result;
+	}
+	if (!Result)
+		fprintf(stderr, "aseprite_export: couldn't write %s\n", Path);
+	free(Path);
+	return Result;
+}
+
+void
+ExportFree(exporter *Exporter)
+{
+	for (int FileIndex = 0; FileIndex < Exporter->NumFiles; FileIndex++)
+	{
+		export_file *File = Exporter->Files + FileIndex;
+		for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+			free(File->Frames[FrameNumber].Pixels);
+		for (int TagIndex = 0; TagIndex < File->NumTags; TagIndex++)
+			free(File->Tags[TagIndex].Name);
+		for (int SliceIndex = 0; SliceIndex < File->NumSlices; SliceIndex++)
+		{
+			free(File->Slices[SliceIndex].Name);
+			free(File->Slices[SliceIndex].Keys);
+		}
+		free(File->Frames);
+		free(File->Tags);
+		free(File->Slices);
+		free(File->Path);
+		free(File->Name);
+	}
+	free(Exporter->Files);
+	free(Exporter->Pages);
+}
+
+void
+ExportUsage()
+{
+	fprintf(stderr,
+			"usage: aseprite_export [options] <file.ase or directory>...\n"
+			"  -o <dir>     output directory (default .)\n"
+			"  -n <name>    name of the atlas and metadata files (default atlas)\n"
+			"  -j <count>   worker threads (default one per CPU)\n"
+			"  -p <size>    largest atlas page (default 2048)\n"
+			"  -P <pixels>  padding between frames in the atlas (default 1)\n"
+			"  -s <scale>   whole number upscale (default 1)\n"
+			"  -t           trim transparent borders off the frames\n"
+			"  -m <count>   a convex mesh per frame with at most this many vertices\n"
+			"  -b           binary metadata instead of JSON\n"
+			"  -c           write a cooked blob per file\n"
+			"  -f           write every frame as its own TGA\n"
+			"  -d <spread>  write a signed distance field of every frame\n"
+			"  -l <layer>   take the distance fields from just this layer\n"
+			"  -v           print what was done and how long it took\n");
+}
+
+int
+main(int ArgCount, char **Args)
+{
+	exporter Exporter = {};
+	export_options *Options = &Exporter.Options;
+	Options->OutDir = ".";
+	Options->Name = "atlas";
+	Options->PageSize = 2048;
+	Options->Padding = 1;
+	Options->Scale = 1;
+
+	const char **Inputs = (const char **)malloc(ArgCount*sizeof(char *));
+	int NumInputs = 0;
+	for (int ArgIndex = 1; ArgIndex < ArgCount; ArgIndex++)
+	{
+		const char *Arg = Args[ArgIndex];
+		if (Arg[0] != '-' || Arg[1] == '\0')
+		{
+			Inputs[NumInputs++] = Arg;
+			continue;
+		}
+
+		char Flag = Arg[1];
+		const char *Value = 0;
+		if (strchr("onjpPsmdl", Flag))
+		{
+			//Either -j8 or -j 8
+			Value = Arg[2] ? Arg + 2 : (ArgIndex + 1 < ArgCount ? Args[++ArgIndex] : 0);
+			if (!Value)
+			{
+				ExportUsage();
+				return 1;
+			}
+		}
+		switch (Flag)
+		{
+			case 'o': Options->OutDir = Value; break;
+			case 'n': Options->Name = Value; break;
+			case 'j': Options->NumThreads = atoi(Value); break;
+			case 'p': Options->PageSize = atoi(Value); break;
+			case 'P': Options->Padding = atoi(Value); break;
+			case 's': Options->Scale = atoi(Value); break;
+			case 'm': Options->MeshVertices = atoi(Value); break;
+			case 'd': Options->Spread = (float)atof(Value); break;
+			case 'l': Options->Layer = Value; break;
+			case 't': Options->Trim = true; break;
+			case 'b': Options->Binary = true; break;
+			case 'c': Options->Cook = true; break;
+			case 'f': Options->FrameImages = true; break;
+			case 'v': Options->Verbose = true; break;
+			default:
+			{
+				ExportUsage();
+				return 1;
+			}
+		}
+	}
+	if (NumInputs == 0 || Options->PageSize <= 0 || Options->Padding < 0 || Options->Scale <= 0 || Options->Scale > 0xFFFF || Options->NumThreads < 0 || Options->MeshVertices < 0 ||
+		Options->Spread < 0.0f || (Options->Layer && Options->Spread == 0.0f))
+	{
+		ExportUsage();
+		return 1;
+	}
+
+	double StartTime = ExportSeconds();
+	for (int InputIndex = 0; InputIndex < NumInputs; InputIndex++)
+	{
+		const char *Input = Inputs[InputIndex];
+#ifdef _WIN32
+		DWORD Attributes = GetFileAttributesA(Input);
+		bool IsDirectory = (Attributes != INVALID_FILE_ATTRIBUTES && (Attributes & FILE_ATTRIBUTE_DIRECTORY));
+#else
+		struct stat Info;
+		bool IsDirectory = (stat(Input, &Info) == 0 && S_ISDIR(Info.st_mode));
+#endif
+		if (IsDirectory)
+		{
+			ExportAddDirectory(&Exporter, Input, "");
+		}
+		else
+		{
+			const char *Slash = strrchr(Input, '/');
+			const char *Backslash = strrchr(Input, '\\');
+			if (Backslash > Slash)
+				Slash = Backslash;
+			ExportAddFile(&Exporter, Input, Slash ? Slash + 1 : Input);
+		}
+	}
+	free(Inputs);
+	if (Exporter.NumFiles == 0)
+	{
+		fprintf(stderr, "aseprite_export: no .ase files found\n");
+		return 1;
+	}
+	//Sorted so the output doesn't depend on the order the file system lists them
+	qsort(Exporter.Files, Exporter.NumFiles, sizeof(export_file), ExportCompareFiles);
+#ifdef _WIN32
+	int Made = _mkdir(Options->OutDir);
+#else
+	int Made = mkdir(Options->OutDir, 0777);
+#endif
+	if (Made != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "aseprite_export: couldn't create %s: %s\n", Options->OutDir, strerror(errno));
+		return 1;
+	}
+
+	const char **Paths = (const char **)malloc(Exporter.NumFiles*sizeof(char *));
+	for (int FileIndex = 0; FileIndex < Exporter.NumFiles; FileIndex++)
+		Paths[FileIndex] = Exporter.Files[FileIndex].Path;
+
+	aseprite_batch_request Batch = {0};
+	Batch.Paths = Paths;
+	Batch.NumPaths = Exporter.NumFiles;
+	Batch.NumThreads = Options->NumThreads;
+	Batch.MemoryBudget = (size_t)1 << 30;
+	Batch.EncodeFrame = ExportEncodeFrame;
+	Batch.FinishFile = ExportFinishFile;
+	Batch.UserData = &Exporter;
+	AsepriteInitMutex(&Exporter.Lock);
+	double BatchTime = ExportSeconds();
+	bool Result = AsepriteRunBatch(&Batch);
+	AsepriteDestroyMutex(&Exporter.Lock);
+	free(Paths);
+	if (!Result)
+	{
+		fprintf(stderr, "aseprite_export: couldn't start the worker threads\n");
+		return 1;
+	}
+
+	double PackTime = ExportSeconds();
+	ExportPack(&Exporter);
+	double WriteTime = ExportSeconds();
+	Result = ExportWritePages(&Exporter);
+	Result = ExportWriteMetadata(&Exporter) && Result;
+	double EndTime = ExportSeconds();
+
+	int NumFailed = 0, NumFrames = 0;
+	for (int FileIndex = 0; FileIndex < Exporter.NumFiles; FileIndex++)
+	{
+		NumFailed += Exporter.Files[FileIndex].Failed;
+		NumFrames += Exporter.Files[FileIndex].NumFrames;
+	}
+	if (Options->Verbose)
+	{
+		printf("%d files (%d failed), %d frames, %d atlas pages\n", Exporter.NumFiles, NumFailed, NumFrames, Exporter.NumPages);
+		printf("  scan    %8.2f ms\n", (BatchTime - StartTime)*1000.0);
+		printf("  batch   %8.2f ms (parse, inflate, composite, trim)\n", (PackTime - BatchTime)*1000.0);
+		printf("  pack    %8.2f ms\n", (WriteTime - PackTime)*1000.0);
+		printf("  write   %8.2f ms\n", (EndTime - WriteTime)*1000.0);
+		printf("  total   %8.2f ms\n", (EndTime - StartTime)*1000.0);
+	}
+	ExportFree(&Exporter);
+	return (Result && NumFailed == 0) ? 0 : 1;
+}
@@ -11,7 +11,7 @@
  *
  * TODO:
  *   Implement remaining blending modes (Hue, Saturation, Color, Luminosity)
- *   Read chunk data (chunks are packets of data stored in the file) other than frame/layer/cel/palette
+ *   Read chunk data (chunks are packets of data stored in the file) other than frame/layer/cel/palette/slice/tags/user data
  *   Parse cel data of the 'linked' type
  *   Implement 16-bit (grayscale) color mode
  *
@@ -33,6 +33,10 @@
  * Requires a few c standard library includes
  *  - #include <stdlib.h> (malloc, realloc)
  *  - #include <stdint.h> (for uint16_t, uint8_t, etc.)
+ *  - #include <string.h> (memcpy, memset, strcmp)
+ *  - #include <math.h> (powf, sqrtf, floorf and lrintf, only used to build the linear-light lookup tables
+ *    and by AsepriteComputeSDF)
+ *  - #include <stdio.h> (fopen, only used by AsepriteLoadAsync and the export cache)
  *
  * Example:
  *
@@ -46,6 +50,81 @@
  * free(FrameData);
  * ...
  *
+ * Collision masks (1 bit per pixel, rows padded to 64-bit words):
+ *
+ * ...
+ * aseprite_mask Mask;
+ * AsepriteGetFrameAlphaMask(&ParsedFile, 0, -1, 127, &Mask);			//all visible layers, alpha > 127
+ * bool Hit = AsepriteMasksOverlap(&Mask, PlayerX, PlayerY, &OtherMask, OtherX, OtherY);
+ * AsepriteFreeMask(&Mask);
+ * ...
+ *
+ * Rendering without heap allocation (the caller owns the scratch memory):
+ *
+ * ...
+ * aseprite_scratch Scratch = {MyFrameArena, MyFrameArenaSize, 0};
+ * aseprite_render_options Options = {0};
+ * Options.Scratch = &Scratch;
+ * Assert(AsepriteStreamFrameScratchSize(&ParsedFile, 0) <= MyFrameArenaSize);
+ * AsepriteStreamFrameRGBA(&ParsedFile, 0, FrameData, Width, Height, 0, 0, &Options);
+ * ...
+ *
+ * Caching parsed files (no inflating when they are loaded again):
+ *
+ * ...
+ * size_t CacheSize = AsepriteSerialize(&ParsedFile, 0, 0);
+ * AsepriteSerialize(&ParsedFile, CacheData, CacheSize);				//then write CacheData out
+ * ...
+ * aseprite_file *Cached = AsepriteDeserializeInPlace(MappedCacheFile, MappedSize);	//0 if stale or damaged
+ * ...
+ *
+ * Exporting many files on all cores:
+ *
+ * ...
+ * aseprite_batch_request Batch = {0};
+ * Batch.Paths = Paths;
+ * Batch.NumPaths = NumPaths;
+ * Batch.MemoryBudget = 512 << 20;
+ * Batch.EncodeFrame = MyEncodeFrame;								//called from worker threads
+ * Batch.FinishFile = MyFinishFile;
+ * AsepriteRunBatch(&Batch);
+ * ...
+ *
+ * Skipping exports whose inputs haven't changed:
+ *
+ * ...
+ * aseprite_export_options Export = {0};
+ * Export.FrameNumber = 3;
+ * Export.Scale = 2;
+ * aseprite_cached_output Output;
+ * if (AsepriteExportFrameCached("build/cache", FileData, FileSize, &Export, &Output))	//only parses on a miss
+ * {
+ *     MyWriteImage(Output.Data, Output.Size);
+ *     AsepriteReleaseCachedOutput(&Output);
+ * }
+ * ...
+ *
+ * Signed distance field of one layer (see AsepriteComputeSDF):
+ *
+ * ...
+ * aseprite_render_options Options = {0};
+ * Options.LayerMask = (uint64_t)1 << AsepriteFindLayer(&ParsedFile, "outline");
+ * AsepriteGetEntireFrameRGBAEx(&ParsedFile, 0, FrameData, Width, Height, 0, 0, &Options);
+ * AsepriteComputeSDF(FrameData, Width, Height, Width*4, 0, 8.0f, Field, Width);	//edge at 128, 8 pixels to 0 or 255
+ * ...
+ *
+ * Incremental builds (see AsepriteCompareManifestEntry):
+ *
+ * ...
+ * aseprite_manifest Previous, Current = {};
+ * AsepriteReadManifest("build/sprites.manifest", &Previous);		//empty on the first build
+ * int NumFrames = AsepriteHashFrameInputs(FileData, FileSize, FrameInputs, MaxFrames);
+ * aseprite_export_change Change = AsepriteCompareManifestEntry(AsepriteFindManifestEntry(&Previous, Path),
+ *                                                              InputHash, OptionsHash, FrameInputs, NumFrames, FrameChanged);
+ * ...export the frames marked in FrameChanged, then record the file in Current...
+ * AsepriteWriteManifest(&Current, "build/sprites.manifest");
+ * ...
+ *
  */
 
 #ifdef ASEPRITE_NO_DEBUG_OUTPUT
@@ -57,11 +136,37 @@
 static void
 printf_nooutput(const char *OutString, ...) {}
 
-#pragma pack(1)
+/*
+ * SSE2 is used for the alpha mask generation and signed distance fields when
+ * the compiler targets it.
+ * Define ASEPRITE_NO_SIMD to force the plain C paths.
+ */
+
+#if !defined(ASEPRITE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ASEPRITE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/*
+ * The asynchronous loader starts its own threads (when the caller doesn't
+ * hand it an executor) and uses atomics for cancellation and reference counts.
+ * The export cache maps its files into memory.
+ */
 
-//The following structs are laid out exactly as described in the file spec.
-//pragma pack is used to tell the compiler not to insert extra spacing
-//around the members of the struct
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//The following structs hold the fields of the headers described in the file
+//spec.  They use the compiler's normal layout; the headers are read from the
+//file field by field (see AsepriteReadHeader etc. below), so the sizes the
+//headers take up in the file are given separately.
 
 struct aseprite_header
 {
@@ -73,11 +178,8 @@ struct aseprite_header
 	uint16_t ColorDepth;
 	uint32_t Flags;
 	uint16_t Speed;
-	uint32_t SpacerA[2];
 	uint8_t TransparentPaletteEntry;
-	uint8_t SpacerB[3];
 	uint16_t NumberOfColors;
-	uint8_t SpacerC[94];
 };
 
 struct aseprite_frame_header
@@ -86,7 +188,6 @@ struct aseprite_frame_header
 	uint16_t MagicNumber;
 	uint16_t ChunksInFrame;
 	uint16_t FrameDuration;
-	uint8_t Spacer[6];
 };
 
 struct aseprite_chunk_header
@@ -100,7 +201,6 @@ struct aseprite_palette_header
 	uint32_t NewPaletteSize;
 	uint32_t FirstColorIndexToChange;
 	uint32_t LastColorIndexToChange;
-	uint8_t Spacer[8];
 };
 
 struct aseprite_palette_entry
@@ -121,7 +221,6 @@ struct aseprite_layer_header
 	uint16_t DefaultLayerHeightInPixels; //Ignored
 	uint16_t BlendMode;
 	uint8_t Opacity;
-	uint8_t Spacer[3];
 };
 
 struct aseprite_cel_header
@@ -131,26 +230,441 @@ struct aseprite_cel_header
 	int16_t YPos;
 	uint8_t Opacity;
 	uint16_t CelType;
-	uint8_t Spacer[7];
 };
 
-#pragma options align=reset
+struct aseprite_slice_header
+{
+	uint32_t NumKeys;
+	uint32_t Flags;
+};
+
+struct aseprite_slice_key_header
+{
+	uint32_t FrameNumber;
+	int32_t XOrigin;
+	int32_t YOrigin;
+	uint32_t Width;
+	uint32_t Height;
+};
+
+struct aseprite_slice_center
+{
+	int32_t XPos;
+	int32_t YPos;
+	uint32_t Width;
+	uint32_t Height;
+};
+
+struct aseprite_slice_pivot
+{
+	int32_t XPos;
+	int32_t YPos;
+};
+
+struct aseprite_tileset_header
+{
+	uint32_t TilesetID;
+	uint32_t Flags;
+	uint32_t NumTiles;
+	uint16_t TileWidth;
+	uint16_t TileHeight;
+	int16_t BaseIndex;
+};
+
+struct aseprite_tilemap_header
+{
+	uint16_t WidthInTiles;
+	uint16_t HeightInTiles;
+	uint16_t BitsPerTile;
+	uint32_t TileIDMask;
+	uint32_t XFlipMask;
+	uint32_t YFlipMask;
+	uint32_t DiagonalFlipMask;
+};
+
+struct aseprite_color_profile_header
+{
+	uint16_t Type;
+	uint16_t Flags;
+	uint32_t FixedGamma;
+};
+
+struct aseprite_tags_header
+{
+	uint16_t NumTags;
+};
+
+struct aseprite_tag_header
+{
+	uint16_t FromFrame;
+	uint16_t ToFrame;
+	uint8_t LoopDirection;
+	uint16_t Repeat;
+	uint8_t Color[3];
+};
+
+//Sizes of the headers in the file
+
+#define ASEPRITE_HEADER_SIZE 128
+#define ASEPRITE_FRAME_HEADER_SIZE 16
+#define ASEPRITE_CHUNK_HEADER_SIZE 6
+#define ASEPRITE_PALETTE_HEADER_SIZE 20
+#define ASEPRITE_PALETTE_ENTRY_SIZE 6
+#define ASEPRITE_LAYER_HEADER_SIZE 16
+#define ASEPRITE_CEL_HEADER_SIZE 16
+#define ASEPRITE_SLICE_HEADER_SIZE 12
+#define ASEPRITE_SLICE_KEY_HEADER_SIZE 20
+#define ASEPRITE_SLICE_CENTER_SIZE 16
+#define ASEPRITE_SLICE_PIVOT_SIZE 8
+#define ASEPRITE_TILESET_HEADER_SIZE 32
+#define ASEPRITE_TILEMAP_HEADER_SIZE 32
+#define ASEPRITE_COLOR_PROFILE_HEADER_SIZE 16
+#define ASEPRITE_TAGS_HEADER_SIZE 10
+#define ASEPRITE_TAG_HEADER_SIZE 17
+
+// Little endian reads from any address.  memcpy lets the compiler use a plain
+// (unaligned) load on targets that allow it, which is all of the little endian
+// ones this is likely to run on.
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define ASEPRITE_BIG_ENDIAN 1
+#endif
+
+inline uint8_t
+AsepriteReadU8(const void *Data)
+{
+	return *(const uint8_t *)Data;
+}
+
+inline uint16_t
+AsepriteReadU16(const void *Data)
+{
+#ifdef ASEPRITE_BIG_ENDIAN
+	const uint8_t *Bytes = (const uint8_t *)Data;
+	return (uint16_t)(Bytes[0] | (Bytes[1] << 8));
+#else
+	uint16_t Result;
+	memcpy(&Result, Data, sizeof(Result));
+	return Result;
+#endif
+}
+
+inline uint32_t
+AsepriteReadU32(const void *Data)
+{
+#ifdef ASEPRITE_BIG_ENDIAN
+	const uint8_t *Bytes = (const uint8_t *)Data;
+	return (uint32_t)Bytes[0] | ((uint32_t)Bytes[1] << 8) | ((uint32_t)Bytes[2] << 16) | ((uint32_t)Bytes[3] << 24);
+#else
+	uint32_t Result;
+	memcpy(&Result, Data, sizeof(Result));
+	return Result;
+#endif
+}
+
+inline int16_t
+AsepriteReadS16(const void *Data)
+{
+	return (int16_t)AsepriteReadU16(Data);
+}
+
+inline int32_t
+AsepriteReadS32(const void *Data)
+{
+	return (int32_t)AsepriteReadU32(Data);
+}
+
+// Header readers.  Each takes a pointer to the header in the file; the field
+// offsets are the ones in the spec.
+
+inline aseprite_header
+AsepriteReadHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_header Result;
+	Result.FileSize = AsepriteReadU32(At + 0);
+	Result.MagicNumber = AsepriteReadU16(At + 4);
+	Result.Frames = AsepriteReadU16(At + 6);
+	Result.WidthInPixels = AsepriteReadU16(At + 8);
+	Result.HeightInPixels = AsepriteReadU16(At + 10);
+	Result.ColorDepth = AsepriteReadU16(At + 12);
+	Result.Flags = AsepriteReadU32(At + 14);
+	Result.Speed = AsepriteReadU16(At + 18);
+	Result.TransparentPaletteEntry = AsepriteReadU8(At + 28);
+	Result.NumberOfColors = AsepriteReadU16(At + 32);
+	return Result;
+}
+
+inline aseprite_frame_header
+AsepriteReadFrameHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_frame_header Result;
+	Result.BytesInFrame = AsepriteReadU32(At + 0);
+	Result.MagicNumber = AsepriteReadU16(At + 4);
+	Result.ChunksInFrame = AsepriteReadU16(At + 6);
+	Result.FrameDuration = AsepriteReadU16(At + 8);
+	return Result;
+}
+
+inline aseprite_chunk_header
+AsepriteReadChunkHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_chunk_header Result;
+	Result.ChunkSize = AsepriteReadU32(At + 0);
+	Result.ChunkType = AsepriteReadU16(At + 4);
+	return Result;
+}
+
+inline aseprite_palette_header
+AsepriteReadPaletteHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_palette_header Result;
+	Result.NewPaletteSize = AsepriteReadU32(At + 0);
+	Result.FirstColorIndexToChange = AsepriteReadU32(At + 4);
+	Result.LastColorIndexToChange = AsepriteReadU32(At + 8);
+	return Result;
+}
+
+inline aseprite_palette_entry
+AsepriteReadPaletteEntry(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_palette_entry Result;
+	Result.Flags = AsepriteReadU16(At + 0);
+	Result.Red = AsepriteReadU8(At + 2);
+	Result.Green = AsepriteReadU8(At + 3);
+	Result.Blue = AsepriteReadU8(At + 4);
+	Result.Alpha = AsepriteReadU8(At + 5);
+	return Result;
+}
+
+inline aseprite_layer_header
+AsepriteReadLayerHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_layer_header Result;
+	Result.Flags = AsepriteReadU16(At + 0);
+	Result.LayerType = AsepriteReadU16(At + 2);
+	Result.LayerChild = AsepriteReadU16(At + 4);
+	Result.DefaultLayerWidthInPixels = AsepriteReadU16(At + 6);
+	Result.DefaultLayerHeightInPixels = AsepriteReadU16(At + 8);
+	Result.BlendMode = AsepriteReadU16(At + 10);
+	Result.Opacity = AsepriteReadU8(At + 12);
+	return Result;
+}
+
+inline aseprite_cel_header
+AsepriteReadCelHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_cel_header Result;
+	Result.LayerIndex = AsepriteReadU16(At + 0);
+	Result.XPos = AsepriteReadS16(At + 2);
+	Result.YPos = AsepriteReadS16(At + 4);
+	Result.Opacity = AsepriteReadU8(At + 6);
+	Result.CelType = AsepriteReadU16(At + 7);
+	return Result;
+}
+
+inline aseprite_slice_header
+AsepriteReadSliceHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_slice_header Result;
+	Result.NumKeys = AsepriteReadU32(At + 0);
+	Result.Flags = AsepriteReadU32(At + 4);
+	return Result;
+}
+
+inline aseprite_slice_key_header
+AsepriteReadSliceKeyHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_slice_key_header Result;
+	Result.FrameNumber = AsepriteReadU32(At + 0);
+	Result.XOrigin = AsepriteReadS32(At + 4);
+	Result.YOrigin = AsepriteReadS32(At + 8);
+	Result.Width = AsepriteReadU32(At + 12);
+	Result.Height = AsepriteReadU32(At + 16);
+	return Result;
+}
+
+inline aseprite_slice_center
+AsepriteReadSliceCenter(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_slice_center Result;
+	Result.XPos = AsepriteReadS32(At + 0);
+	Result.YPos = AsepriteReadS32(At + 4);
+	Result.Width = AsepriteReadU32(At + 8);
+	Result.Height = AsepriteReadU32(At + 12);
+	return Result;
+}
+
+inline aseprite_slice_pivot
+AsepriteReadSlicePivot(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_slice_pivot Result;
+	Result.XPos = AsepriteReadS32(At + 0);
+	Result.YPos = AsepriteReadS32(At + 4);
+	return Result;
+}
+
+inline aseprite_tileset_header
+AsepriteReadTilesetHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_tileset_header Result;
+	Result.TilesetID = AsepriteReadU32(At + 0);
+	Result.Flags = AsepriteReadU32(At + 4);
+	Result.NumTiles = AsepriteReadU32(At + 8);
+	Result.TileWidth = AsepriteReadU16(At + 12);
+	Result.TileHeight = AsepriteReadU16(At + 14);
+	Result.BaseIndex = AsepriteReadS16(At + 16);
+	return Result;
+}
+
+inline aseprite_tilemap_header
+AsepriteReadTilemapHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_tilemap_header Result;
+	Result.WidthInTiles = AsepriteReadU16(At + 0);
+	Result.HeightInTiles = AsepriteReadU16(At + 2);
+	Result.BitsPerTile = AsepriteReadU16(At + 4);
+	Result.TileIDMask = AsepriteReadU32(At + 6);
+	Result.XFlipMask = AsepriteReadU32(At + 10);
+	Result.YFlipMask = AsepriteReadU32(At + 14);
+	Result.DiagonalFlipMask = AsepriteReadU32(At + 18);
+	return Result;
+}
+
+inline aseprite_color_profile_header
+AsepriteReadColorProfileHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_color_profile_header Result;
+	Result.Type = AsepriteReadU16(At + 0);
+	Result.Flags = AsepriteReadU16(At + 2);
+	Result.FixedGamma = AsepriteReadU32(At + 4);
+	return Result;
+}
+
+inline aseprite_tags_header
+AsepriteReadTagsHeader(const void *Data)
+{
+	aseprite_tags_header Result;
+	Result.NumTags = AsepriteReadU16(Data);
+	return Result;
+}
+
+inline aseprite_tag_header
+AsepriteReadTagHeader(const void *Data)
+{
+	const uint8_t *At = (const uint8_t *)Data;
+	aseprite_tag_header Result;
+	Result.FromFrame = AsepriteReadU16(At + 0);
+	Result.ToFrame = AsepriteReadU16(At + 2);
+	Result.LoopDirection = AsepriteReadU8(At + 4);
+	Result.Repeat = AsepriteReadU16(At + 5);
+	Result.Color[0] = AsepriteReadU8(At + 13);
+	Result.Color[1] = AsepriteReadU8(At + 14);
+	Result.Color[2] = AsepriteReadU8(At + 15);
+	return Result;
+}
+
 
 // The following structs are things that I defined myself to hold all the relevant
 // data for the file.
 
+// Coverage stats for a cel, gathered while the cel data is decoded so that
+// nothing downstream has to rescan the pixels.  The bounds are relative to the
+// cel data (not the canvas), and Max is exclusive.  An empty cel has no
+// non-transparent pixels at all, an opaque cel has no transparent or
+// translucent pixels.
+
+struct aseprite_cel_stats
+{
+	int MinX;
+	int MinY;
+	int MaxX;
+	int MaxY;
+	bool IsEmpty;
+	bool IsOpaque;
+};
+
+// User data is attached to a layer, cel, tag, slice or the sprite itself.
+// TextOffset points into the file's string pool (see AsepriteGetUserDataText).
+// Flags is zero when nothing was attached.
+
+struct aseprite_user_data
+{
+	uint32_t Flags;
+	uint32_t TextOffset;
+	uint32_t TextLength;
+	uint8_t R8, G8, B8, A8;
+};
+
+// Bits of a tilemap entry.  Tile ID 0 is always the empty tile.
+
+struct aseprite_tile_masks
+{
+	uint32_t TileID;
+	uint32_t XFlip;
+	uint32_t YFlip;
+	uint32_t DiagonalFlip;
+};
+
+// A cel of a tilemap layer (Header.CelType == AsepriteCelType_CompressedTilemap)
+// is kept as its grid of tiles: Data holds DataWidth x DataHeight uint32_t
+// entries and the pixels come from the layer's tileset.  Its stats are in
+// pixels, relative to the cel position, like any other cel.
+
 struct aseprite_layer
 {
 	aseprite_cel_header Header;
 	int DataWidth;
 	int DataHeight;
 	void *Data;
+	aseprite_cel_stats Stats;
+	aseprite_user_data UserData;
+	aseprite_tile_masks TileMasks;
+	//Set instead of Data for compressed cels parsed with AsepriteParseFlags_KeepCompressedCels
+	void *CompressedData;
+	int CompressedSize;
+	//Data holds runs rather than pixels (see AsepriteEncodeCelRuns)
+	bool IsRunLength;
+	//Data holds tiles rather than pixels (see AsepriteEncodeCelTiles)
+	bool IsTiled;
 };
 
 struct aseprite_layer_info
 {
 	aseprite_layer_header Header;
 	char *Name;
+	aseprite_user_data UserData;
+	uint32_t TilesetIndex;
+};
+
+// The tiles of a tileset are decoded once, stacked vertically in Pixels
+// (TileWidth x TileHeight*NumTiles, in the file's color depth), and shared by
+// every tilemap cel that uses them.  Tilesets stored in external files have
+// no Pixels.
+
+struct aseprite_tileset
+{
+	uint32_t ID;
+	uint32_t Flags;
+	int NumTiles;
+	int TileWidth;
+	int TileHeight;
+	int BaseIndex;
+	char *Name;
+	void *Pixels;
 };
 
 struct aseprite_color
@@ -228,6 +742,75 @@ struct aseprite_frame
 	aseprite_layer *Layers;
 };
 
+// Every string referenced by user data is stored once in the file's string
+// pool.  Strings are null terminated and referred to by their offset into
+// Data, which stays valid when the pool grows.  Offset 0 is the empty string.
+// Slots is an open addressing table of (offset + 1) used to find duplicates.
+
+struct aseprite_string_pool
+{
+	char *Data;
+	uint32_t Used;
+	uint32_t Size;
+	uint32_t *Slots;
+	uint32_t NumSlots;
+	uint32_t NumStrings;
+};
+
+struct aseprite_tag
+{
+	int FromFrame;
+	int ToFrame;
+	uint8_t LoopDirection;
+	int Repeat;
+	char *Name;
+	aseprite_user_data UserData;
+};
+
+// A slice key applies from its FrameNumber until the next key of the same
+// slice.  The center (9-slice) rect is relative to the slice bounds and the
+// pivot is relative to the slice origin; both are zero unless the slice flags
+// say they are present.
+
+struct aseprite_slice_key
+{
+	int FrameNumber;
+	int X;
+	int Y;
+	int Width;
+	int Height;
+	int CenterX;
+	int CenterY;
+	int CenterWidth;
+	int CenterHeight;
+	int PivotX;
+	int PivotY;
+};
+
+// The keys of every slice in the file live in one array (File->SliceKeys),
+// each slice owning a run of it sorted by frame number.
+
+struct aseprite_slice
+{
+	uint32_t Flags;
+	char *Name;
+	int FirstKey;
+	int NumKeys;
+	aseprite_user_data UserData;
+};
+
+// Files written before color profiles existed are sRGB.  Gamma is only
+// meaningful with AsepriteColorProfileFlags_FixedGamma.  The ICC data of
+// embedded profiles isn't kept, only its size.
+
+struct aseprite_color_profile
+{
+	uint16_t Type;
+	uint16_t Flags;
+	float Gamma;
+	uint32_t ICCLength;
+};
+
 struct aseprite_file
 {
 	aseprite_header Header;
@@ -236,6 +819,22 @@ struct aseprite_file
 	aseprite_palette Palette;
 	int NumLayers;
 	aseprite_layer_info *LayerInfo;
+	int NumSlices;
+	aseprite_slice *Slices;
+	int NumSliceKeys;
+	aseprite_slice_key *SliceKeys;
+	int NumTags;
+	aseprite_tag *Tags;
+	int NumTilesets;
+	aseprite_tileset *Tilesets;
+	aseprite_user_data UserData;
+	aseprite_string_pool Strings;
+	aseprite_color_profile ColorProfile;
+	//Cels whose pixels turned out identical to an earlier cel's, and share its buffer
+	int NumSharedCels;
+	size_t SharedCelBytes;
+	//Set by AsepriteCompact: everything above lives in this one block
+	void *Block;
 };
 
 struct aseprite_string
@@ -251,13 +850,70 @@ enum aseprite_chunk_type
 {
 	AsepriteChunk_OldPalette = 0x0004,
 	AsepriteChunk_OldPalette2 = 0x0011,
+	AsepriteChunk_ColorProfile = 0x2007,
 	AsepriteChunk_Layer = 0x2004,
 	AsepriteChunk_Cel = 0x2005,
+	AsepriteChunk_CelExtra = 0x2006,
 	AsepriteChunk_Mask = 0x2016,
 	AsepriteChunk_Path = 0x2017,
 	AsepriteChunk_FrameTags = 0x2018,
 	AsepriteChunk_Palette = 0x2019,
 	AsepriteChunk_UserData = 0x2020,
+	AsepriteChunk_Slice = 0x2022,
+	AsepriteChunk_Tileset = 0x2023,
+};
+
+enum aseprite_color_profile_type
+{
+	AsepriteColorProfile_None = 0,
+	AsepriteColorProfile_SRGB = 1,
+	AsepriteColorProfile_ICC = 2,
+};
+
+enum aseprite_color_profile_flags
+{
+	AsepriteColorProfileFlags_FixedGamma = 1,
+};
+
+enum aseprite_layer_type
+{
+	AsepriteLayerType_Normal = 0,
+	AsepriteLayerType_Group = 1,
+	AsepriteLayerType_Tilemap = 2,
+};
+
+enum aseprite_tileset_flags
+{
+	AsepriteTilesetFlags_ExternalFile = 1,
+	AsepriteTilesetFlags_TilesInFile = 2,
+	AsepriteTilesetFlags_EmptyTileIsZero = 4,
+};
+
+enum aseprite_user_data_flags
+{
+	AsepriteUserDataFlags_HasText = 1,
+	AsepriteUserDataFlags_HasColor = 2,
+};
+
+enum aseprite_loop_direction
+{
+	AsepriteLoopDirection_Forward = 0,
+	AsepriteLoopDirection_Reverse = 1,
+	AsepriteLoopDirection_PingPong = 2,
+	AsepriteLoopDirection_PingPongReverse = 3,
+};
+
+// User data chunks attach to whatever came right before them.  After a tags
+// chunk there is one user data chunk per tag, in order.
+
+enum aseprite_user_data_target
+{
+	AsepriteUserDataTarget_None,
+	AsepriteUserDataTarget_Sprite,
+	AsepriteUserDataTarget_Layer,
+	AsepriteUserDataTarget_Cel,
+	AsepriteUserDataTarget_Tag,
+	AsepriteUserDataTarget_Slice,
 };
 
 enum aseprite_layer_flags
@@ -269,6 +925,12 @@ enum aseprite_layer_flags
 	AsepriteLayerFlags_PreferLinkedCels = 16,
 };
 
+enum aseprite_slice_flags
+{
+	AsepriteSliceFlags_NinePatch = 1,
+	AsepriteSliceFlags_HasPivot = 2,
+};
+
 enum aseprite_blend_mode
 { 
 	AsepriteBlendMode_Normal = 0,
@@ -294,6 +956,7 @@ enum aseprite_cel_type
 	AsepriteCelType_Raw = 0,
 	AsepriteCelType_Linked = 1,
 	AsepriteCelType_Compressed = 2,
+	AsepriteCelType_CompressedTilemap = 3,
 };
 
 // This struct is passed around, and holds the details about where in the file
@@ -303,56 +966,191 @@ enum aseprite_cel_type
 // back and filling in the data), and it also prevents us from using some sort of
 // std::vector kind of nonsense.
 
+// One decoded cel in the parser's table of cel contents (see AsepriteShareCelData)
+
+struct aseprite_cel_hash
+{
+	uint64_t Hash;
+	void *Data;
+	uint16_t Width;
+	uint16_t Height;
+	uint16_t CelType;
+};
+
 struct aseprite_parser
 {
 	void *At;
+	void *End;
 	int AvailableLayers;
+	int AvailableSlices;
+	int AvailableSliceKeys;
+	aseprite_user_data_target UserDataTarget;
+	int UserDataIndex;
 	bool UsesNewPalette;
+	volatile int32_t *Cancel;
+	uint32_t Flags;
+	aseprite_cel_hash *CelHashes;
+	int NumCelHashes;
+	int CelHashSlots;
+};
+
+// Optional settings for AsepriteParseFileEx.  FileSize limits how far the
+// parser reads (0 trusts the size in the file header), and MaxFrames stops the
+// parse after that many frames (0 parses them all).  The struct must be zero
+// initialized.
+
+enum aseprite_parse_flags
+{
+	//Keep compressed cels compressed (a copy of their zlib stream) instead of
+	//inflating them.  Their stats are just the cel bounds.  Use
+	//AsepriteStreamFrameRGBA to draw them, or AsepriteInflateKeptCel.
+	AsepriteParseFlags_KeepCompressedCels = 1,
+	//Don't look for cels with identical pixels (see AsepriteShareCelData)
+	AsepriteParseFlags_NoCelSharing = 2,
+	//Store RGBA files with at most 255 colors (plus transparent) as indexed
+	//(see AsepriteConvertToIndexed).  Ignored with KeepCompressedCels.
+	AsepriteParseFlags_ConvertToIndexed = 4,
+	//With ConvertToIndexed, quantize files with more colors down to 255
+	AsepriteParseFlags_LossyIndexed = 8,
+	//Store decoded cels as runs where that is smaller (see AsepriteEncodeCelRuns)
+	AsepriteParseFlags_RunLengthCels = 16,
+	//Store large decoded cels as tiles where that is smaller (see
+	//AsepriteEncodeCelTiles).  Cels that get tiled aren't also stored as runs.
+	//With KeepCompressedCels, use AsepriteInflateKeptCelTiles instead.
+	AsepriteParseFlags_TiledCels = 32,
+};
+
+struct aseprite_parse_options
+{
+	size_t FileSize;
+	int MaxFrames;
+	uint32_t Flags;
+	//If set, the parse stops at the next chunk boundary once this becomes non-zero
+	volatile int32_t *Cancel;
 };
 
 aseprite_string
 AsepriteParseString(void *Data)
 {
 	aseprite_string Result;
-	uint16_t *Length = (uint16_t *)Data;
-	Result.Length = *Length;
+	Result.Length = AsepriteReadU16(Data);
 	Result.String = (char *)((uint16_t *)Data + 1);
 	return Result;
 };
 
-void
-AsepriteParsePalette(aseprite_file *File, void *ChunkData)
+inline uint32_t
+AsepriteHashString(const char *String, uint32_t Length)
 {
-	aseprite_palette_header *PaletteHeader = (aseprite_palette_header *)ChunkData;
-	ChunkData = ((aseprite_palette_header *)ChunkData + 1);
+	//FNV-1a
+	uint32_t Hash = 2166136261u;
+	for (uint32_t Index = 0; Index < Length; Index++)
+	{
+		Hash ^= (uint8_t)String[Index];
+		Hash *= 16777619u;
+	}
+	return Hash;
+}
 
-	File->Palette.Header = *PaletteHeader;
-	File->Palette.NumColors = PaletteHeader->NewPaletteSize;
-	File->Palette.Colors = (aseprite_color *)malloc(sizeof(aseprite_color)*PaletteHeader->NewPaletteSize);
+// Adds a string to the pool (or finds the copy already in it) and returns its
+// offset, or ASEPRITE_NO_STRING if memory ran out.  The pool keeps its lookup
+// table at most half full.
 
-	printf_d("   Num Entries: %d\n", PaletteHeader->NewPaletteSize);
-	for (int EntryIndex = PaletteHeader->FirstColorIndexToChange; EntryIndex <= PaletteHeader->LastColorIndexToChange; EntryIndex++)
+#define ASEPRITE_NO_STRING 0xFFFFFFFFu
+
+uint32_t
+AsepriteInternString(aseprite_string_pool *Pool, const char *String, uint32_t Length)
+{
+	if (Pool->NumSlots == 0 || (Pool->NumStrings + 1)*2 > Pool->NumSlots)
 	{
-		aseprite_palette_entry *PaletteEntry = (aseprite_palette_entry *)ChunkData;
-		ChunkData = ((aseprite_palette_entry *)ChunkData + 1);
-		if (PaletteEntry->Flags == 1)
+		uint32_t NewNumSlots = Pool->NumSlots ? Pool->NumSlots*2 : 64;
+		uint32_t *NewSlots = (uint32_t *)calloc(NewNumSlots, sizeof(uint32_t));
+		if (!NewSlots)
+			return ASEPRITE_NO_STRING;
+		for (uint32_t SlotIndex = 0; SlotIndex < Pool->NumSlots; SlotIndex++)
 		{
-			aseprite_string ColorName = AsepriteParseString(ChunkData);
-			ChunkData = ((char *)ChunkData + sizeof(uint16_t) + ColorName.Length);
-			printf_d("     Color name: %.*s\n", ColorName.Length, ColorName.String);
+			uint32_t Slot = Pool->Slots[SlotIndex];
+			if (!Slot)
+				continue;
+			char *Existing = Pool->Data + Slot - 1;
+			uint32_t NewSlot = AsepriteHashString(Existing, (uint32_t)strlen(Existing)) & (NewNumSlots - 1);
+			while (NewSlots[NewSlot])
+				NewSlot = (NewSlot + 1) & (NewNumSlots - 1);
+			NewSlots[NewSlot] = Slot;
 		}
-		printf_d("     R%d G%d B%d A%d\n", PaletteEntry->Red, PaletteEntry->Green, PaletteEntry->Blue, PaletteEntry->Alpha);
-
-		aseprite_color *Color = &File->Palette.Colors[EntryIndex];
-		*Color = AsepriteColorFromR8G8B8A8(PaletteEntry->Red, PaletteEntry->Green, PaletteEntry->Blue, PaletteEntry->Alpha);
+		free(Pool->Slots);
+		Pool->Slots = NewSlots;
+		Pool->NumSlots = NewNumSlots;
+	}
+
+	uint32_t SlotIndex = AsepriteHashString(String, Length) & (Pool->NumSlots - 1);
+	while (Pool->Slots[SlotIndex])
+	{
+		//Strings in the pool are null terminated, so one of the same length
+		//has its terminator at Length, inside the used part of the pool
+		uint32_t Offset = Pool->Slots[SlotIndex] - 1;
+		char *Existing = Pool->Data + Offset;
+		if (Length < Pool->Used - Offset && Existing[Length] == '\0' && memcmp(Existing, String, Length) == 0)
+			return Offset;
+		SlotIndex = (SlotIndex + 1) & (Pool->NumSlots - 1);
+	}
+
+	if ((uint64_t)Pool->Used + Length + 1 > 0xFFFFFFFFu)
+		return ASEPRITE_NO_STRING;
+	if (Pool->Used + Length + 1 > Pool->Size)
+	{
+		uint32_t NewSize = Pool->Size;
+		while (Pool->Used + Length + 1 > NewSize)
+			NewSize = NewSize ? ((NewSize > 0x7FFFFFFFu) ? 0xFFFFFFFFu : NewSize*2) : 256;
+		char *NewData = (char *)realloc(Pool->Data, NewSize);
+		if (!NewData)
+			return ASEPRITE_NO_STRING;
+		Pool->Data = NewData;
+		Pool->Size = NewSize;
+	}
+
+	uint32_t Result = Pool->Used;
+	memcpy(Pool->Data + Result, String, Length);
+	Pool->Data[Result + Length] = '\0';
+	Pool->Used += Length + 1;
+	Pool->Slots[SlotIndex] = Result + 1;
+	Pool->NumStrings++;
+	return Result;
+}
+
+void
+AsepriteParsePalette(aseprite_file *File, void *ChunkData)
+{
+	aseprite_palette_header PaletteHeader = AsepriteReadPaletteHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_PALETTE_HEADER_SIZE);
+
+	File->Palette.Header = PaletteHeader;
+	File->Palette.NumColors = PaletteHeader.NewPaletteSize;
+	File->Palette.Colors = (aseprite_color *)malloc(sizeof(aseprite_color)*PaletteHeader.NewPaletteSize);
+
+	printf_d("   Num Entries: %d\n", PaletteHeader.NewPaletteSize);
+	for (int EntryIndex = PaletteHeader.FirstColorIndexToChange; EntryIndex <= PaletteHeader.LastColorIndexToChange; EntryIndex++)
+	{
+		aseprite_palette_entry PaletteEntry = AsepriteReadPaletteEntry(ChunkData);
+		ChunkData = ((uint8_t *)ChunkData + ASEPRITE_PALETTE_ENTRY_SIZE);
+		if (PaletteEntry.Flags == 1)
+		{
+			aseprite_string ColorName = AsepriteParseString(ChunkData);
+			ChunkData = ((char *)ChunkData + sizeof(uint16_t) + ColorName.Length);
+			printf_d("     Color name: %.*s\n", ColorName.Length, ColorName.String);
+		}
+		printf_d("     R%d G%d B%d A%d\n", PaletteEntry.Red, PaletteEntry.Green, PaletteEntry.Blue, PaletteEntry.Alpha);
+
+		aseprite_color *Color = &File->Palette.Colors[EntryIndex];
+		*Color = AsepriteColorFromR8G8B8A8(PaletteEntry.Red, PaletteEntry.Green, PaletteEntry.Blue, PaletteEntry.Alpha);
 	}
 }
 
 void
 AsepriteParseOldPalette(aseprite_file *File, void *ChunkData)
 {
-	uint16_t Packets = *((uint16_t *)ChunkData);
+	uint16_t Packets = AsepriteReadU16(ChunkData);
 	ChunkData = ((uint16_t *)ChunkData + 1);
+	File->Palette.NumColors = 256;
 	File->Palette.Colors = (aseprite_color *)malloc(sizeof(aseprite_color)*256);
 
 	for (int PacketIndex = 0; PacketIndex < Packets; PacketIndex++)
@@ -378,456 +1176,7057 @@ AsepriteParseOldPalette(aseprite_file *File, void *ChunkData)
 	}
 }
 
-void
-AsepriteParseCel(aseprite_frame *Frame, void *ChunkData, int ChunkLength)
+inline int
+AsepriteMinInt(int A, int B)
 {
-	aseprite_cel_header *CelHeader = (aseprite_cel_header *)ChunkData;
-	ChunkData = ((aseprite_cel_header *)ChunkData + 1);
-
-	aseprite_layer *Layer = &Frame->Layers[CelHeader->LayerIndex];
-	Layer->Header = *CelHeader;
-
-	printf_d("  Layer Index: %d\n", CelHeader->LayerIndex);
-	printf_d("  XPos: %d\n", CelHeader->XPos);
-	printf_d("  YPos: %d\n", CelHeader->YPos);
-	printf_d("  Opacity: %d\n", CelHeader->Opacity);
-
-	printf_d("  Cel Type:  ");
-	switch (CelHeader->CelType)
-	{
-		case AsepriteCelType_Raw: 
-		{
-			printf_d("Raw\n");
-			uint16_t WidthInPixels = *((uint16_t *)ChunkData);
-			ChunkData = ((uint16_t *)ChunkData + 1);
-			uint16_t HeightInPixels = *((uint16_t *)ChunkData);
-			ChunkData = ((uint16_t *)ChunkData + 1);
-			int DataSize = ChunkLength - sizeof(aseprite_cel_header) - sizeof(uint16_t)*2;
-			void *Data = ChunkData;
-			Layer->DataWidth = WidthInPixels;
-			Layer->DataHeight = HeightInPixels;
-			Layer->Data = malloc(DataSize);
-			memcpy(Layer->Data, ChunkData, DataSize);
-		} break;
-		case AsepriteCelType_Linked: 
-		{
-			printf_d("Linked\n");
-		} break;
-		case AsepriteCelType_Compressed: 
-		{
-			printf_d("Compressed\n");
-			uint16_t WidthInPixels = *((uint16_t *)ChunkData);
-			ChunkData = ((uint16_t *)ChunkData + 1);
-			uint16_t HeightInPixels = *((uint16_t *)ChunkData);
-			ChunkData = ((uint16_t *)ChunkData + 1);
-			printf_d("  Cel data size x,y (%d, %d)\n", WidthInPixels, HeightInPixels);
-			int DataSize = ChunkLength - sizeof(aseprite_cel_header) - sizeof(uint16_t)*2;
-			size_t DataLength = 0;
-			void *Data = tinfl_decompress_mem_to_heap(ChunkData, DataSize, &DataLength, TINFL_FLAG_PARSE_ZLIB_HEADER);
-			Layer->DataWidth = WidthInPixels;
-			Layer->DataHeight = HeightInPixels;
-			Layer->Data = Data;
-			
-			/*
-			if (Data)
-			{
-				uint8_t *Bytes = (uint8_t *)Data;
-				for (int Y = 180; Y < HeightInPixels; Y++)
-				{
-					for (int X = 0; X < WidthInPixels; X++)
-					{
-						printf_d("%d ", Bytes[X + Y*WidthInPixels]);
-					}
-					printf_d("\n");
-				}
-			}*/
-			printf_d("\n");
-			
-		} break;
-	}
+	int Result = A;
+	if (B < A)
+		Result = B;
+	return Result;
 }
 
-void
-AsepriteParseLayer(aseprite_file *File, aseprite_parser *Parser, void *ChunkData)
+inline int
+AsepriteMaxInt(int A, int B)
 {
-	if (File->NumLayers == Parser->AvailableLayers)
-	{
-		Parser->AvailableLayers *= 2;
-		File->LayerInfo = (aseprite_layer_info *)realloc(File->LayerInfo, sizeof(aseprite_layer_info)*Parser->AvailableLayers);
-	}
+	int Result = A;
+	if (B > A)
+		Result = B;
+	return Result;
+}
 
-	aseprite_layer_info *NewLayer = &File->LayerInfo[File->NumLayers++];
+inline size_t
+AsepriteMinSize(size_t A, size_t B)
+{
+	size_t Result = A;
+	if (B < A)
+		Result = B;
+	return Result;
+}
 
-	aseprite_layer_header *LayerHeader = (aseprite_layer_header *)ChunkData;
-	ChunkData = ((aseprite_layer_header *)ChunkData + 1);
+inline size_t
+AsepriteMaxSize(size_t A, size_t B)
+{
+	size_t Result = A;
+	if (B > A)
+		Result = B;
+	return Result;
+}
 
-	NewLayer->Header = *LayerHeader;
+inline float
+AsepriteMinFloat(float A, float B)
+{
+	float Result = A;
+	if (B < A)
+		Result = B;
+	return Result;
+}
 
-	printf_d(" Layer Flags\n");
-	if (LayerHeader->Flags & AsepriteLayerFlags_Visible)
-		printf_d("     Visible\n");
-	if (LayerHeader->Flags & AsepriteLayerFlags_Editable)
-		printf_d("     Editable\n");
-	if (LayerHeader->Flags & AsepriteLayerFlags_LockMovement)
-		printf_d("     Lock Movement\n");
-	if (LayerHeader->Flags & AsepriteLayerFlags_Background)
-		printf_d("     Background\n");
-	if (LayerHeader->Flags & AsepriteLayerFlags_PreferLinkedCels)
-		printf_d("     Prefer Linked Cels\n");
+inline int
+AsepriteBytesPerPixel(uint16_t ColorDepth)
+{
+	return ColorDepth / 8;
+}
 
-	printf_d(" Layer Type: %d\n", LayerHeader->LayerType);
-	printf_d(" Layer Child: %d\n", LayerHeader->LayerChild);
+// Atomics for the reference counts here and for the asynchronous loader.
 
-	printf_d(" Blend Mode:  ");
-	switch (LayerHeader->BlendMode)
-	{
-		case AsepriteBlendMode_Normal: {printf_d("Normal\n");} break;
-		case AsepriteBlendMode_Multiply: {printf_d("Multiply\n");} break;
-		case AsepriteBlendMode_Screen: {printf_d("Screen \n");} break;
-		case AsepriteBlendMode_Overlay: {printf_d("Overlay \n");} break;
-		case AsepriteBlendMode_Darken: {printf_d("Darken \n");} break;
-		case AsepriteBlendMode_Lighten: {printf_d("Lighten \n");} break;
-		case AsepriteBlendMode_ColorDodge: {printf_d("Color Dodge\n");} break;
-		case AsepriteBlendMode_ColorBurn: {printf_d("Color Burn\n");} break;
-		case AsepriteBlendMode_HardLight: {printf_d("Hard Light\n");} break;
-		case AsepriteBlendMode_SoftLight: {printf_d("Soft Light\n");} break;
-		case AsepriteBlendMode_Difference: {printf_d("Difference\n");} break;
-		case AsepriteBlendMode_Exclusion: {printf_d("Exclusion\n");} break;
-		case AsepriteBlendMode_Hue: {printf_d("Hue \n");} break;
-		case AsepriteBlendMode_Saturation: {printf_d("Saturation\n");} break;
-		case AsepriteBlendMode_Color: {printf_d("Color\n");} break;
-		case AsepriteBlendMode_Luminosity: {printf_d("Luminosity\n");} break;
-	}
+inline int32_t
+AsepriteAtomicAdd(volatile int32_t *Value, int32_t Addend)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd((volatile LONG *)Value, Addend) + Addend;
+#else
+	return __atomic_add_fetch(Value, Addend, __ATOMIC_SEQ_CST);
+#endif
+}
 
-	printf_d(" Opacity: %d\n", LayerHeader->Opacity);
-	aseprite_string LayerName = AsepriteParseString(ChunkData);
-	printf_d(" Layer name: %.*s\n", LayerName.Length, LayerName.String);
+inline int32_t
+AsepriteAtomicLoad(volatile int32_t *Value)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange((volatile LONG *)Value, 0, 0);
+#else
+	return __atomic_load_n(Value, __ATOMIC_SEQ_CST);
+#endif
+}
 
-	NewLayer->Name = (char *)malloc(LayerName.Length + 1);
-	memcpy(NewLayer->Name, LayerName.String, LayerName.Length);
-	NewLayer->Name[LayerName.Length] = '\0';
+inline void
+AsepriteAtomicStore(volatile int32_t *Value, int32_t NewValue)
+{
+#ifdef _WIN32
+	InterlockedExchange((volatile LONG *)Value, NewValue);
+#else
+	__atomic_store_n(Value, NewValue, __ATOMIC_SEQ_CST);
+#endif
 }
 
-// You can see which 'chunk' types are not implemented here.  Some are deprecated, so no
-// need to fill those in.
+// Sets *Value to NewValue if it is Expected, and returns what it was.
 
-void
-AsepriteParseChunk(aseprite_file *File, aseprite_frame *Frame, aseprite_parser *Parser)
+inline int32_t
+AsepriteAtomicCompareExchange(volatile int32_t *Value, int32_t Expected, int32_t NewValue)
 {
-	aseprite_chunk_header *ChunkHeader = (aseprite_chunk_header *)Parser->At;
-	void *ChunkData = ((aseprite_chunk_header *)Parser->At + 1);
-	Parser->At = ((char *)Parser->At + ChunkHeader->ChunkSize);
-
-	printf_d("Chunk type: ");
-	switch (ChunkHeader->ChunkType)
-	{
-		case AsepriteChunk_OldPalette:
-		{
-			printf_d("old palette\n");
-			if (!Parser->UsesNewPalette)
-				AsepriteParseOldPalette(File, ChunkData);
-		} break;
-		case AsepriteChunk_OldPalette2:
-		{
-			printf_d("old palette\n");
-		} break;
-		case AsepriteChunk_Layer:
-		{
-			printf_d("layer\n");
-			AsepriteParseLayer(File, Parser, ChunkData);
-		} break;
-		case AsepriteChunk_Cel:
-		{
-			printf_d("cel\n");
-			if (Frame->NumLayers != File->NumLayers)
-			{
-				Frame->NumLayers = File->NumLayers;
-				Frame->Layers = (aseprite_layer *)malloc(sizeof(aseprite_layer)*Frame->NumLayers);
-			}
-			AsepriteParseCel(Frame, ChunkData, ChunkHeader->ChunkSize - sizeof(aseprite_chunk_header));
-		} break;
-		case AsepriteChunk_Mask:
-		{
-			printf_d("mask\n");
-		} break;
-		case AsepriteChunk_Path:
-		{
-			printf_d("path\n");
-		} break;
-		case AsepriteChunk_FrameTags:
-		{
-			printf_d("frame tags\n");
-		} break;
-		case AsepriteChunk_Palette:
-		{
-			printf_d("palette\n");
-			Parser->UsesNewPalette = true;
-			AsepriteParsePalette(File, ChunkData);
-		} break;
-		case AsepriteChunk_UserData:
-		{
-			printf_d("user data\n");
-		} break;
-	}
-	printf_d("\n");
+#ifdef _WIN32
+	return InterlockedCompareExchange((volatile LONG *)Value, NewValue, Expected);
+#else
+	__atomic_compare_exchange_n(Value, &Expected, NewValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Expected;
+#endif
 }
 
-void
-AsepriteParseFrame(aseprite_file *File, aseprite_frame *Frame, aseprite_parser *Parser)
+// Cel pixel buffers are shared and reference counted, so a cel can be handed
+// to other objects (or shared between cels) without copying it.  A small
+// header sits in front of the pixels; Layer->Data points past it.  Once a
+// buffer is shared it must be treated as read only.  Buffers that live inside
+// a larger block (see AsepriteCompact) have an Owner, and references to them
+// count against the block instead.
+
+struct aseprite_cel_buffer
 {
-	aseprite_frame_header *FrameHeader = (aseprite_frame_header *)Parser->At;
-	Parser->At = ((aseprite_frame_header *)Parser->At + 1);
+	volatile int32_t RefCount;
+	uint32_t Flags;
+	size_t Size;
+	aseprite_cel_buffer *Owner;
+	//What to free when the count reaches zero
+	void *Allocation;
+};
 
-	Frame->Header = *FrameHeader;
+#define ASEPRITE_CEL_BUFFER_HEADER_SIZE ((sizeof(aseprite_cel_buffer) + 15) & ~(size_t)15)
 
-	printf_d("Frame: \n");
-	printf_d("   Duration: %d\n", FrameHeader->FrameDuration);
-	printf_d("CHUNKS: \n");
+inline aseprite_cel_buffer *
+AsepriteGetCelBuffer(void *Data)
+{
+	return (aseprite_cel_buffer *)((uint8_t *)Data - ASEPRITE_CEL_BUFFER_HEADER_SIZE);
+}
 
-	for (int ChunkIndex = 0; ChunkIndex < FrameHeader->ChunksInFrame; ChunkIndex++)
-	{
-		AsepriteParseChunk(File, Frame, Parser);
-	}
+// Returns pixel memory with a reference count of 1.
 
-	printf_d("\n");
+void *
+AsepriteAllocCelData(size_t Size)
+{
+	uint8_t *Memory = (uint8_t *)malloc(ASEPRITE_CEL_BUFFER_HEADER_SIZE + Size);
+	if (!Memory)
+		return 0;
+	aseprite_cel_buffer *Buffer = (aseprite_cel_buffer *)Memory;
+	Buffer->RefCount = 1;
+	Buffer->Flags = 0;
+	Buffer->Size = Size;
+	Buffer->Owner = 0;
+	Buffer->Allocation = Memory;
+	return Memory + ASEPRITE_CEL_BUFFER_HEADER_SIZE;
 }
 
-aseprite_file
-AsepriteParseFile(void *FileData)
+void
+AsepriteReleaseCelBuffer(aseprite_cel_buffer *Buffer)
 {
-	aseprite_file Result;
-
-	aseprite_parser Parser = {0};
-	Parser.At = FileData;
-	Parser.AvailableLayers = 2;
-
-	aseprite_header *Header = (aseprite_header *)Parser.At;
-	Parser.At = ((aseprite_header *)Parser.At + 1);
-
-	Result.Header = *Header;
-	Result.NumFrames = Header->Frames;
-	Result.Frames = (aseprite_frame *)malloc(sizeof(aseprite_frame)*Header->Frames);
-	Result.NumLayers = 0;
-	Result.LayerInfo = (aseprite_layer_info *)malloc(sizeof(aseprite_layer_info)*Parser.AvailableLayers);
+	if (Buffer->Owner)
+		Buffer = Buffer->Owner;
+	if (AsepriteAtomicAdd(&Buffer->RefCount, -1) == 0)
+		free(Buffer->Allocation);
+}
 
-	for (int FrameIndex = 0; FrameIndex < Header->Frames; FrameIndex++)
+void *
+AsepriteRetainCelData(void *Data)
+{
+	if (Data)
 	{
-		AsepriteParseFrame(&Result, &Result.Frames[FrameIndex], &Parser);
+		aseprite_cel_buffer *Buffer = AsepriteGetCelBuffer(Data);
+		AsepriteAtomicAdd(Buffer->Owner ? &Buffer->Owner->RefCount : &Buffer->RefCount, 1);
 	}
+	return Data;
+}
 
-	return Result;
-
+void
+AsepriteReleaseCelData(void *Data)
+{
+	if (Data)
+		AsepriteReleaseCelBuffer(AsepriteGetCelBuffer(Data));
 }
 
-inline float
-AsepriteMin(float A, float B)
+size_t
+AsepriteGetCelDataSize(void *Data)
 {
-	float Result = A;
-	if (B < A)
-		Result = B;
-	return Result;
+	return Data ? AsepriteGetCelBuffer(Data)->Size : 0;
 }
 
-inline float
-AsepriteAbs(float A)
+uint64_t
+AsepriteHashCelData(const uint8_t *Data, size_t Size)
 {
-	float Result = A;
-	if (A < 0)
-		Result = -A;
-	return Result;
+	uint64_t Hash = 0x9E3779B97F4A7C15ull ^ Size;
+	size_t At = 0;
+	for (; At + 8 <= Size; At += 8)
+	{
+		uint64_t Word;
+		memcpy(&Word, Data + At, 8);
+		Hash = (Hash ^ Word)*0xFF51AFD7ED558CCDull;
+		Hash ^= Hash >> 32;
+	}
+	for (; At < Size; At++)
+		Hash = (Hash ^ Data[At])*0x100000001B3ull;
+	Hash ^= Hash >> 29;
+	return Hash;
 }
 
-inline aseprite_color
-AsepriteCombineColors(aseprite_color *Src, aseprite_color *Dest, aseprite_blend_mode BlendMode)
+// Animations often repeat a cel exactly without using a linked cel.  Every
+// decoded cel is hashed as it is parsed, and one whose pixels match an earlier
+// cel drops its own buffer and shares the earlier one.
+
+void
+AsepriteShareCelData(aseprite_file *File, aseprite_parser *Parser, aseprite_layer *Layer)
 {
-	aseprite_color Result;
+	if (!Layer->Data || (Parser->Flags & AsepriteParseFlags_NoCelSharing))
+		return;
 
-	float OutAlpha = Src->A + Dest->A*(1 - Src->A);
-	if (OutAlpha == 0)
+	if (2*(Parser->NumCelHashes + 1) > Parser->CelHashSlots)
 	{
-		Result = AsepriteColorFromRGBA(0,0,0,0);
-	} 
-	else
+		int NewSlots = Parser->CelHashSlots ? Parser->CelHashSlots*2 : 64;
+		aseprite_cel_hash *NewHashes = (aseprite_cel_hash *)calloc(NewSlots, sizeof(aseprite_cel_hash));
+		if (!NewHashes)
+			return;
+		for (int SlotIndex = 0; SlotIndex < Parser->CelHashSlots; SlotIndex++)
+		{
+			aseprite_cel_hash *Entry = Parser->CelHashes + SlotIndex;
+			if (!Entry->Data)
+				continue;
+			int NewIndex = (int)(Entry->Hash & (NewSlots - 1));
+			while (NewHashes[NewIndex].Data)
+				NewIndex = (NewIndex + 1) & (NewSlots - 1);
+			NewHashes[NewIndex] = *Entry;
+		}
+		free(Parser->CelHashes);
+		Parser->CelHashes = NewHashes;
+		Parser->CelHashSlots = NewSlots;
+	}
+
+	size_t Size = AsepriteGetCelDataSize(Layer->Data);
+	uint16_t CelType = (Layer->Header.CelType == AsepriteCelType_CompressedTilemap) ? AsepriteCelType_CompressedTilemap : AsepriteCelType_Raw;
+	uint64_t Hash = AsepriteHashCelData((uint8_t *)Layer->Data, Size);
+	int SlotIndex = (int)(Hash & (Parser->CelHashSlots - 1));
+	for (;;)
 	{
-		float OutRed, OutGreen, OutBlue;
-		switch (BlendMode)
+		aseprite_cel_hash *Entry = Parser->CelHashes + SlotIndex;
+		if (!Entry->Data)
 		{
-			case AsepriteBlendMode_Multiply:
-			{
-				OutRed = Src->R*Dest->R;
-				OutGreen = Src->G*Dest->G;
-				OutBlue = Src->B*Dest->B;
-			} break;
-			case AsepriteBlendMode_Screen:
-			{
-				OutRed = 1 - (1 - Src->R)*(1 - Dest->R);
-				OutGreen = 1 - (1 - Src->G)*(1 - Dest->G);
-				OutBlue = 1 - (1 - Src->B)*(1 - Dest->B);
-			} break;
-			case AsepriteBlendMode_Overlay:
-			{
-				OutRed = (Dest->R < 0.5f) ? (2*Src->R*Dest->R) : (1 - 2*(1 - Src->R)*(1 - Dest->R));
-				OutGreen = (Dest->G < 0.5f) ? (2*Src->G*Dest->G) : (1 - 2*(1 - Src->G)*(1 - Dest->G));
-				OutBlue = (Dest->B < 0.5f) ? (2*Src->B*Dest->B) : (1 - 2*(1 - Src->B)*(1 - Dest->B));
-			} break;
-			case AsepriteBlendMode_Darken:
-			{
-				OutRed = (Dest->R < Src->R) ? (Dest->R) : (Src->R);
-				OutGreen = (Dest->G < Src->G) ? (Dest->G) : (Src->G);
-				OutBlue = (Dest->B < Src->B) ? (Dest->B) : (Src->B);
-			} break;
-			case AsepriteBlendMode_Lighten:
-			{
-				OutRed = (Dest->R > Src->R) ? (Dest->R) : (Src->R);
-				OutGreen = (Dest->G > Src->G) ? (Dest->G) : (Src->G);
-				OutBlue = (Dest->B > Src->B) ? (Dest->B) : (Src->B);
-			} break;
-			case AsepriteBlendMode_ColorDodge:
-			{
-				OutRed = (Src->R == 1) ? (1) : (Dest->R / (1 - Src->R));
-				OutRed = AsepriteMin(OutRed, 1);
-				OutGreen = (Src->G == 1) ? (1) : (Dest->G / (1 - Src->G));
-				OutGreen = AsepriteMin(OutGreen, 1);
-				OutBlue = (Src->B == 1) ? (1) : (Dest->B / (1 - Src->B));
-				OutBlue = AsepriteMin(OutBlue, 1);
-			} break;
-			case AsepriteBlendMode_ColorBurn:
-			{
-				OutRed = (Src->R == 0) ? 0 : (1 - AsepriteMin((1 - Dest->R)/(Src->R), 1));
-				OutGreen = (Src->G == 0) ? 0 : (1 - AsepriteMin((1 - Dest->G)/(Src->G), 1));
-				OutBlue = (Src->B == 0) ? 0 : (1 - AsepriteMin((1 - Dest->B)/(Src->B), 1));
-			} break;
-			case AsepriteBlendMode_HardLight:
-			{
-				OutRed = (Src->R < 0.5f) ? (2*Src->R*Dest->R) : (1 - 2*(1 - Src->R)*(1 - Dest->R));
-				OutGreen = (Src->G < 0.5f) ? (2*Src->G*Dest->G) : (1 - 2*(1 - Src->G)*(1 - Dest->G));
-				OutBlue = (Src->B < 0.5f) ? (2*Src->B*Dest->B) : (1 - 2*(1 - Src->B)*(1 - Dest->B));
-			} break;
-			case AsepriteBlendMode_SoftLight:
-			{
-				OutRed = (1 - 2*Src->R)*Dest->R*Dest->R + 2*Dest->R*Src->R;
-				OutGreen = (1 - 2*Src->G)*Dest->G*Dest->G + 2*Dest->G*Src->G;
-				OutBlue = (1 - 2*Src->B)*Dest->B*Dest->B + 2*Dest->B*Src->B;
-			} break;
-			case AsepriteBlendMode_Difference:
+			Entry->Hash = Hash;
+			Entry->Data = Layer->Data;
+			Entry->Width = (uint16_t)Layer->DataWidth;
+			Entry->Height = (uint16_t)Layer->DataHeight;
+			Entry->CelType = CelType;
+			Parser->NumCelHashes++;
+			return;
+		}
+		if (Entry->Hash == Hash && Entry->Width == Layer->DataWidth && Entry->Height == Layer->DataHeight && Entry->CelType == CelType &&
+			AsepriteGetCelDataSize(Entry->Data) == Size && memcmp(Entry->Data, Layer->Data, Size) == 0)
+		{
+			AsepriteReleaseCelData(Layer->Data);
+			Layer->Data = AsepriteRetainCelData(Entry->Data);
+			File->NumSharedCels++;
+			File->SharedCelBytes += Size;
+			printf_d("  Same pixels as an earlier cel, sharing it\n");
+			return;
+		}
+		SlotIndex = (SlotIndex + 1) & (Parser->CelHashSlots - 1);
+	}
+}
+
+// Scans freshly decoded rows of a cel and folds them into its stats.  This is
+// called on each strip of rows right after it is written, while the strip is
+// still in cache.
+
+void
+AsepriteAccumulateCelStats(aseprite_cel_stats *Stats, uint8_t *Rows, int FirstRow, int NumRows, int Width, uint16_t ColorDepth, uint8_t TransparentPaletteEntry)
+{
+	int BytesPerPixel = AsepriteBytesPerPixel(ColorDepth);
+	for (int RowIndex = 0; RowIndex < NumRows; RowIndex++)
+	{
+		uint8_t *Row = Rows + RowIndex*Width*BytesPerPixel;
+		int First = -1;
+		int Last = -1;
+		bool RowOpaque = true;
+		switch (ColorDepth)
+		{
+			case 8:
 			{
-				OutRed = AsepriteAbs(Dest->R - Src->R);
-				OutGreen = AsepriteAbs(Dest->G - Src->G);
-				OutBlue = AsepriteAbs(Dest->B - Src->B);
+				for (int X = 0; X < Width; X++)
+				{
+					if (Row[X] == TransparentPaletteEntry)
+					{
+						RowOpaque = false;
+					}
+					else
+					{
+						if (First < 0)
+							First = X;
+						Last = X;
+					}
+				}
 			} break;
-			case AsepriteBlendMode_Exclusion:
+			case 16:
+			case 32:
 			{
-				OutRed = 0.5f - 2*(Dest->R - 0.5f)*(Src->R - 0.5f);
-				OutGreen = 0.5f - 2*(Dest->G - 0.5f)*(Src->G - 0.5f);
-				OutBlue = 0.5f - 2*(Dest->B - 0.5f)*(Src->B - 0.5f);
+				//Alpha is the last byte of each pixel for both grayscale and RGBA
+				uint8_t *Alpha = Row + BytesPerPixel - 1;
+				for (int X = 0; X < Width; X++, Alpha += BytesPerPixel)
+				{
+					if (*Alpha != 255)
+						RowOpaque = false;
+					if (*Alpha != 0)
+					{
+						if (First < 0)
+							First = X;
+						Last = X;
+					}
+				}
 			} break;
-			default:
+		}
+
+		if (!RowOpaque)
+			Stats->IsOpaque = false;
+		if (First >= 0)
+		{
+			int Y = FirstRow + RowIndex;
+			if (Stats->IsEmpty)
 			{
-				//Defaults to normal blend mode
-				OutRed = Src->R;
-				OutGreen = Src->G;
-				OutBlue = Src->B;
-			} break;
+				Stats->MinX = First;
+				Stats->MaxX = Last + 1;
+				Stats->MinY = Y;
+				Stats->IsEmpty = false;
+			}
+			if (First < Stats->MinX)
+				Stats->MinX = First;
+			if (Last + 1 > Stats->MaxX)
+				Stats->MaxX = Last + 1;
+			Stats->MaxY = Y + 1;
 		}
-		//Alpha compositing
-		float OneOverOutAlpha = 1.0f / OutAlpha;
-		OutRed = (OutRed*Src->A + Dest->R*Dest->A*(1-Src->A)) * OneOverOutAlpha;
-		OutGreen = (OutGreen*Src->A + Dest->G*Dest->A*(1-Src->A)) * OneOverOutAlpha;
-		OutBlue = (OutBlue*Src->A + Dest->B*Dest->A*(1-Src->A)) * OneOverOutAlpha;
-		Result = AsepriteColorFromRGBA(OutRed, OutGreen, OutBlue, OutAlpha);
 	}
+}
 
-	return Result;
+inline void
+AsepriteBeginCelStats(aseprite_cel_stats *Stats)
+{
+	Stats->MinX = Stats->MinY = Stats->MaxX = Stats->MaxY = 0;
+	Stats->IsEmpty = true;
+	Stats->IsOpaque = true;
+}
+
+inline void
+AsepriteEndCelStats(aseprite_cel_stats *Stats)
+{
+	//An empty cel is never reported as opaque
+	if (Stats->IsEmpty)
+		Stats->IsOpaque = false;
+}
+
+// Inflates the zlib stream of a compressed cel into Dest a strip of rows at a
+// time, gathering the cel stats for each strip as soon as it lands.  Returns
+// false if the stream is corrupt or doesn't fill the cel.
+
+#define ASEPRITE_INFLATE_STRIP_SIZE (16*1024)
+
+bool
+AsepriteInflateCel(void *CompressedData, int CompressedSize, uint8_t *Dest, int Width, int Height, uint16_t ColorDepth, uint8_t TransparentPaletteEntry, aseprite_cel_stats *Stats)
+{
+	int Pitch = Width*AsepriteBytesPerPixel(ColorDepth);
+	size_t TotalSize = (size_t)Pitch*Height;
+	AsepriteBeginCelStats(Stats);
+	if (TotalSize == 0)
+	{
+		AsepriteEndCelStats(Stats);
+		return true;
+	}
+	//A chunk shorter than its headers leaves a negative size
+	if (CompressedSize < 0)
+	{
+		AsepriteEndCelStats(Stats);
+		return false;
+	}
+
+	tinfl_decompressor Inflator;
+	tinfl_init(&Inflator);
+
+	const mz_uint8 *In = (const mz_uint8 *)CompressedData;
+	size_t InRemaining = CompressedSize;
+	size_t Produced = 0;
+	int RowsScanned = 0;
+	tinfl_status Status = TINFL_STATUS_HAS_MORE_OUTPUT;
+	while (Status == TINFL_STATUS_HAS_MORE_OUTPUT && Produced < TotalSize)
+	{
+		size_t InSize = InRemaining;
+		size_t OutSize = TotalSize - Produced;
+		if (OutSize > ASEPRITE_INFLATE_STRIP_SIZE)
+			OutSize = ASEPRITE_INFLATE_STRIP_SIZE;
+		Status = tinfl_decompress(&Inflator, In, &InSize, Dest, Dest + Produced, &OutSize,
+								  TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+		In += InSize;
+		InRemaining -= InSize;
+		Produced += OutSize;
+
+		int RowsReady = (int)(Produced / Pitch);
+		if (RowsReady > RowsScanned)
+		{
+			AsepriteAccumulateCelStats(Stats, Dest + (size_t)RowsScanned*Pitch, RowsScanned, RowsReady - RowsScanned, Width, ColorDepth, TransparentPaletteEntry);
+			RowsScanned = RowsReady;
+		}
+	}
+	AsepriteEndCelStats(Stats);
+
+	return (Status >= TINFL_STATUS_DONE && Produced == TotalSize);
+}
+
+// Tilemap layers refer to tilesets by ID, which in practice is also their
+// index.  Returns 0 if there is no such tileset.
+
+aseprite_tileset *
+AsepriteGetTileset(aseprite_file *File, uint32_t TilesetID)
+{
+	if (TilesetID < (uint32_t)File->NumTilesets && File->Tilesets[TilesetID].ID == TilesetID)
+		return &File->Tilesets[TilesetID];
+	for (int TilesetIndex = 0; TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		if (File->Tilesets[TilesetIndex].ID == TilesetID)
+			return &File->Tilesets[TilesetIndex];
+	}
+	return 0;
 }
 
 void
-AsepriteGetEntireFrameRGBA(aseprite_file *File, int FrameNumber, void *DestTexture, int DestWidth, int DestHeight, int DestX, int DestY)
+AsepriteParseTileset(aseprite_file *File, void *ChunkData)
 {
-	Assert(FrameNumber < File->NumFrames);
-	
-	int Width = File->Header.WidthInPixels;
-	int Height = File->Header.HeightInPixels;
-	aseprite_frame *Frame = File->Frames + FrameNumber;
-	aseprite_palette *Palette = &File->Palette;
-	uint8_t TransparentPaletteEntry = File->Header.TransparentPaletteEntry;
+	aseprite_tileset_header TilesetHeader = AsepriteReadTilesetHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_TILESET_HEADER_SIZE);
 
-	for (int LayerIndex = 0; LayerIndex < File->NumLayers; LayerIndex++)
+	aseprite_string TilesetName = AsepriteParseString(ChunkData);
+	char *Name = (char *)malloc(TilesetName.Length + 1);
+	aseprite_tileset *Tilesets = Name ? (aseprite_tileset *)realloc(File->Tilesets, sizeof(aseprite_tileset)*(File->NumTilesets + 1)) : 0;
+	if (!Tilesets)
 	{
-		aseprite_layer_info *LayerInfo = File->LayerInfo + LayerIndex;
-		if (LayerInfo->Header.Opacity == 0 || (LayerInfo->Header.Flags & AsepriteLayerFlags_Visible) == 0)
-			continue;
+		printf_d(" Out of memory, skipping tileset %d\n", TilesetHeader.TilesetID);
+		free(Name);
+		return;
+	}
+	File->Tilesets = Tilesets;
+	aseprite_tileset *Tileset = &File->Tilesets[File->NumTilesets++];
+	Tileset->ID = TilesetHeader.TilesetID;
+	Tileset->Flags = TilesetHeader.Flags;
+	Tileset->NumTiles = TilesetHeader.NumTiles;
+	Tileset->TileWidth = TilesetHeader.TileWidth;
+	Tileset->TileHeight = TilesetHeader.TileHeight;
+	Tileset->BaseIndex = TilesetHeader.BaseIndex;
+	Tileset->Pixels = 0;
 
-		aseprite_blend_mode BlendMode = (aseprite_blend_mode)LayerInfo->Header.BlendMode;
-		aseprite_layer *Layer = Frame->Layers + LayerIndex;
-		void *CelData = Layer->Data;
-		uint16_t ColorDepth = File->Header.ColorDepth;
-		float LayerOpacity = LayerInfo->Header.Opacity / 255.0f;
+	ChunkData = ((char *)ChunkData + sizeof(uint16_t) + TilesetName.Length);
+	Tileset->Name = Name;
+	memcpy(Tileset->Name, TilesetName.String, TilesetName.Length);
+	Tileset->Name[TilesetName.Length] = '\0';
+
+	printf_d(" Tileset %d: %s, %d tiles of %dx%d\n", Tileset->ID, Tileset->Name, Tileset->NumTiles, Tileset->TileWidth, Tileset->TileHeight);
+
+	if (TilesetHeader.Flags & AsepriteTilesetFlags_ExternalFile)
+	{
+		printf_d(" Tiles are in an external file\n");
+		ChunkData = ((uint32_t *)ChunkData + 2);
+	}
+	if (TilesetHeader.Flags & AsepriteTilesetFlags_TilesInFile)
+	{
+		uint32_t CompressedSize = AsepriteReadU32(ChunkData);
+		ChunkData = ((uint32_t *)ChunkData + 1);
 
-		int DestPitch = DestWidth*4;
-		int DestStartX = (DestX < 0) ? 0 : (DestX*4);
+		//The tiles are inflated as one tall image, whose height has to fit an int
+		int64_t Rows = (int64_t)Tileset->TileHeight*Tileset->NumTiles;
+		int Height = (Rows >= 0 && Rows <= 0x7FFFFFFF) ? (int)Rows : 0;
+		int Pitch = Tileset->TileWidth*AsepriteBytesPerPixel(File->Header.ColorDepth);
+		Tileset->Pixels = Height ? malloc((size_t)Pitch*Height) : 0;
+		aseprite_cel_stats Stats;
+		if (!Tileset->Pixels ||
+			!AsepriteInflateCel(ChunkData, CompressedSize, (uint8_t *)Tileset->Pixels, Tileset->TileWidth, Height,
+								File->Header.ColorDepth, File->Header.TransparentPaletteEntry, &Stats))
+		{
+			printf_d(" Failed to inflate tileset\n");
+			free(Tileset->Pixels);
+			Tileset->Pixels = 0;
+		}
+	}
+}
+
+// Decodes the tile grid of a tilemap cel, widening the entries to 32 bits, and
+// works out the pixel bounds of the non-empty tiles as it goes.
+
+void
+AsepriteParseTilemapCel(aseprite_file *File, aseprite_layer *Layer, void *ChunkData, int DataSize)
+{
+	aseprite_tilemap_header TilemapHeader = AsepriteReadTilemapHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_TILEMAP_HEADER_SIZE);
+	DataSize -= ASEPRITE_TILEMAP_HEADER_SIZE;
 
-		int DataPitch = Layer->DataWidth;
-		if (ColorDepth == 32)
-			DataPitch *= 4;
+	int Width = TilemapHeader.WidthInTiles;
+	int Height = TilemapHeader.HeightInTiles;
+	int BytesPerTile = TilemapHeader.BitsPerTile / 8;
+	printf_d("  Tiles x,y (%d, %d), %d bits per tile\n", Width, Height, TilemapHeader.BitsPerTile);
 
-		int StartY = 0 - Layer->Header.YPos;
-		int StartX = 0 - Layer->Header.XPos;
-		if (ColorDepth == 32)
-			StartX *= 4;
+	Layer->DataWidth = Width;
+	Layer->DataHeight = Height;
+	Layer->TileMasks.TileID = TilemapHeader.TileIDMask;
+	Layer->TileMasks.XFlip = TilemapHeader.XFlipMask;
+	Layer->TileMasks.YFlip = TilemapHeader.YFlipMask;
+	Layer->TileMasks.DiagonalFlip = TilemapHeader.DiagonalFlipMask;
+
+	size_t NumTiles = (size_t)Width*Height;
+	uint32_t *Tiles = (uint32_t *)AsepriteAllocCelData(NumTiles*sizeof(uint32_t));
+	aseprite_cel_stats Stats;
+	bool Inflated = Tiles && (BytesPerTile == 1 || BytesPerTile == 2 || BytesPerTile == 4) &&
+		AsepriteInflateCel(ChunkData, DataSize, (uint8_t *)Tiles, Width, Height, (uint16_t)(BytesPerTile*8), 0, &Stats);
+	if (!Inflated)
+	{
+		printf_d("  Failed to inflate tilemap\n");
+		AsepriteReleaseCelData(Tiles);
+		Tiles = 0;
+	}
+	else if (BytesPerTile == 1)
+	{
+		//Widen in place, back to front
+		for (size_t TileIndex = NumTiles; TileIndex-- > 0;)
+			Tiles[TileIndex] = ((uint8_t *)Tiles)[TileIndex];
+	}
+	else if (BytesPerTile == 2)
+	{
+		for (size_t TileIndex = NumTiles; TileIndex-- > 0;)
+			Tiles[TileIndex] = AsepriteReadU16((uint8_t *)Tiles + TileIndex*2);
+	}
+#ifdef ASEPRITE_BIG_ENDIAN
+	else
+	{
+		for (size_t TileIndex = 0; TileIndex < NumTiles; TileIndex++)
+			Tiles[TileIndex] = AsepriteReadU32(Tiles + TileIndex);
+	}
+#endif
+	Layer->Data = Tiles;
 
+	AsepriteBeginCelStats(&Layer->Stats);
+	aseprite_layer_info *LayerInfo = File->LayerInfo + Layer->Header.LayerIndex;
+	aseprite_tileset *Tileset = AsepriteGetTileset(File, LayerInfo->TilesetIndex);
+	if (Tiles && Tileset)
+	{
+		aseprite_cel_stats *Stats = &Layer->Stats;
 		for (int Y = 0; Y < Height; Y++)
 		{
-			if (Y + DestY < 0)
-				continue;
-			if (Y + DestY >= DestHeight)
-				break;
-
-			uint32_t *Dest = (uint32_t *)((uint8_t *)DestTexture + (DestY + Y)*DestPitch + DestStartX);
-			uint8_t *Source = ((uint8_t *)CelData + (StartY + Y)*DataPitch + StartX);
 			for (int X = 0; X < Width; X++)
 			{
-				if (X + DestX < 0)
+				if ((Tiles[(size_t)Y*Width + X] & Layer->TileMasks.TileID) == 0)
 					continue;
-				if (X + DestX >= DestWidth)
-					break;
-
-				aseprite_color SourceColor;
-				switch (ColorDepth)
-				{
-					case 8:
-					{
-						uint8_t PaletteIndex = (*Source++);
-						if (PaletteIndex == TransparentPaletteEntry)
-							SourceColor = (aseprite_color){0};
-						else
-							SourceColor = Palette->Colors[PaletteIndex];
-					} break;
-					case 32:
-					{
-						uint32_t *Src = (uint32_t *)Source;
-						Source = (uint8_t *)(Src + 1);
-						SourceColor = AsepriteColorFromRGBA8(Src);
-					} break;
-				}
-				if (LayerOpacity == 0)
-				{
-					SourceColor = (aseprite_color){0};
-				}
-				else if (LayerOpacity != 1)
+				int MinX = X*Tileset->TileWidth;
+				int MinY = Y*Tileset->TileHeight;
+				if (Stats->IsEmpty)
 				{
-					SourceColor.A *= LayerOpacity;
-					SourceColor.A8 = (uint8_t)(SourceColor.A * 255);
+					Stats->MinX = MinX;
+					Stats->MinY = MinY;
+					Stats->MaxX = MinX + Tileset->TileWidth;
+					Stats->IsEmpty = false;
 				}
-				if (LayerIndex == 0 || *Dest == 0)
-					*Dest = *((uint32_t *)SourceColor.RGBA8);
-				else if (*SourceColor.RGBA8 != 0)
+				Stats->MinX = AsepriteMinInt(Stats->MinX, MinX);
+				Stats->MaxX = AsepriteMaxInt(Stats->MaxX, MinX + Tileset->TileWidth);
+				Stats->MaxY = MinY + Tileset->TileHeight;
+			}
+		}
+		//Tiles can have transparent pixels, so never claim to be opaque
+		Stats->IsOpaque = false;
+	}
+	AsepriteEndCelStats(&Layer->Stats);
+}
+
+void
+AsepriteParseCel(aseprite_file *File, aseprite_frame *Frame, aseprite_parser *Parser, void *ChunkData, int ChunkLength)
+{
+	aseprite_cel_header CelHeader = AsepriteReadCelHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_CEL_HEADER_SIZE);
+
+	aseprite_layer *Layer = &Frame->Layers[CelHeader.LayerIndex];
+	Layer->Header = CelHeader;
+
+	uint16_t ColorDepth = File->Header.ColorDepth;
+	uint8_t TransparentPaletteEntry = File->Header.TransparentPaletteEntry;
+
+	printf_d("  Layer Index: %d\n", CelHeader.LayerIndex);
+	printf_d("  XPos: %d\n", CelHeader.XPos);
+	printf_d("  YPos: %d\n", CelHeader.YPos);
+	printf_d("  Opacity: %d\n", CelHeader.Opacity);
+
+	printf_d("  Cel Type:  ");
+	switch (CelHeader.CelType)
+	{
+		case AsepriteCelType_Raw: 
+		{
+			printf_d("Raw\n");
+			uint16_t WidthInPixels = AsepriteReadU16(ChunkData);
+			ChunkData = ((uint16_t *)ChunkData + 1);
+			uint16_t HeightInPixels = AsepriteReadU16(ChunkData);
+			ChunkData = ((uint16_t *)ChunkData + 1);
+			int DataSize = ChunkLength - ASEPRITE_CEL_HEADER_SIZE - sizeof(uint16_t)*2;
+			int Pitch = WidthInPixels*AsepriteBytesPerPixel(ColorDepth);
+			size_t CelSize = (size_t)Pitch*HeightInPixels;
+			size_t CopySize = (DataSize > 0) ? AsepriteMinSize((size_t)DataSize, CelSize) : 0;
+			Layer->DataWidth = WidthInPixels;
+			Layer->DataHeight = HeightInPixels;
+			Layer->Data = AsepriteAllocCelData(CelSize);
+
+			//Copy and scan a row at a time so the stats come for free
+			AsepriteBeginCelStats(&Layer->Stats);
+			if (!Layer->Data)
+			{
+				printf_d("  Failed to allocate cel data\n");
+				AsepriteEndCelStats(&Layer->Stats);
+				break;
+			}
+			memset(Layer->Data, 0, CelSize);
+			for (int Y = 0; Y < HeightInPixels; Y++)
+			{
+				size_t RowStart = (size_t)Y*Pitch;
+				uint8_t *Row = (uint8_t *)Layer->Data + RowStart;
+				if (RowStart < CopySize)
+					memcpy(Row, (uint8_t *)ChunkData + RowStart, AsepriteMinSize(CopySize - RowStart, Pitch));
+				AsepriteAccumulateCelStats(&Layer->Stats, Row, Y, 1, WidthInPixels, ColorDepth, TransparentPaletteEntry);
+			}
+			AsepriteEndCelStats(&Layer->Stats);
+		} break;
+		case AsepriteCelType_Linked: 
+		{
+			printf_d("Linked\n");
+		} break;
+		case AsepriteCelType_Compressed: 
+		{
+			printf_d("Compressed\n");
+			uint16_t WidthInPixels = AsepriteReadU16(ChunkData);
+			ChunkData = ((uint16_t *)ChunkData + 1);
+			uint16_t HeightInPixels = AsepriteReadU16(ChunkData);
+			ChunkData = ((uint16_t *)ChunkData + 1);
+			printf_d("  Cel data size x,y (%d, %d)\n", WidthInPixels, HeightInPixels);
+			int DataSize = ChunkLength - ASEPRITE_CEL_HEADER_SIZE - sizeof(uint16_t)*2;
+			Layer->DataWidth = WidthInPixels;
+			Layer->DataHeight = HeightInPixels;
+			if (Parser->Flags & AsepriteParseFlags_KeepCompressedCels)
+			{
+				Layer->CompressedData = (DataSize > 0) ? malloc(DataSize) : 0;
+				if (!Layer->CompressedData)
 				{
-					aseprite_color DestColor = AsepriteColorFromRGBA8(Dest);
-					aseprite_color FinalColor = AsepriteCombineColors(&SourceColor, &DestColor, BlendMode);
-					*Dest = *((uint32_t *)FinalColor.RGBA8);
+					printf_d("  Failed to keep cel data\n");
+					AsepriteBeginCelStats(&Layer->Stats);
+					AsepriteEndCelStats(&Layer->Stats);
+					break;
 				}
-				Dest++;
+				Layer->CompressedSize = DataSize;
+				memcpy(Layer->CompressedData, ChunkData, DataSize);
+
+				//Nothing is known about the pixels yet, so assume the whole cel
+				AsepriteBeginCelStats(&Layer->Stats);
+				Layer->Stats.MaxX = WidthInPixels;
+				Layer->Stats.MaxY = HeightInPixels;
+				Layer->Stats.IsEmpty = (WidthInPixels == 0 || HeightInPixels == 0);
+				Layer->Stats.IsOpaque = false;
+				break;
 			}
-		}
+
+			int Pitch = WidthInPixels*AsepriteBytesPerPixel(ColorDepth);
+			uint8_t *Data = (uint8_t *)AsepriteAllocCelData((size_t)Pitch*HeightInPixels);
+			if (!Data || !AsepriteInflateCel(ChunkData, DataSize, Data, WidthInPixels, HeightInPixels, ColorDepth, TransparentPaletteEntry, &Layer->Stats))
+			{
+				printf_d("  Failed to inflate cel data\n");
+				AsepriteReleaseCelData(Data);
+				Data = 0;
+				AsepriteBeginCelStats(&Layer->Stats);
+				AsepriteEndCelStats(&Layer->Stats);
+			}
+			Layer->Data = Data;
+			printf_d("  Bounds (%d, %d)-(%d, %d)%s%s\n", Layer->Stats.MinX, Layer->Stats.MinY, Layer->Stats.MaxX, Layer->Stats.MaxY,
+					 Layer->Stats.IsEmpty ? " empty" : "", Layer->Stats.IsOpaque ? " opaque" : "");
+			printf_d("\n");
+			
+		} break;
+		case AsepriteCelType_CompressedTilemap:
+		{
+			printf_d("Compressed Tilemap\n");
+			int DataSize = ChunkLength - ASEPRITE_CEL_HEADER_SIZE;
+			AsepriteParseTilemapCel(File, Layer, ChunkData, DataSize);
+		} break;
+	}
+
+	AsepriteShareCelData(File, Parser, Layer);
+}
+
+void
+AsepriteParseLayer(aseprite_file *File, aseprite_parser *Parser, void *ChunkData)
+{
+	if (File->NumLayers == Parser->AvailableLayers)
+	{
+		Parser->AvailableLayers *= 2;
+		File->LayerInfo = (aseprite_layer_info *)realloc(File->LayerInfo, sizeof(aseprite_layer_info)*Parser->AvailableLayers);
 	}
+
+	aseprite_layer_info *NewLayer = &File->LayerInfo[File->NumLayers++];
+
+	aseprite_layer_header LayerHeader = AsepriteReadLayerHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_LAYER_HEADER_SIZE);
+
+	NewLayer->Header = LayerHeader;
+	memset(&NewLayer->UserData, 0, sizeof(aseprite_user_data));
+
+	printf_d(" Layer Flags\n");
+	if (LayerHeader.Flags & AsepriteLayerFlags_Visible)
+		printf_d("     Visible\n");
+	if (LayerHeader.Flags & AsepriteLayerFlags_Editable)
+		printf_d("     Editable\n");
+	if (LayerHeader.Flags & AsepriteLayerFlags_LockMovement)
+		printf_d("     Lock Movement\n");
+	if (LayerHeader.Flags & AsepriteLayerFlags_Background)
+		printf_d("     Background\n");
+	if (LayerHeader.Flags & AsepriteLayerFlags_PreferLinkedCels)
+		printf_d("     Prefer Linked Cels\n");
+
+	printf_d(" Layer Type: %d\n", LayerHeader.LayerType);
+	printf_d(" Layer Child: %d\n", LayerHeader.LayerChild);
+
+	printf_d(" Blend Mode:  ");
+	switch (LayerHeader.BlendMode)
+	{
+		case AsepriteBlendMode_Normal: {printf_d("Normal\n");} break;
+		case AsepriteBlendMode_Multiply: {printf_d("Multiply\n");} break;
+		case AsepriteBlendMode_Screen: {printf_d("Screen \n");} break;
+		case AsepriteBlendMode_Overlay: {printf_d("Overlay \n");} break;
+		case AsepriteBlendMode_Darken: {printf_d("Darken \n");} break;
+		case AsepriteBlendMode_Lighten: {printf_d("Lighten \n");} break;
+		case AsepriteBlendMode_ColorDodge: {printf_d("Color Dodge\n");} break;
+		case AsepriteBlendMode_ColorBurn: {printf_d("Color Burn\n");} break;
+		case AsepriteBlendMode_HardLight: {printf_d("Hard Light\n");} break;
+		case AsepriteBlendMode_SoftLight: {printf_d("Soft Light\n");} break;
+		case AsepriteBlendMode_Difference: {printf_d("Difference\n");} break;
+		case AsepriteBlendMode_Exclusion: {printf_d("Exclusion\n");} break;
+		case AsepriteBlendMode_Hue: {printf_d("Hue \n");} break;
+		case AsepriteBlendMode_Saturation: {printf_d("Saturation\n");} break;
+		case AsepriteBlendMode_Color: {printf_d("Color\n");} break;
+		case AsepriteBlendMode_Luminosity: {printf_d("Luminosity\n");} break;
+	}
+
+	printf_d(" Opacity: %d\n", LayerHeader.Opacity);
+	aseprite_string LayerName = AsepriteParseString(ChunkData);
+	printf_d(" Layer name: %.*s\n", LayerName.Length, LayerName.String);
+
+	NewLayer->Name = (char *)malloc(LayerName.Length + 1);
+	memcpy(NewLayer->Name, LayerName.String, LayerName.Length);
+	NewLayer->Name[LayerName.Length] = '\0';
+	ChunkData = ((char *)ChunkData + sizeof(uint16_t) + LayerName.Length);
+
+	NewLayer->TilesetIndex = 0;
+	if (LayerHeader.LayerType == AsepriteLayerType_Tilemap)
+	{
+		NewLayer->TilesetIndex = AsepriteReadU32(ChunkData);
+		printf_d(" Tileset index: %d\n", NewLayer->TilesetIndex);
+	}
+}
+
+void
+AsepriteParseSlice(aseprite_file *File, aseprite_parser *Parser, void *ChunkData)
+{
+	aseprite_slice_header SliceHeader = AsepriteReadSliceHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_SLICE_HEADER_SIZE);
+
+	if (File->NumSlices == Parser->AvailableSlices)
+	{
+		Parser->AvailableSlices = Parser->AvailableSlices ? Parser->AvailableSlices*2 : 4;
+		File->Slices = (aseprite_slice *)realloc(File->Slices, sizeof(aseprite_slice)*Parser->AvailableSlices);
+	}
+	if (File->NumSliceKeys + (int)SliceHeader.NumKeys > Parser->AvailableSliceKeys)
+	{
+		while (File->NumSliceKeys + (int)SliceHeader.NumKeys > Parser->AvailableSliceKeys)
+			Parser->AvailableSliceKeys = Parser->AvailableSliceKeys ? Parser->AvailableSliceKeys*2 : 8;
+		File->SliceKeys = (aseprite_slice_key *)realloc(File->SliceKeys, sizeof(aseprite_slice_key)*Parser->AvailableSliceKeys);
+	}
+
+	aseprite_slice *Slice = &File->Slices[File->NumSlices++];
+	Slice->Flags = SliceHeader.Flags;
+	Slice->FirstKey = File->NumSliceKeys;
+	Slice->NumKeys = SliceHeader.NumKeys;
+	memset(&Slice->UserData, 0, sizeof(aseprite_user_data));
+
+	aseprite_string SliceName = AsepriteParseString(ChunkData);
+	ChunkData = ((char *)ChunkData + sizeof(uint16_t) + SliceName.Length);
+	Slice->Name = (char *)malloc(SliceName.Length + 1);
+	memcpy(Slice->Name, SliceName.String, SliceName.Length);
+	Slice->Name[SliceName.Length] = '\0';
+
+	printf_d(" Slice name: %s\n", Slice->Name);
+	printf_d(" Keys: %d\n", SliceHeader.NumKeys);
+
+	for (uint32_t KeyIndex = 0; KeyIndex < SliceHeader.NumKeys; KeyIndex++)
+	{
+		aseprite_slice_key_header KeyHeader = AsepriteReadSliceKeyHeader(ChunkData);
+		ChunkData = ((uint8_t *)ChunkData + ASEPRITE_SLICE_KEY_HEADER_SIZE);
+
+		aseprite_slice_key Key = {0};
+		Key.FrameNumber = KeyHeader.FrameNumber;
+		Key.X = KeyHeader.XOrigin;
+		Key.Y = KeyHeader.YOrigin;
+		Key.Width = KeyHeader.Width;
+		Key.Height = KeyHeader.Height;
+		if (SliceHeader.Flags & AsepriteSliceFlags_NinePatch)
+		{
+			aseprite_slice_center Center = AsepriteReadSliceCenter(ChunkData);
+			ChunkData = ((uint8_t *)ChunkData + ASEPRITE_SLICE_CENTER_SIZE);
+			Key.CenterX = Center.XPos;
+			Key.CenterY = Center.YPos;
+			Key.CenterWidth = Center.Width;
+			Key.CenterHeight = Center.Height;
+		}
+		if (SliceHeader.Flags & AsepriteSliceFlags_HasPivot)
+		{
+			aseprite_slice_pivot Pivot = AsepriteReadSlicePivot(ChunkData);
+			ChunkData = ((uint8_t *)ChunkData + ASEPRITE_SLICE_PIVOT_SIZE);
+			Key.PivotX = Pivot.XPos;
+			Key.PivotY = Pivot.YPos;
+		}
+		printf_d("   Frame %d: (%d, %d) %dx%d\n", Key.FrameNumber, Key.X, Key.Y, Key.Width, Key.Height);
+
+		//Keys are written in frame order, but keep the run sorted regardless so
+		//lookups can binary search it
+		aseprite_slice_key *Keys = File->SliceKeys + Slice->FirstKey;
+		int InsertAt = KeyIndex;
+		while (InsertAt > 0 && Keys[InsertAt - 1].FrameNumber > Key.FrameNumber)
+		{
+			Keys[InsertAt] = Keys[InsertAt - 1];
+			InsertAt--;
+		}
+		Keys[InsertAt] = Key;
+	}
+	File->NumSliceKeys += SliceHeader.NumKeys;
+}
+
+void
+AsepriteParseTags(aseprite_file *File, void *ChunkData)
+{
+	aseprite_tags_header TagsHeader = AsepriteReadTagsHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_TAGS_HEADER_SIZE);
+
+	int FirstTag = File->NumTags;
+	File->NumTags += TagsHeader.NumTags;
+	File->Tags = (aseprite_tag *)realloc(File->Tags, sizeof(aseprite_tag)*File->NumTags);
+
+	printf_d(" Num Tags: %d\n", TagsHeader.NumTags);
+	for (int TagIndex = FirstTag; TagIndex < File->NumTags; TagIndex++)
+	{
+		aseprite_tag_header TagHeader = AsepriteReadTagHeader(ChunkData);
+		ChunkData = ((uint8_t *)ChunkData + ASEPRITE_TAG_HEADER_SIZE);
+
+		aseprite_tag *Tag = &File->Tags[TagIndex];
+		memset(Tag, 0, sizeof(aseprite_tag));
+		Tag->FromFrame = TagHeader.FromFrame;
+		Tag->ToFrame = TagHeader.ToFrame;
+		Tag->LoopDirection = TagHeader.LoopDirection;
+		Tag->Repeat = TagHeader.Repeat;
+
+		aseprite_string TagName = AsepriteParseString(ChunkData);
+		ChunkData = ((char *)ChunkData + sizeof(uint16_t) + TagName.Length);
+		Tag->Name = (char *)malloc(TagName.Length + 1);
+		memcpy(Tag->Name, TagName.String, TagName.Length);
+		Tag->Name[TagName.Length] = '\0';
+
+		printf_d("   Tag %s: frames %d-%d\n", Tag->Name, Tag->FromFrame, Tag->ToFrame);
+	}
+}
+
+void
+AsepriteParseUserData(aseprite_file *File, aseprite_frame *Frame, aseprite_parser *Parser, void *ChunkData)
+{
+	aseprite_user_data UserData = {0};
+	UserData.Flags = AsepriteReadU32(ChunkData);
+	ChunkData = ((uint32_t *)ChunkData + 1);
+
+	if (UserData.Flags & AsepriteUserDataFlags_HasText)
+	{
+		aseprite_string Text = AsepriteParseString(ChunkData);
+		ChunkData = ((char *)ChunkData + sizeof(uint16_t) + Text.Length);
+		UserData.TextOffset = AsepriteInternString(&File->Strings, Text.String, Text.Length);
+		UserData.TextLength = Text.Length;
+		//Out of memory: the text is dropped
+		if (UserData.TextOffset == ASEPRITE_NO_STRING)
+		{
+			UserData.Flags &= ~AsepriteUserDataFlags_HasText;
+			UserData.TextOffset = 0;
+			UserData.TextLength = 0;
+		}
+		printf_d(" Text: %.*s\n", Text.Length, Text.String);
+	}
+	if (UserData.Flags & AsepriteUserDataFlags_HasColor)
+	{
+		uint8_t *Color = (uint8_t *)ChunkData;
+		UserData.R8 = Color[0];
+		UserData.G8 = Color[1];
+		UserData.B8 = Color[2];
+		UserData.A8 = Color[3];
+		printf_d(" Color: R%d G%d B%d A%d\n", Color[0], Color[1], Color[2], Color[3]);
+	}
+
+	switch (Parser->UserDataTarget)
+	{
+		case AsepriteUserDataTarget_Sprite:
+		{
+			File->UserData = UserData;
+		} break;
+		case AsepriteUserDataTarget_Layer:
+		{
+			File->LayerInfo[Parser->UserDataIndex].UserData = UserData;
+		} break;
+		case AsepriteUserDataTarget_Cel:
+		{
+			Frame->Layers[Parser->UserDataIndex].UserData = UserData;
+		} break;
+		case AsepriteUserDataTarget_Tag:
+		{
+			//Each following user data chunk belongs to the next tag
+			File->Tags[Parser->UserDataIndex++].UserData = UserData;
+			if (Parser->UserDataIndex == File->NumTags)
+				Parser->UserDataTarget = AsepriteUserDataTarget_None;
+			return;
+		} break;
+		case AsepriteUserDataTarget_Slice:
+		{
+			File->Slices[Parser->UserDataIndex].UserData = UserData;
+		} break;
+		default:
+		{
+			printf_d(" (not attached to anything)\n");
+		} break;
+	}
+	Parser->UserDataTarget = AsepriteUserDataTarget_None;
+}
+
+void
+AsepriteParseColorProfile(aseprite_file *File, void *ChunkData)
+{
+	aseprite_color_profile_header ProfileHeader = AsepriteReadColorProfileHeader(ChunkData);
+	ChunkData = ((uint8_t *)ChunkData + ASEPRITE_COLOR_PROFILE_HEADER_SIZE);
+
+	File->ColorProfile.Type = ProfileHeader.Type;
+	File->ColorProfile.Flags = ProfileHeader.Flags;
+	//16.16 fixed point
+	File->ColorProfile.Gamma = ProfileHeader.FixedGamma / 65536.0f;
+	File->ColorProfile.ICCLength = 0;
+	if (ProfileHeader.Type == AsepriteColorProfile_ICC)
+		File->ColorProfile.ICCLength = AsepriteReadU32(ChunkData);
+
+	printf_d(" Type: %d\n", ProfileHeader.Type);
+	if (ProfileHeader.Flags & AsepriteColorProfileFlags_FixedGamma)
+		printf_d(" Fixed gamma: %f\n", File->ColorProfile.Gamma);
+}
+
+// You can see which 'chunk' types are not implemented here.  Some are deprecated, so no
+// need to fill those in.
+
+bool
+AsepriteParseChunk(aseprite_file *File, aseprite_frame *Frame, aseprite_parser *Parser, void *FrameEnd)
+{
+	if ((char *)FrameEnd - (char *)Parser->At < ASEPRITE_CHUNK_HEADER_SIZE)
+	{
+		printf_d("Chunk runs past the end of the frame\n");
+		return false;
+	}
+	aseprite_chunk_header ChunkHeader = AsepriteReadChunkHeader(Parser->At);
+	if (ChunkHeader.ChunkSize < ASEPRITE_CHUNK_HEADER_SIZE ||
+		ChunkHeader.ChunkSize > (size_t)((char *)FrameEnd - (char *)Parser->At))
+	{
+		printf_d("Chunk runs past the end of the frame\n");
+		return false;
+	}
+	void *ChunkData = ((uint8_t *)Parser->At + ASEPRITE_CHUNK_HEADER_SIZE);
+	Parser->At = ((char *)Parser->At + ChunkHeader.ChunkSize);
+
+	//Anything other than a user data chunk changes what the next user data
+	//chunk attaches to, except a cel extra chunk, which Aseprite writes between
+	//a cel and its user data
+	if (ChunkHeader.ChunkType != AsepriteChunk_UserData && ChunkHeader.ChunkType != AsepriteChunk_CelExtra)
+		Parser->UserDataTarget = AsepriteUserDataTarget_None;
+
+	printf_d("Chunk type: ");
+	switch (ChunkHeader.ChunkType)
+	{
+		case AsepriteChunk_OldPalette:
+		{
+			printf_d("old palette\n");
+			if (!Parser->UsesNewPalette)
+				AsepriteParseOldPalette(File, ChunkData);
+			Parser->UserDataTarget = AsepriteUserDataTarget_Sprite;
+		} break;
+		case AsepriteChunk_OldPalette2:
+		{
+			printf_d("old palette\n");
+		} break;
+		case AsepriteChunk_ColorProfile:
+		{
+			printf_d("color profile\n");
+			AsepriteParseColorProfile(File, ChunkData);
+		} break;
+		case AsepriteChunk_Layer:
+		{
+			printf_d("layer\n");
+			AsepriteParseLayer(File, Parser, ChunkData);
+			Parser->UserDataTarget = AsepriteUserDataTarget_Layer;
+			Parser->UserDataIndex = File->NumLayers - 1;
+		} break;
+		case AsepriteChunk_Cel:
+		{
+			printf_d("cel\n");
+			if (Frame->NumLayers != File->NumLayers)
+			{
+				Frame->NumLayers = File->NumLayers;
+				Frame->Layers = (aseprite_layer *)calloc(Frame->NumLayers, sizeof(aseprite_layer));
+			}
+			AsepriteParseCel(File, Frame, Parser, ChunkData, ChunkHeader.ChunkSize - ASEPRITE_CHUNK_HEADER_SIZE);
+			Parser->UserDataTarget = AsepriteUserDataTarget_Cel;
+			Parser->UserDataIndex = AsepriteReadCelHeader(ChunkData).LayerIndex;
+		} break;
+		case AsepriteChunk_Mask:
+		{
+			printf_d("mask\n");
+		} break;
+		case AsepriteChunk_Path:
+		{
+			printf_d("path\n");
+		} break;
+		case AsepriteChunk_FrameTags:
+		{
+			printf_d("frame tags\n");
+			int FirstTag = File->NumTags;
+			AsepriteParseTags(File, ChunkData);
+			if (FirstTag < File->NumTags)
+			{
+				Parser->UserDataTarget = AsepriteUserDataTarget_Tag;
+				Parser->UserDataIndex = FirstTag;
+			}
+		} break;
+		case AsepriteChunk_Palette:
+		{
+			printf_d("palette\n");
+			Parser->UsesNewPalette = true;
+			AsepriteParsePalette(File, ChunkData);
+			Parser->UserDataTarget = AsepriteUserDataTarget_Sprite;
+		} break;
+		case AsepriteChunk_UserData:
+		{
+			printf_d("user data\n");
+			AsepriteParseUserData(File, Frame, Parser, ChunkData);
+		} break;
+		case AsepriteChunk_Slice:
+		{
+			printf_d("slice\n");
+			AsepriteParseSlice(File, Parser, ChunkData);
+			Parser->UserDataTarget = AsepriteUserDataTarget_Slice;
+			Parser->UserDataIndex = File->NumSlices - 1;
+		} break;
+		case AsepriteChunk_Tileset:
+		{
+			printf_d("tileset\n");
+			AsepriteParseTileset(File, ChunkData);
+		} break;
+	}
+	printf_d("\n");
+	return true;
+}
+
+bool
+AsepriteParseFrame(aseprite_file *File, aseprite_frame *Frame, aseprite_parser *Parser)
+{
+	if ((char *)Parser->End - (char *)Parser->At < ASEPRITE_FRAME_HEADER_SIZE)
+	{
+		printf_d("Frame runs past the end of the file\n");
+		return false;
+	}
+	aseprite_frame_header FrameHeader = AsepriteReadFrameHeader(Parser->At);
+	if (FrameHeader.BytesInFrame < ASEPRITE_FRAME_HEADER_SIZE ||
+		FrameHeader.BytesInFrame > (size_t)((char *)Parser->End - (char *)Parser->At))
+	{
+		printf_d("Frame runs past the end of the file\n");
+		return false;
+	}
+	void *FrameEnd = (char *)Parser->At + FrameHeader.BytesInFrame;
+	Parser->At = ((uint8_t *)Parser->At + ASEPRITE_FRAME_HEADER_SIZE);
+	File->NumFrames++;
+
+	Frame->Header = FrameHeader;
+
+	printf_d("Frame: \n");
+	printf_d("   Duration: %d\n", FrameHeader.FrameDuration);
+	printf_d("CHUNKS: \n");
+
+	for (int ChunkIndex = 0; ChunkIndex < FrameHeader.ChunksInFrame; ChunkIndex++)
+	{
+		if (Parser->Cancel && AsepriteAtomicLoad(Parser->Cancel))
+			return false;
+		if (!AsepriteParseChunk(File, Frame, Parser, FrameEnd))
+			break;
+	}
+	Parser->At = FrameEnd;
+
+	printf_d("\n");
+	return true;
+}
+
+/*
+ * Converting RGBA files to indexed
+ *
+ * A lot of RGBA art is really pixel art with a few dozen colors.  Stored as
+ * palette indices its cels take a quarter of the memory and draw through the
+ * palette, like any indexed file.  AsepriteConvertToIndexed gathers the
+ * distinct colors of every cel and tileset in a hash set; with at most 255 of
+ * them the conversion is exact.  With more it either gives up or, when lossy,
+ * quantizes them to 255 by median cut.
+ *
+ * Index 0 becomes the transparent entry and takes every pixel that is all
+ * zeros.  Other colors keep their alpha in the palette, even zero: the
+ * compositor copies such a pixel into an empty spot of the frame as is, and a
+ * layer blended over it later sees its color.
+ */
+
+// Colors are the 4 RGBA8 bytes of a pixel read as one word.  0 marks an empty
+// slot, which is safe since that color is index 0 and never stored.
+
+struct aseprite_color_set
+{
+	uint32_t *Colors;
+	uint32_t *Counts;
+	uint8_t *Indices;
+	uint32_t NumSlots;
+	uint32_t NumColors;
+};
+
+inline uint32_t
+AsepriteHashColor(uint32_t Color)
+{
+	Color ^= Color >> 16;
+	Color *= 0x7FEB352Du;
+	Color ^= Color >> 15;
+	Color *= 0x846CA68Bu;
+	Color ^= Color >> 16;
+	return Color;
+}
+
+void
+AsepriteFreeColorSet(aseprite_color_set *Set)
+{
+	free(Set->Colors);
+	free(Set->Counts);
+	free(Set->Indices);
+	memset(Set, 0, sizeof(aseprite_color_set));
+}
+
+// Returns the slot holding Color, or -1 if it isn't in the set.
+
+inline int
+AsepriteFindColor(aseprite_color_set *Set, uint32_t Color)
+{
+	uint32_t Slot = AsepriteHashColor(Color) & (Set->NumSlots - 1);
+	while (Set->Colors[Slot])
+	{
+		if (Set->Colors[Slot] == Color)
+			return (int)Slot;
+		Slot = (Slot + 1) & (Set->NumSlots - 1);
+	}
+	return -1;
+}
+
+bool
+AsepriteAddColor(aseprite_color_set *Set, uint32_t Color, uint32_t Count)
+{
+	if (2*(Set->NumColors + 1) > Set->NumSlots)
+	{
+		aseprite_color_set Grown = {0};
+		Grown.NumSlots = Set->NumSlots ? Set->NumSlots*2 : 1024;
+		Grown.Colors = (uint32_t *)calloc(Grown.NumSlots, sizeof(uint32_t));
+		Grown.Counts = (uint32_t *)calloc(Grown.NumSlots, sizeof(uint32_t));
+		if (!Grown.Colors || !Grown.Counts)
+		{
+			AsepriteFreeColorSet(&Grown);
+			return false;
+		}
+		for (uint32_t Slot = 0; Slot < Set->NumSlots; Slot++)
+		{
+			if (Set->Colors[Slot])
+				AsepriteAddColor(&Grown, Set->Colors[Slot], Set->Counts[Slot]);
+		}
+		AsepriteFreeColorSet(Set);
+		*Set = Grown;
+	}
+
+	uint32_t Slot = AsepriteHashColor(Color) & (Set->NumSlots - 1);
+	while (Set->Colors[Slot] && Set->Colors[Slot] != Color)
+		Slot = (Slot + 1) & (Set->NumSlots - 1);
+	if (!Set->Colors[Slot])
+	{
+		Set->Colors[Slot] = Color;
+		Set->NumColors++;
+	}
+	Set->Counts[Slot] += Count;
+	return true;
+}
+
+// Adds the colors of NumPixels RGBA pixels.  Runs of one color (most of any
+// piece of pixel art) cost one lookup.  Stops early, returning false, once the
+// set holds more than MaxColors.
+
+bool
+AsepriteGatherColors(aseprite_color_set *Set, const uint8_t *Pixels, size_t NumPixels, uint32_t MaxColors)
+{
+	size_t PixelIndex = 0;
+	while (PixelIndex < NumPixels)
+	{
+		uint32_t Color;
+		memcpy(&Color, Pixels + PixelIndex*4, 4);
+		size_t RunEnd = PixelIndex + 1;
+		while (RunEnd < NumPixels && memcmp(Pixels + RunEnd*4, &Color, 4) == 0)
+			RunEnd++;
+		if (Color != 0)
+		{
+			if (!AsepriteAddColor(Set, Color, (uint32_t)(RunEnd - PixelIndex)) || Set->NumColors > MaxColors)
+				return false;
+		}
+		PixelIndex = RunEnd;
+	}
+	return true;
+}
+
+struct aseprite_color_count
+{
+	uint8_t RGBA8[4];
+	uint32_t Count;
+	uint32_t Slot;
+};
+
+// A run of the color array, and its widest channel.
+
+struct aseprite_color_box
+{
+	int Begin;
+	int End;
+	int Channel;
+	int Range;
+};
+
+void
+AsepriteMeasureColorBox(aseprite_color_count *Entries, aseprite_color_box *Box)
+{
+	Box->Channel = 0;
+	Box->Range = 0;
+	for (int Channel = 0; Channel < 4; Channel++)
+	{
+		int Min = 255;
+		int Max = 0;
+		for (int EntryIndex = Box->Begin; EntryIndex < Box->End; EntryIndex++)
+		{
+			Min = AsepriteMinInt(Min, Entries[EntryIndex].RGBA8[Channel]);
+			Max = AsepriteMaxInt(Max, Entries[EntryIndex].RGBA8[Channel]);
+		}
+		if (Max - Min > Box->Range)
+		{
+			Box->Range = Max - Min;
+			Box->Channel = Channel;
+		}
+	}
+}
+
+// Median cut: keeps splitting the box with the widest channel at the median
+// pixel (weighted by how often each color is used) along that channel, until
+// there are MaxColors boxes.  Each color's index in the set becomes its box's
+// (plus one, after the transparent entry) and Palette gets the boxes' weighted
+// mean colors.  Colors with zero alpha take no box and go to index 0, since
+// averaging them into a visible color would show them.  Returns the number of
+// boxes, or -1 if out of memory.
+
+int
+AsepriteMedianCut(aseprite_color_set *Set, int MaxColors, aseprite_color *Palette)
+{
+	int NumEntries = 0;
+	aseprite_color_count *Entries = (aseprite_color_count *)malloc(sizeof(aseprite_color_count)*Set->NumColors*2);
+	aseprite_color_box *Boxes = (aseprite_color_box *)malloc(sizeof(aseprite_color_box)*MaxColors);
+	if (!Entries || !Boxes)
+	{
+		free(Entries);
+		free(Boxes);
+		return -1;
+	}
+	aseprite_color_count *Sorted = Entries + Set->NumColors;
+	for (uint32_t Slot = 0; Slot < Set->NumSlots; Slot++)
+	{
+		aseprite_color_count *Entry = Entries + NumEntries;
+		memcpy(Entry->RGBA8, &Set->Colors[Slot], 4);
+		if (!Set->Colors[Slot] || Entry->RGBA8[3] == 0)
+			continue;
+		Entry->Count = Set->Counts[Slot];
+		Entry->Slot = Slot;
+		NumEntries++;
+	}
+	if (NumEntries == 0)
+	{
+		free(Entries);
+		free(Boxes);
+		return 0;
+	}
+
+	int NumBoxes = 1;
+	Boxes[0].Begin = 0;
+	Boxes[0].End = NumEntries;
+	AsepriteMeasureColorBox(Entries, Boxes);
+	while (NumBoxes < MaxColors)
+	{
+		aseprite_color_box *Box = Boxes;
+		for (int BoxIndex = 1; BoxIndex < NumBoxes; BoxIndex++)
+		{
+			if (Boxes[BoxIndex].Range > Box->Range)
+				Box = Boxes + BoxIndex;
+		}
+		if (Box->Range == 0)
+			break;
+
+		//Channels are bytes, so a counting sort orders the box
+		int Starts[257] = {0};
+		uint64_t Total = 0;
+		for (int At = Box->Begin; At < Box->End; At++)
+		{
+			Starts[Entries[At].RGBA8[Box->Channel] + 1]++;
+			Total += Entries[At].Count;
+		}
+		for (int Value = 0; Value < 256; Value++)
+			Starts[Value + 1] += Starts[Value];
+		for (int At = Box->Begin; At < Box->End; At++)
+			Sorted[Box->Begin + Starts[Entries[At].RGBA8[Box->Channel]]++] = Entries[At];
+		memcpy(Entries + Box->Begin, Sorted + Box->Begin, sizeof(aseprite_color_count)*(Box->End - Box->Begin));
+
+		int Middle = Box->Begin;
+		uint64_t Below = 0;
+		while (Middle < Box->End - 1 && 2*(Below + Entries[Middle].Count) <= Total)
+			Below += Entries[Middle++].Count;
+		Middle = AsepriteMaxInt(Middle, Box->Begin + 1);
+
+		aseprite_color_box *Split = Boxes + NumBoxes++;
+		Split->Begin = Middle;
+		Split->End = Box->End;
+		Box->End = Middle;
+		AsepriteMeasureColorBox(Entries, Box);
+		AsepriteMeasureColorBox(Entries, Split);
+	}
+
+	for (int BoxIndex = 0; BoxIndex < NumBoxes; BoxIndex++)
+	{
+		uint64_t Sums[4] = {0};
+		uint64_t Weight = 0;
+		for (int At = Boxes[BoxIndex].Begin; At < Boxes[BoxIndex].End; At++)
+		{
+			for (int Channel = 0; Channel < 4; Channel++)
+				Sums[Channel] += (uint64_t)Entries[At].RGBA8[Channel]*Entries[At].Count;
+			Weight += Entries[At].Count;
+			Set->Indices[Entries[At].Slot] = (uint8_t)(BoxIndex + 1);
+		}
+		uint8_t Mean[4];
+		for (int Channel = 0; Channel < 4; Channel++)
+			Mean[Channel] = (uint8_t)((Sums[Channel] + Weight/2)/Weight);
+		Palette[BoxIndex] = AsepriteColorFromR8G8B8A8(Mean[0], Mean[1], Mean[2], Mean[3]);
+	}
+	free(Entries);
+	free(Boxes);
+	return NumBoxes;
+}
+
+// Replaces RGBA pixels with their indices in the set.  Dest may not overlap.
+
+void
+AsepriteIndexPixels(aseprite_color_set *Set, const uint8_t *Pixels, size_t NumPixels, uint8_t *Dest)
+{
+	uint32_t LastColor = 0;
+	uint8_t LastIndex = 0;
+	for (size_t PixelIndex = 0; PixelIndex < NumPixels; PixelIndex++)
+	{
+		uint32_t Color;
+		memcpy(&Color, Pixels + PixelIndex*4, 4);
+		if (Color == 0)
+		{
+			Dest[PixelIndex] = 0;
+			continue;
+		}
+		if (Color != LastColor)
+		{
+			LastColor = Color;
+			LastIndex = Set->Indices[AsepriteFindColor(Set, Color)];
+		}
+		Dest[PixelIndex] = LastIndex;
+	}
+}
+
+inline int
+AsepriteCompareCelData(const void *A, const void *B)
+{
+	uintptr_t DataA = (uintptr_t)(*(aseprite_layer **)A)->Data;
+	uintptr_t DataB = (uintptr_t)(*(aseprite_layer **)B)->Data;
+	return (DataA < DataB) ? -1 : (DataA > DataB);
+}
+
+// Turns a freshly parsed RGBA file into an indexed one (see above).  Returns
+// false, leaving the file as it was, if it isn't RGBA, has cels kept
+// compressed or stored as runs or tiles, is compacted, or has more than 255
+// colors and Lossy isn't set.
+
+bool
+AsepriteConvertToIndexed(aseprite_file *File, bool Lossy)
+{
+	if (File->Header.ColorDepth != 32 || File->Block)
+		return false;
+
+	//Image cels sorted by buffer, so shared buffers are converted once
+	int NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameIndex;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			if (Frame->Layers[LayerIndex].CompressedData || Frame->Layers[LayerIndex].IsRunLength || Frame->Layers[LayerIndex].IsTiled)
+				return false;
+			if (Frame->Layers[LayerIndex].Data && Frame->Layers[LayerIndex].Header.CelType != AsepriteCelType_CompressedTilemap)
+				NumCels++;
+		}
+	}
+	aseprite_layer **Cels = (aseprite_layer **)malloc(sizeof(aseprite_layer *)*(NumCels + 1));
+	if (!Cels)
+		return false;
+	NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameIndex;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			if (Frame->Layers[LayerIndex].Data && Frame->Layers[LayerIndex].Header.CelType != AsepriteCelType_CompressedTilemap)
+				Cels[NumCels++] = Frame->Layers + LayerIndex;
+		}
+	}
+	qsort(Cels, NumCels, sizeof(aseprite_layer *), AsepriteCompareCelData);
+
+	aseprite_color_set Set = {0};
+	uint32_t MaxColors = Lossy ? 0xFFFFFFFFu : 255;
+	bool Gathered = true;
+	for (int CelIndex = 0; Gathered && CelIndex < NumCels; CelIndex++)
+	{
+		if (CelIndex && Cels[CelIndex]->Data == Cels[CelIndex - 1]->Data)
+			continue;
+		aseprite_layer *Cel = Cels[CelIndex];
+		Gathered = AsepriteGatherColors(&Set, (uint8_t *)Cel->Data, (size_t)Cel->DataWidth*Cel->DataHeight, MaxColors);
+	}
+	for (int TilesetIndex = 0; Gathered && TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		aseprite_tileset *Tileset = File->Tilesets + TilesetIndex;
+		if (Tileset->Pixels)
+			Gathered = AsepriteGatherColors(&Set, (uint8_t *)Tileset->Pixels, (size_t)Tileset->TileWidth*Tileset->TileHeight*Tileset->NumTiles, MaxColors);
+	}
+	if (Gathered)
+		Set.Indices = (uint8_t *)calloc(Set.NumSlots + 1, 1);
+	aseprite_color *Colors = Gathered ? (aseprite_color *)calloc(256, sizeof(aseprite_color)) : 0;
+	if (!Colors || !Set.Indices)
+	{
+		AsepriteFreeColorSet(&Set);
+		free(Colors);
+		free(Cels);
+		return false;
+	}
+
+	int NumColors = 0;
+	bool Allocated = true;
+	if (Set.NumColors <= 255)
+	{
+		for (uint32_t Slot = 0; Slot < Set.NumSlots; Slot++)
+		{
+			if (!Set.Colors[Slot])
+				continue;
+			uint8_t RGBA8[4];
+			memcpy(RGBA8, &Set.Colors[Slot], 4);
+			Colors[++NumColors] = AsepriteColorFromR8G8B8A8(RGBA8[0], RGBA8[1], RGBA8[2], RGBA8[3]);
+			Set.Indices[Slot] = (uint8_t)NumColors;
+		}
+	}
+	else
+	{
+		NumColors = AsepriteMedianCut(&Set, 255, Colors + 1);
+		Allocated = (NumColors >= 0);
+		printf_d("%u colors quantized to %d\n", Set.NumColors, NumColors);
+	}
+
+	//The new buffers are all made before any old one goes, so a failure
+	//leaves the file untouched
+	void **Converted = (void **)calloc(NumCels + File->NumTilesets + 1, sizeof(void *));
+	Allocated = Allocated && Converted;
+	for (int CelIndex = 0; Allocated && CelIndex < NumCels; CelIndex++)
+	{
+		aseprite_layer *Cel = Cels[CelIndex];
+		if (CelIndex && Cel->Data == Cels[CelIndex - 1]->Data)
+			continue;
+		size_t NumPixels = (size_t)Cel->DataWidth*Cel->DataHeight;
+		Converted[CelIndex] = AsepriteAllocCelData(NumPixels);
+		Allocated = (Converted[CelIndex] != 0);
+		if (Allocated)
+			AsepriteIndexPixels(&Set, (uint8_t *)Cel->Data, NumPixels, (uint8_t *)Converted[CelIndex]);
+	}
+	for (int TilesetIndex = 0; Allocated && TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		aseprite_tileset *Tileset = File->Tilesets + TilesetIndex;
+		if (!Tileset->Pixels)
+			continue;
+		size_t NumPixels = (size_t)Tileset->TileWidth*Tileset->TileHeight*Tileset->NumTiles;
+		void **Pixels = Converted + NumCels + TilesetIndex;
+		*Pixels = malloc(NumPixels);
+		Allocated = (*Pixels != 0);
+		if (Allocated)
+			AsepriteIndexPixels(&Set, (uint8_t *)Tileset->Pixels, NumPixels, (uint8_t *)*Pixels);
+	}
+	AsepriteFreeColorSet(&Set);
+	if (!Allocated)
+	{
+		for (int CelIndex = 0; Converted && CelIndex < NumCels; CelIndex++)
+			AsepriteReleaseCelData(Converted[CelIndex]);
+		for (int TilesetIndex = 0; Converted && TilesetIndex < File->NumTilesets; TilesetIndex++)
+			free(Converted[NumCels + TilesetIndex]);
+		free(Converted);
+		free(Colors);
+		free(Cels);
+		return false;
+	}
+
+	void *Indices = 0;
+	for (int CelIndex = 0; CelIndex < NumCels; CelIndex++)
+	{
+		aseprite_layer *Cel = Cels[CelIndex];
+		if (Converted[CelIndex])
+			Indices = Converted[CelIndex];
+		else
+			AsepriteRetainCelData(Indices);
+		//The stats still hold: the same pixels are visible
+		AsepriteReleaseCelData(Cel->Data);
+		Cel->Data = Indices;
+	}
+	for (int TilesetIndex = 0; TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		aseprite_tileset *Tileset = File->Tilesets + TilesetIndex;
+		if (Tileset->Pixels)
+		{
+			free(Tileset->Pixels);
+			Tileset->Pixels = Converted[NumCels + TilesetIndex];
+		}
+	}
+	free(Converted);
+	free(Cels);
+
+	free(File->Palette.Colors);
+	File->Palette.Colors = Colors;
+	File->Palette.NumColors = NumColors + 1;
+	File->Palette.Header.NewPaletteSize = NumColors + 1;
+	File->Palette.Header.FirstColorIndexToChange = 0;
+	File->Palette.Header.LastColorIndexToChange = NumColors;
+	File->Header.ColorDepth = 8;
+	File->Header.TransparentPaletteEntry = 0;
+	File->Header.NumberOfColors = (uint16_t)(NumColors + 1);
+	return true;
+}
+
+/*
+ * Run length cels
+ *
+ * Pixel art is mostly flat runs of one color.  AsepriteEncodeCelRuns (or
+ * AsepriteParseFlags_RunLengthCels) stores a cel's rows as runs instead of
+ * pixels, and Layer->IsRunLength is set.  Data then starts with a u32 per row:
+ * the offset from Data to that row's runs.  A run is a u16 length followed by
+ * one pixel in the file's color depth, and a row's runs add up to DataWidth.
+ *
+ * The compositor looks up a run's color once and only blends it again where
+ * the destination changes, and alpha masks set a run's bits in one go.  A cel
+ * is only stored as runs when that is smaller than its pixels.  Tilemap cels
+ * are already compact and are left alone.
+ */
+
+#define ASEPRITE_RUN_HEADER_SIZE 2
+
+inline int
+AsepriteGetRunLength(const uint8_t *Run)
+{
+	uint16_t Length;
+	memcpy(&Length, Run, sizeof(Length));
+	return Length;
+}
+
+inline const uint8_t *
+AsepriteGetCelRunRow(aseprite_layer *Layer, int Row)
+{
+	uint32_t Offset;
+	memcpy(&Offset, (uint8_t *)Layer->Data + Row*sizeof(uint32_t), sizeof(Offset));
+	return (uint8_t *)Layer->Data + Offset;
+}
+
+// Writes the runs of a cel's pixels to Dest, or just measures them when Dest
+// is 0.  Returns the size in bytes.
+
+size_t
+AsepriteWriteCelRuns(const uint8_t *Pixels, int Width, int Height, int BytesPerPixel, uint8_t *Dest)
+{
+	size_t At = (size_t)Height*sizeof(uint32_t);
+	int RunSize = ASEPRITE_RUN_HEADER_SIZE + BytesPerPixel;
+	for (int Y = 0; Y < Height; Y++)
+	{
+		if (Dest)
+		{
+			uint32_t Offset = (uint32_t)At;
+			memcpy(Dest + Y*sizeof(uint32_t), &Offset, sizeof(Offset));
+		}
+		const uint8_t *Row = Pixels + (size_t)Y*Width*BytesPerPixel;
+		for (int X = 0; X < Width;)
+		{
+			const uint8_t *Pixel = Row + X*BytesPerPixel;
+			int End = X + 1;
+			while (End < Width && memcmp(Row + End*BytesPerPixel, Pixel, BytesPerPixel) == 0)
+				End++;
+			if (Dest)
+			{
+				uint16_t Length = (uint16_t)(End - X);
+				memcpy(Dest + At, &Length, sizeof(Length));
+				memcpy(Dest + At + ASEPRITE_RUN_HEADER_SIZE, Pixel, BytesPerPixel);
+			}
+			At += RunSize;
+			X = End;
+		}
+	}
+	return At;
+}
+
+// Writes Count pixels of a row of runs, starting at column Column, to Out.
+
+void
+AsepriteExpandRunRow(const uint8_t *Run, int BytesPerPixel, int Column, int Count, uint8_t *Out)
+{
+	int RunStart = 0;
+	while (Count > 0)
+	{
+		int Length = AsepriteGetRunLength(Run);
+		int RunEnd = RunStart + Length;
+		if (RunEnd > Column)
+		{
+			int Repeat = AsepriteMinInt(RunEnd - Column, Count);
+			for (int X = 0; X < Repeat; X++, Out += BytesPerPixel)
+				memcpy(Out, Run + ASEPRITE_RUN_HEADER_SIZE, BytesPerPixel);
+			Column += Repeat;
+			Count -= Repeat;
+		}
+		RunStart = RunEnd;
+		Run += ASEPRITE_RUN_HEADER_SIZE + BytesPerPixel;
+	}
+}
+
+// Stores every image cel of the file as runs where that saves memory.  Cels
+// sharing a buffer keep sharing it.  Returns false if memory ran out, in which
+// case some cels may still be pixels (which is fine).
+
+bool
+AsepriteEncodeCelRuns(aseprite_file *File)
+{
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	if (File->Block)
+		return false;
+
+	int NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+		NumCels += File->Frames[FrameIndex].NumLayers;
+	aseprite_layer **Cels = (aseprite_layer **)malloc(sizeof(aseprite_layer *)*(NumCels + 1));
+	if (!Cels)
+		return false;
+	NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameIndex;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			aseprite_layer *Layer = Frame->Layers + LayerIndex;
+			if (Layer->Data && !Layer->IsRunLength && !Layer->IsTiled && Layer->Header.CelType != AsepriteCelType_CompressedTilemap)
+				Cels[NumCels++] = Layer;
+		}
+	}
+	qsort(Cels, NumCels, sizeof(aseprite_layer *), AsepriteCompareCelData);
+
+	bool Result = true;
+	void *Pixels = 0;
+	void *Runs = 0;
+	for (int CelIndex = 0; CelIndex < NumCels; CelIndex++)
+	{
+		aseprite_layer *Cel = Cels[CelIndex];
+		if (Cel->Data != Pixels)
+		{
+			Pixels = Cel->Data;
+			Runs = 0;
+			size_t Size = AsepriteWriteCelRuns((uint8_t *)Pixels, Cel->DataWidth, Cel->DataHeight, BytesPerPixel, 0);
+			//Row offsets have to fit in a u32
+			if (Size >= AsepriteGetCelDataSize(Pixels) || Size > 0xFFFFFFFFu)
+				continue;
+			Runs = AsepriteAllocCelData(Size);
+			if (!Runs)
+			{
+				Result = false;
+				continue;
+			}
+			AsepriteWriteCelRuns((uint8_t *)Pixels, Cel->DataWidth, Cel->DataHeight, BytesPerPixel, (uint8_t *)Runs);
+		}
+		else if (Runs)
+		{
+			AsepriteRetainCelData(Runs);
+		}
+		if (Runs)
+		{
+			AsepriteReleaseCelData(Cel->Data);
+			Cel->Data = Runs;
+			Cel->IsRunLength = true;
+		}
+	}
+	free(Cels);
+	return Result;
+}
+
+// Turns one run length cel back into pixels, for code that wants to read them
+// directly.  The cel stops sharing its buffer with any others.  Compacted
+// files can't be changed.
+
+bool
+AsepriteDecodeCelRuns(aseprite_file *File, aseprite_layer *Layer)
+{
+	if (!Layer->IsRunLength)
+		return true;
+	if (File->Block)
+		return false;
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	int Pitch = Layer->DataWidth*BytesPerPixel;
+	uint8_t *Pixels = (uint8_t *)AsepriteAllocCelData((size_t)Pitch*Layer->DataHeight);
+	if (!Pixels)
+		return false;
+	for (int Y = 0; Y < Layer->DataHeight; Y++)
+		AsepriteExpandRunRow(AsepriteGetCelRunRow(Layer, Y), BytesPerPixel, 0, Layer->DataWidth, Pixels + (size_t)Y*Pitch);
+	AsepriteReleaseCelData(Layer->Data);
+	Layer->Data = Pixels;
+	Layer->IsRunLength = false;
+	return true;
+}
+
+/*
+ * Tiled cels
+ *
+ * Large background and painting layers are mostly empty or flat.
+ * AsepriteEncodeCelTiles (or AsepriteParseFlags_TiledCels) cuts such cels into
+ * 32x32 or 64x64 tiles and sets Layer->IsTiled.  Data then starts with a u32
+ * holding the tile size as a shift (5 or 6), followed by a u32 entry per tile,
+ * row by row.  An entry of 0 is a fully transparent tile and nothing else is
+ * stored for it.  Otherwise the entry is the offset from Data to the tile,
+ * with ASEPRITE_TILE_UNIFORM set if the tile is one pixel repeated and stored
+ * as just that pixel.  Other tiles hold their pixels row by row, cut short on
+ * the right and bottom edges of the cel.  Tiles start on 4 byte boundaries.
+ *
+ * The compositor and alpha masks skip the span of an empty tile without
+ * looking at it and treat a uniform tile as a run.  Cels kept compressed can be
+ * inflated straight into tiles a strip at a time (AsepriteInflateKeptCelTiles),
+ * so their pixels never exist in full.
+ */
+
+#define ASEPRITE_TILE_HEADER_SIZE 4
+#define ASEPRITE_TILE_UNIFORM 0x80000000u
+#define ASEPRITE_TILE_MIN_SHIFT 5
+#define ASEPRITE_TILE_MAX_SHIFT 6
+
+inline int
+AsepriteGetCelTileShift(aseprite_layer *Layer)
+{
+	uint32_t Shift;
+	memcpy(&Shift, Layer->Data, sizeof(Shift));
+	return (int)Shift;
+}
+
+// Number of tiles needed to cover Size pixels.
+
+inline int
+AsepriteCountTiles(int Size, int Shift)
+{
+	return (Size + (1 << Shift) - 1) >> Shift;
+}
+
+// Size in pixels of tile number Tile along an edge of Size pixels.
+
+inline int
+AsepriteGetTileSpan(int Size, int Shift, int Tile)
+{
+	return AsepriteMinInt(1 << Shift, Size - (Tile << Shift));
+}
+
+// Returns the pixels of a tile of a tiled cel, or 0 if the tile is empty.
+// *Uniform is set when the tile is stored as a single pixel.
+
+inline uint8_t *
+AsepriteGetCelTile(aseprite_layer *Layer, int Shift, int TileX, int TileY, bool *Uniform)
+{
+	uint32_t Entry;
+	size_t Index = (size_t)TileY*AsepriteCountTiles(Layer->DataWidth, Shift) + TileX;
+	memcpy(&Entry, (uint8_t *)Layer->Data + ASEPRITE_TILE_HEADER_SIZE + Index*sizeof(uint32_t), sizeof(Entry));
+	*Uniform = (Entry & ASEPRITE_TILE_UNIFORM) != 0;
+	return Entry ? (uint8_t *)Layer->Data + (Entry & ~ASEPRITE_TILE_UNIFORM) : 0;
+}
+
+// Writes the entries and tiles of tile row TileY, whose pixels are the Height
+// rows at Strip, to Dest starting at offset At, or just measures them when
+// Dest is 0.  A transparent pixel is all Transparent bytes.  Returns the
+// offset past the last tile.
+
+size_t
+AsepriteWriteTileRow(const uint8_t *Strip, int Width, int Height, int BytesPerPixel, uint8_t Transparent, int Shift, int TileY, uint8_t *Dest, size_t At)
+{
+	size_t Pitch = (size_t)Width*BytesPerPixel;
+	int TilesX = AsepriteCountTiles(Width, Shift);
+	uint8_t TransparentPixel[4];
+	memset(TransparentPixel, Transparent, sizeof(TransparentPixel));
+	for (int TileX = 0; TileX < TilesX; TileX++)
+	{
+		const uint8_t *Tile = Strip + (TileX << Shift)*BytesPerPixel;
+		int RowSize = AsepriteGetTileSpan(Width, Shift, TileX)*BytesPerPixel;
+		bool IsUniform = true;
+		for (int X = BytesPerPixel; IsUniform && X < RowSize; X += BytesPerPixel)
+			IsUniform = (memcmp(Tile + X, Tile, BytesPerPixel) == 0);
+		for (int Y = 1; IsUniform && Y < Height; Y++)
+			IsUniform = (memcmp(Tile + Y*Pitch, Tile, RowSize) == 0);
+
+		uint32_t Entry = 0;
+		size_t TileSize = 0;
+		if (!IsUniform)
+		{
+			Entry = (uint32_t)At;
+			TileSize = (size_t)RowSize*Height;
+		}
+		else if (memcmp(Tile, TransparentPixel, BytesPerPixel) != 0)
+		{
+			Entry = (uint32_t)At | ASEPRITE_TILE_UNIFORM;
+			TileSize = BytesPerPixel;
+		}
+		size_t PaddedSize = (TileSize + 3) & ~(size_t)3;
+		if (Dest)
+		{
+			size_t Index = (size_t)TileY*TilesX + TileX;
+			memcpy(Dest + ASEPRITE_TILE_HEADER_SIZE + Index*sizeof(uint32_t), &Entry, sizeof(Entry));
+			if (IsUniform)
+				memcpy(Dest + At, Tile, TileSize);
+			for (int Y = 0; !IsUniform && Y < Height; Y++)
+				memcpy(Dest + At + (size_t)Y*RowSize, Tile + Y*Pitch, RowSize);
+			memset(Dest + At + TileSize, 0, PaddedSize - TileSize);
+		}
+		At += PaddedSize;
+	}
+	return At;
+}
+
+// Writes the tiles of a cel's pixels to Dest, or just measures them when Dest
+// is 0.  Returns the size in bytes.
+
+size_t
+AsepriteWriteCelTiles(const uint8_t *Pixels, int Width, int Height, int BytesPerPixel, uint8_t Transparent, int Shift, uint8_t *Dest)
+{
+	int TilesY = AsepriteCountTiles(Height, Shift);
+	size_t At = ASEPRITE_TILE_HEADER_SIZE + (size_t)AsepriteCountTiles(Width, Shift)*TilesY*sizeof(uint32_t);
+	if (Dest)
+	{
+		uint32_t Value = (uint32_t)Shift;
+		memcpy(Dest, &Value, sizeof(Value));
+	}
+	for (int TileY = 0; TileY < TilesY; TileY++)
+	{
+		const uint8_t *Strip = Pixels + ((size_t)TileY << Shift)*Width*BytesPerPixel;
+		At = AsepriteWriteTileRow(Strip, Width, AsepriteGetTileSpan(Height, Shift, TileY), BytesPerPixel, Transparent, Shift, TileY, Dest, At);
+	}
+	return At;
+}
+
+// Writes Count pixels of row Row of a tiled cel, starting at column Column,
+// to Out.  Empty tiles come out as Transparent bytes.
+
+void
+AsepriteExpandTiledRow(aseprite_layer *Layer, int BytesPerPixel, uint8_t Transparent, int Row, int Column, int Count, uint8_t *Out)
+{
+	int Shift = AsepriteGetCelTileShift(Layer);
+	int V = Row & ((1 << Shift) - 1);
+	while (Count > 0)
+	{
+		int TileX = Column >> Shift;
+		int TileWidth = AsepriteGetTileSpan(Layer->DataWidth, Shift, TileX);
+		int U = Column - (TileX << Shift);
+		int SpanCount = AsepriteMinInt(TileWidth - U, Count);
+		bool Uniform;
+		uint8_t *Tile = AsepriteGetCelTile(Layer, Shift, TileX, Row >> Shift, &Uniform);
+		if (!Tile)
+			memset(Out, Transparent, (size_t)SpanCount*BytesPerPixel);
+		else if (Uniform)
+		{
+			for (int X = 0; X < SpanCount; X++)
+				memcpy(Out + X*BytesPerPixel, Tile, BytesPerPixel);
+		}
+		else
+			memcpy(Out, Tile + ((size_t)V*TileWidth + U)*BytesPerPixel, (size_t)SpanCount*BytesPerPixel);
+		Out += SpanCount*BytesPerPixel;
+		Column += SpanCount;
+		Count -= SpanCount;
+	}
+}
+
+// Stores every image cel of the file that is at least one small tile across
+// and down as tiles, with whichever tile size is smaller, where that saves
+// memory.  Cels sharing a buffer keep sharing it.  Returns false if memory ran
+// out, in which case some cels may still be pixels (which is fine).
+
+bool
+AsepriteEncodeCelTiles(aseprite_file *File)
+{
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	uint8_t Transparent = (File->Header.ColorDepth == 8) ? File->Header.TransparentPaletteEntry : 0;
+	if (File->Block)
+		return false;
+
+	int NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+		NumCels += File->Frames[FrameIndex].NumLayers;
+	aseprite_layer **Cels = (aseprite_layer **)malloc(sizeof(aseprite_layer *)*(NumCels + 1));
+	if (!Cels)
+		return false;
+	NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameIndex;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			aseprite_layer *Layer = Frame->Layers + LayerIndex;
+			if (Layer->Data && !Layer->IsRunLength && !Layer->IsTiled && Layer->Header.CelType != AsepriteCelType_CompressedTilemap &&
+				Layer->DataWidth >= (1 << ASEPRITE_TILE_MIN_SHIFT) && Layer->DataHeight >= (1 << ASEPRITE_TILE_MIN_SHIFT))
+				Cels[NumCels++] = Layer;
+		}
+	}
+	qsort(Cels, NumCels, sizeof(aseprite_layer *), AsepriteCompareCelData);
+
+	bool Result = true;
+	void *Pixels = 0;
+	void *Tiles = 0;
+	for (int CelIndex = 0; CelIndex < NumCels; CelIndex++)
+	{
+		aseprite_layer *Cel = Cels[CelIndex];
+		if (Cel->Data != Pixels)
+		{
+			Pixels = Cel->Data;
+			Tiles = 0;
+			int Shift = 0;
+			size_t Size = AsepriteGetCelDataSize(Pixels);
+			for (int TryShift = ASEPRITE_TILE_MAX_SHIFT; TryShift >= ASEPRITE_TILE_MIN_SHIFT; TryShift--)
+			{
+				size_t TrySize = AsepriteWriteCelTiles((uint8_t *)Pixels, Cel->DataWidth, Cel->DataHeight, BytesPerPixel, Transparent, TryShift, 0);
+				if (TrySize < Size)
+				{
+					Shift = TryShift;
+					Size = TrySize;
+				}
+			}
+			//Offsets have to fit in an entry
+			if (!Shift || Size > ~ASEPRITE_TILE_UNIFORM)
+				continue;
+			Tiles = AsepriteAllocCelData(Size);
+			if (!Tiles)
+			{
+				Result = false;
+				continue;
+			}
+			AsepriteWriteCelTiles((uint8_t *)Pixels, Cel->DataWidth, Cel->DataHeight, BytesPerPixel, Transparent, Shift, (uint8_t *)Tiles);
+		}
+		else if (Tiles)
+		{
+			AsepriteRetainCelData(Tiles);
+		}
+		if (Tiles)
+		{
+			AsepriteReleaseCelData(Cel->Data);
+			Cel->Data = Tiles;
+			Cel->IsTiled = true;
+		}
+	}
+	free(Cels);
+	return Result;
+}
+
+// Turns one tiled cel back into pixels, for code that wants to read them
+// directly.  The cel stops sharing its buffer with any others.  Compacted
+// files can't be changed.
+
+bool
+AsepriteDecodeCelTiles(aseprite_file *File, aseprite_layer *Layer)
+{
+	if (!Layer->IsTiled)
+		return true;
+	if (File->Block)
+		return false;
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	uint8_t Transparent = (File->Header.ColorDepth == 8) ? File->Header.TransparentPaletteEntry : 0;
+	int Pitch = Layer->DataWidth*BytesPerPixel;
+	uint8_t *Pixels = (uint8_t *)AsepriteAllocCelData((size_t)Pitch*Layer->DataHeight);
+	if (!Pixels)
+		return false;
+	for (int Y = 0; Y < Layer->DataHeight; Y++)
+		AsepriteExpandTiledRow(Layer, BytesPerPixel, Transparent, Y, 0, Layer->DataWidth, Pixels + (size_t)Y*Pitch);
+	AsepriteReleaseCelData(Layer->Data);
+	Layer->Data = Pixels;
+	Layer->IsTiled = false;
+	return true;
+}
+
+// Parses the file the way AsepriteParseFile does, but can stop early (see
+// aseprite_parse_options).  NumFrames is the number of frames actually read,
+// which is less than Header.Frames if the parse stopped early or the data was
+// cut short.  Options may be 0.
+
+aseprite_file
+AsepriteParseFileEx(void *FileData, aseprite_parse_options *Options)
+{
+	aseprite_file Result = {0};
+
+	if (Options && Options->FileSize && Options->FileSize < ASEPRITE_HEADER_SIZE)
+		return Result;
+	aseprite_header Header = AsepriteReadHeader(FileData);
+	size_t FileSize = Header.FileSize;
+	if (Options && Options->FileSize)
+	{
+		if (Options->FileSize < FileSize)
+			FileSize = Options->FileSize;
+	}
+	int FramesToParse = Header.Frames;
+	if (Options && Options->MaxFrames > 0 && Options->MaxFrames < FramesToParse)
+		FramesToParse = Options->MaxFrames;
+
+	aseprite_parser Parser = {0};
+	Parser.At = FileData;
+	Parser.End = (char *)FileData + FileSize;
+	Parser.AvailableLayers = 2;
+	Parser.Cancel = Options ? Options->Cancel : 0;
+	Parser.Flags = Options ? Options->Flags : 0;
+
+	Parser.At = ((uint8_t *)Parser.At + ASEPRITE_HEADER_SIZE);
+
+	Result.Header = Header;
+	Result.NumFrames = 0;
+	Result.Frames = (aseprite_frame *)calloc(FramesToParse, sizeof(aseprite_frame));
+	Result.NumLayers = 0;
+	Result.LayerInfo = (aseprite_layer_info *)malloc(sizeof(aseprite_layer_info)*Parser.AvailableLayers);
+	AsepriteInternString(&Result.Strings, "", 0);
+	Result.ColorProfile.Type = AsepriteColorProfile_SRGB;
+	Result.ColorProfile.Gamma = 1.0f;
+
+	for (int FrameIndex = 0; FrameIndex < FramesToParse; FrameIndex++)
+	{
+		if (!AsepriteParseFrame(&Result, &Result.Frames[FrameIndex], &Parser))
+			break;
+	}
+	free(Parser.CelHashes);
+	if (Result.NumSharedCels)
+		printf_d("%d cels shared, %lu bytes saved\n", Result.NumSharedCels, (unsigned long)Result.SharedCelBytes);
+	if ((Parser.Flags & AsepriteParseFlags_ConvertToIndexed) && !(Parser.Flags & AsepriteParseFlags_KeepCompressedCels))
+		AsepriteConvertToIndexed(&Result, (Parser.Flags & AsepriteParseFlags_LossyIndexed) != 0);
+	if (Parser.Flags & AsepriteParseFlags_TiledCels)
+		AsepriteEncodeCelTiles(&Result);
+	if (Parser.Flags & AsepriteParseFlags_RunLengthCels)
+		AsepriteEncodeCelRuns(&Result);
+
+	return Result;
+}
+
+aseprite_file
+AsepriteParseFile(void *FileData)
+{
+	return AsepriteParseFileEx(FileData, 0);
+}
+
+// Releases everything AsepriteParseFile allocated, and clears the struct.
+// Cel buffers are released rather than freed, so any that were retained with
+// AsepriteRetainCelData stay alive.
+
+void
+AsepriteFreeFile(aseprite_file *File)
+{
+	if (File->Block)
+	{
+		AsepriteReleaseCelBuffer((aseprite_cel_buffer *)File->Block);
+		memset(File, 0, sizeof(aseprite_file));
+		return;
+	}
+
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameIndex;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			AsepriteReleaseCelData(Frame->Layers[LayerIndex].Data);
+			free(Frame->Layers[LayerIndex].CompressedData);
+		}
+		free(Frame->Layers);
+	}
+	free(File->Frames);
+	free(File->Palette.Colors);
+	for (int LayerIndex = 0; LayerIndex < File->NumLayers; LayerIndex++)
+		free(File->LayerInfo[LayerIndex].Name);
+	free(File->LayerInfo);
+	for (int SliceIndex = 0; SliceIndex < File->NumSlices; SliceIndex++)
+		free(File->Slices[SliceIndex].Name);
+	free(File->Slices);
+	free(File->SliceKeys);
+	for (int TagIndex = 0; TagIndex < File->NumTags; TagIndex++)
+		free(File->Tags[TagIndex].Name);
+	free(File->Tags);
+	for (int TilesetIndex = 0; TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		free(File->Tilesets[TilesetIndex].Name);
+		free(File->Tilesets[TilesetIndex].Pixels);
+	}
+	free(File->Tilesets);
+	free(File->Strings.Data);
+	free(File->Strings.Slots);
+	memset(File, 0, sizeof(aseprite_file));
+}
+
+// Packs a parsed file into one allocation: the frames, then each frame's
+// layers followed by their cel pixels, then the layer info, palette, slices,
+// tags, tilesets and strings.  Every piece starts on a 64 byte boundary.
+// Cels that share a buffer still share it afterwards, and cel references
+// handed out after compacting keep the whole block alive.  The layout is
+// measured with a first pass that copies nothing (Block is 0).
+
+#define ASEPRITE_COMPACT_ALIGN 64
+
+struct aseprite_compactor
+{
+	uint8_t *Block;
+	size_t Used;
+	//Old cel buffer to new, so shared cels are only copied once
+	void **CelsFrom;
+	void **CelsTo;
+	int CelSlots;
+};
+
+inline size_t
+AsepriteCompactAlign(size_t Offset)
+{
+	return (Offset + ASEPRITE_COMPACT_ALIGN - 1) & ~(size_t)(ASEPRITE_COMPACT_ALIGN - 1);
+}
+
+void *
+AsepriteCompactPush(aseprite_compactor *Compactor, const void *Source, size_t Size)
+{
+	size_t At = AsepriteCompactAlign(Compactor->Used);
+	Compactor->Used = At + Size;
+	if (!Compactor->Block || !Source)
+		return 0;
+	memcpy(Compactor->Block + At, Source, Size);
+	return Compactor->Block + At;
+}
+
+char *
+AsepriteCompactString(aseprite_compactor *Compactor, const char *String)
+{
+	return String ? (char *)AsepriteCompactPush(Compactor, String, strlen(String) + 1) : 0;
+}
+
+void *
+AsepriteCompactCel(aseprite_compactor *Compactor, void *Data)
+{
+	if (!Data)
+		return 0;
+
+	int SlotIndex = (int)(((uintptr_t)Data >> 4) & (Compactor->CelSlots - 1));
+	while (Compactor->CelsFrom[SlotIndex])
+	{
+		if (Compactor->CelsFrom[SlotIndex] == Data)
+			return Compactor->CelsTo[SlotIndex];
+		SlotIndex = (SlotIndex + 1) & (Compactor->CelSlots - 1);
+	}
+
+	size_t Size = AsepriteGetCelDataSize(Data);
+	size_t At = AsepriteCompactAlign(Compactor->Used + ASEPRITE_CEL_BUFFER_HEADER_SIZE);
+	Compactor->Used = At + Size;
+	void *Result = 0;
+	if (Compactor->Block)
+	{
+		aseprite_cel_buffer *Buffer = (aseprite_cel_buffer *)(Compactor->Block + At - ASEPRITE_CEL_BUFFER_HEADER_SIZE);
+		Buffer->RefCount = 0;
+		Buffer->Flags = 0;
+		Buffer->Size = Size;
+		Buffer->Owner = (aseprite_cel_buffer *)Compactor->Block;
+		Buffer->Allocation = 0;
+		Result = Compactor->Block + At;
+		memcpy(Result, Data, Size);
+	}
+	Compactor->CelsFrom[SlotIndex] = Data;
+	Compactor->CelsTo[SlotIndex] = Result;
+	return Result;
+}
+
+// Lays out (and when Compactor->Block is set, copies) the file.  Out is only
+// written in the copying pass.
+
+void
+AsepriteCompactLayout(aseprite_compactor *Compactor, aseprite_file *File, aseprite_file *Out)
+{
+	bool Copy = (Compactor->Block != 0);
+	*Out = *File;
+	Out->Block = Compactor->Block;
+
+	//The block starts with the header that holds its reference count
+	AsepriteCompactPush(Compactor, 0, ASEPRITE_CEL_BUFFER_HEADER_SIZE);
+
+	Out->Frames = (aseprite_frame *)AsepriteCompactPush(Compactor, File->Frames, sizeof(aseprite_frame)*File->NumFrames);
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameIndex;
+		aseprite_layer *Layers = (aseprite_layer *)AsepriteCompactPush(Compactor, Frame->Layers, sizeof(aseprite_layer)*Frame->NumLayers);
+		if (Copy)
+			Out->Frames[FrameIndex].Layers = Layers;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			aseprite_layer *Layer = Frame->Layers + LayerIndex;
+			void *Data = AsepriteCompactCel(Compactor, Layer->Data);
+			void *CompressedData = AsepriteCompactPush(Compactor, Layer->CompressedData, Layer->CompressedSize);
+			if (Copy)
+			{
+				Layers[LayerIndex].Data = Data;
+				Layers[LayerIndex].CompressedData = CompressedData;
+			}
+		}
+	}
+
+	Out->LayerInfo = (aseprite_layer_info *)AsepriteCompactPush(Compactor, File->LayerInfo, sizeof(aseprite_layer_info)*File->NumLayers);
+	for (int LayerIndex = 0; LayerIndex < File->NumLayers; LayerIndex++)
+	{
+		char *Name = AsepriteCompactString(Compactor, File->LayerInfo[LayerIndex].Name);
+		if (Copy)
+			Out->LayerInfo[LayerIndex].Name = Name;
+	}
+
+	Out->Palette.Colors = (aseprite_color *)AsepriteCompactPush(Compactor, File->Palette.Colors, sizeof(aseprite_color)*File->Palette.NumColors);
+
+	Out->Slices = (aseprite_slice *)AsepriteCompactPush(Compactor, File->Slices, sizeof(aseprite_slice)*File->NumSlices);
+	for (int SliceIndex = 0; SliceIndex < File->NumSlices; SliceIndex++)
+	{
+		char *Name = AsepriteCompactString(Compactor, File->Slices[SliceIndex].Name);
+		if (Copy)
+			Out->Slices[SliceIndex].Name = Name;
+	}
+	Out->SliceKeys = (aseprite_slice_key *)AsepriteCompactPush(Compactor, File->SliceKeys, sizeof(aseprite_slice_key)*File->NumSliceKeys);
+
+	Out->Tags = (aseprite_tag *)AsepriteCompactPush(Compactor, File->Tags, sizeof(aseprite_tag)*File->NumTags);
+	for (int TagIndex = 0; TagIndex < File->NumTags; TagIndex++)
+	{
+		char *Name = AsepriteCompactString(Compactor, File->Tags[TagIndex].Name);
+		if (Copy)
+			Out->Tags[TagIndex].Name = Name;
+	}
+
+	Out->Tilesets = (aseprite_tileset *)AsepriteCompactPush(Compactor, File->Tilesets, sizeof(aseprite_tileset)*File->NumTilesets);
+	for (int TilesetIndex = 0; TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		aseprite_tileset *Tileset = File->Tilesets + TilesetIndex;
+		char *Name = AsepriteCompactString(Compactor, Tileset->Name);
+		size_t PixelsSize = Tileset->Pixels ? (size_t)Tileset->TileWidth*Tileset->TileHeight*Tileset->NumTiles*AsepriteBytesPerPixel(File->Header.ColorDepth) : 0;
+		void *Pixels = AsepriteCompactPush(Compactor, Tileset->Pixels, PixelsSize);
+		if (Copy)
+		{
+			Out->Tilesets[TilesetIndex].Name = Name;
+			Out->Tilesets[TilesetIndex].Pixels = Pixels;
+		}
+	}
+
+	//Only the strings are kept; the table used to intern them isn't needed any more
+	Out->Strings.Data = (char *)AsepriteCompactPush(Compactor, File->Strings.Data, File->Strings.Used);
+	Out->Strings.Size = File->Strings.Used;
+	Out->Strings.Slots = 0;
+	Out->Strings.NumSlots = 0;
+}
+
+// Repacks File in place so that it is one 64 byte aligned allocation, which
+// AsepriteFreeFile releases with a single free.  A compacted file is read only:
+// nothing can be added to it and its cels can't be replaced (so expand
+// tilemaps and inflate kept cels first).  Returns false, leaving the file as
+// it was, if the block can't be allocated.
+
+bool
+AsepriteCompact(aseprite_file *File)
+{
+	if (File->Block)
+		return true;
+
+	int NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+		NumCels += File->Frames[FrameIndex].NumLayers;
+	aseprite_compactor Compactor = {0};
+	Compactor.CelSlots = 16;
+	while (Compactor.CelSlots < NumCels*2)
+		Compactor.CelSlots *= 2;
+	Compactor.CelsFrom = (void **)calloc(Compactor.CelSlots*2, sizeof(void *));
+	if (!Compactor.CelsFrom)
+		return false;
+	Compactor.CelsTo = Compactor.CelsFrom + Compactor.CelSlots;
+
+	aseprite_file Compacted;
+	AsepriteCompactLayout(&Compactor, File, &Compacted);
+	size_t Size = Compactor.Used;
+
+	uint8_t *Allocation = (uint8_t *)malloc(Size + ASEPRITE_COMPACT_ALIGN - 1);
+	if (!Allocation)
+	{
+		free(Compactor.CelsFrom);
+		return false;
+	}
+	Compactor.Block = (uint8_t *)AsepriteCompactAlign((uintptr_t)Allocation);
+	Compactor.Used = 0;
+	memset(Compactor.CelsFrom, 0, sizeof(void *)*Compactor.CelSlots*2);
+	AsepriteCompactLayout(&Compactor, File, &Compacted);
+	free(Compactor.CelsFrom);
+
+	aseprite_cel_buffer *BlockHeader = (aseprite_cel_buffer *)Compactor.Block;
+	BlockHeader->RefCount = 1;
+	BlockHeader->Flags = 0;
+	BlockHeader->Size = Size;
+	BlockHeader->Owner = 0;
+	BlockHeader->Allocation = Allocation;
+	printf_d("Compacted into %lu bytes\n", (unsigned long)Size);
+
+	AsepriteFreeFile(File);
+	*File = Compacted;
+	return true;
+}
+
+// Cache format for parsed files.  AsepriteSerialize writes the same layout
+// AsepriteCompact builds, preceded by a small header, with every pointer
+// stored as an offset from the start of the data.  AsepriteDeserializeInPlace
+// turns the offsets back into pointers where the data sits (one pass over the
+// pointers, nothing is copied or inflated), so a cache file can be read or
+// mapped and used directly.  The data must stay writable and alive for as long
+// as the file is used, and should be 64 byte aligned (as mapped files are) for
+// the cels to keep their alignment.  The layout depends on the build (pointer
+// size and struct layouts), which the header records.
+
+#define ASEPRITE_SERIALIZED_VERSION 3
+
+struct aseprite_serialized_header
+{
+	char Magic[4];
+	uint32_t Version;
+	uint32_t Layout;
+	uint32_t Reserved;
+	uint64_t Size;
+	uint64_t FileOffset;
+	//Address the stored pointers are relative to, 0 when freshly written
+	uint64_t Base;
+};
+
+inline uint32_t
+AsepriteSerializedLayout()
+{
+	uint32_t Layout = (uint32_t)sizeof(void *);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_file);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_frame);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_layer);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_layer_info);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_slice);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_tag);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_tileset);
+	Layout = Layout*31 + (uint32_t)sizeof(aseprite_cel_buffer);
+	uint16_t Endian = 1;
+	return Layout*2 + *(uint8_t *)&Endian;
+}
+
+// Moves pointers between two bases.  A pointer is relative to From now and
+// will be relative to To, and the data itself is at Actual.
+
+struct aseprite_relocation
+{
+	uintptr_t From;
+	uintptr_t To;
+	uint8_t *Actual;
+	size_t Size;
+	bool Failed;
+};
+
+// Where a stored pointer's target really is (0 if the pointer is 0 or out of bounds)
+inline void *
+AsepriteRelocatedTarget(aseprite_relocation *Relocation, const void *Pointer)
+{
+	if (!Pointer)
+		return 0;
+	uintptr_t Offset = (uintptr_t)Pointer - Relocation->From;
+	if (Offset >= Relocation->Size)
+	{
+		Relocation->Failed = true;
+		return 0;
+	}
+	return Relocation->Actual + Offset;
+}
+
+// The stored pointer's new value
+inline void *
+AsepriteRelocated(aseprite_relocation *Relocation, const void *Pointer)
+{
+	if (!Pointer || Relocation->Failed)
+		return 0;
+	return (void *)(Relocation->To + ((uintptr_t)Pointer - Relocation->From));
+}
+
+// Where a stored table of Count elements really is, or 0 if it is 0 or doesn't
+// fit inside the data (which also fails the relocation).
+
+inline void *
+AsepriteRelocatedTable(aseprite_relocation *Relocation, const void *Pointer, int64_t Count, size_t ElementSize)
+{
+	uint8_t *Target = (uint8_t *)AsepriteRelocatedTarget(Relocation, Pointer);
+	if (Count < 0 || (Count && !Pointer))
+		Relocation->Failed = true;
+	if (!Target || Relocation->Failed)
+		return 0;
+	size_t Available = Relocation->Size - (size_t)(Target - Relocation->Actual);
+	if ((uint64_t)Count > Available / ElementSize)
+	{
+		Relocation->Failed = true;
+		return 0;
+	}
+	return Target;
+}
+
+inline void
+AsepriteValidateString(aseprite_relocation *Relocation, const char *Pointer)
+{
+	char *Target = (char *)AsepriteRelocatedTarget(Relocation, Pointer);
+	if (Target && !memchr(Target, 0, Relocation->Size - (size_t)((uint8_t *)Target - Relocation->Actual)))
+		Relocation->Failed = true;
+}
+
+inline void
+AsepriteValidateUserData(aseprite_relocation *Relocation, aseprite_file *File, aseprite_user_data *UserData)
+{
+	if (UserData->TextOffset >= File->Strings.Size || UserData->TextLength > File->Strings.Size - UserData->TextOffset)
+		Relocation->Failed = true;
+}
+
+// Checks a cel buffer: its header and its Size bytes must lie inside the data.
+// Returns the buffer's size, or 0 for no buffer or a bad one.
+
+inline size_t
+AsepriteValidateCelData(aseprite_relocation *Relocation, const void *Pointer)
+{
+	if (!Pointer)
+		return 0;
+	uintptr_t Offset = (uintptr_t)Pointer - Relocation->From;
+	if (Offset < ASEPRITE_CEL_BUFFER_HEADER_SIZE || Offset >= Relocation->Size)
+	{
+		Relocation->Failed = true;
+		return 0;
+	}
+	aseprite_cel_buffer *Buffer = AsepriteGetCelBuffer(Relocation->Actual + Offset);
+	if (Buffer->Size > Relocation->Size - Offset)
+	{
+		Relocation->Failed = true;
+		return 0;
+	}
+	return Buffer->Size;
+}
+
+// Damaged data can hold any byte where a bool is stored, which can't even be
+// loaded as a bool.
+
+inline bool
+AsepriteValidateBool(const bool *Value)
+{
+	uint8_t Byte;
+	memcpy(&Byte, Value, sizeof(Byte));
+	return Byte <= 1;
+}
+
+// Checks that every row of a run length cel has offsets and runs inside its
+// DataSize bytes, and runs that cover the row.
+
+bool
+AsepriteValidateCelRuns(const uint8_t *Data, size_t DataSize, int Width, int Height, int BytesPerPixel)
+{
+	size_t RunSize = ASEPRITE_RUN_HEADER_SIZE + BytesPerPixel;
+	if ((size_t)Height*sizeof(uint32_t) > DataSize)
+		return false;
+	for (int Y = 0; Y < Height; Y++)
+	{
+		uint32_t Offset;
+		memcpy(&Offset, Data + Y*sizeof(uint32_t), sizeof(Offset));
+		size_t At = Offset;
+		for (int Covered = 0; Covered < Width; At += RunSize)
+		{
+			if (At > DataSize || DataSize - At < RunSize)
+				return false;
+			uint16_t Length;
+			memcpy(&Length, Data + At, sizeof(Length));
+			if (Length == 0)
+				return false;
+			Covered += Length;
+		}
+	}
+	return true;
+}
+
+// Checks the tile size of a tiled cel and that every tile its entries point at
+// lies inside its DataSize bytes.
+
+bool
+AsepriteValidateCelTiles(const uint8_t *Data, size_t DataSize, int Width, int Height, int BytesPerPixel)
+{
+	if (DataSize < ASEPRITE_TILE_HEADER_SIZE)
+		return false;
+	uint32_t Shift;
+	memcpy(&Shift, Data, sizeof(Shift));
+	if (Shift < ASEPRITE_TILE_MIN_SHIFT || Shift > ASEPRITE_TILE_MAX_SHIFT)
+		return false;
+	int TilesX = AsepriteCountTiles(Width, Shift);
+	int TilesY = AsepriteCountTiles(Height, Shift);
+	if ((DataSize - ASEPRITE_TILE_HEADER_SIZE) / sizeof(uint32_t) < (size_t)TilesX*TilesY)
+		return false;
+	const uint8_t *Entries = Data + ASEPRITE_TILE_HEADER_SIZE;
+	for (int TileY = 0; TileY < TilesY; TileY++)
+	{
+		for (int TileX = 0; TileX < TilesX; TileX++, Entries += sizeof(uint32_t))
+		{
+			uint32_t Entry;
+			memcpy(&Entry, Entries, sizeof(Entry));
+			if (Entry == 0)
+				continue;
+			size_t Offset = Entry & ~ASEPRITE_TILE_UNIFORM;
+			size_t TileSize = (size_t)BytesPerPixel;
+			if (!(Entry & ASEPRITE_TILE_UNIFORM))
+				TileSize *= (size_t)AsepriteGetTileSpan(Width, Shift, TileX)*AsepriteGetTileSpan(Height, Shift, TileY);
+			if ((Offset & 3) || Offset > DataSize || DataSize - Offset < TileSize)
+				return false;
+		}
+	}
+	return true;
+}
+
+// Checks that every table, cel, string and count of a serialized file stays
+// inside the data, without changing anything.  Sets Relocation->Failed if not.
+
+void
+AsepriteValidateSerializedFile(aseprite_relocation *Relocation, aseprite_file *File)
+{
+	if (!AsepriteRelocatedTable(Relocation, File->Block, 1, sizeof(aseprite_cel_buffer)))
+		Relocation->Failed = true;
+	char *Strings = (char *)AsepriteRelocatedTable(Relocation, File->Strings.Data, File->Strings.Size, 1);
+	if (!Strings || File->Strings.Size == 0 || Strings[0] != 0 || Strings[File->Strings.Size - 1] != 0)
+	{
+		Relocation->Failed = true;
+		return;
+	}
+	AsepriteValidateUserData(Relocation, File, &File->UserData);
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	if (File->Header.ColorDepth != 8 && File->Header.ColorDepth != 16 && File->Header.ColorDepth != 32)
+	{
+		Relocation->Failed = true;
+		return;
+	}
+
+	aseprite_layer_info *LayerInfo = (aseprite_layer_info *)AsepriteRelocatedTable(Relocation, File->LayerInfo, File->NumLayers, sizeof(aseprite_layer_info));
+	for (int LayerIndex = 0; LayerInfo && LayerIndex < File->NumLayers; LayerIndex++)
+	{
+		AsepriteValidateString(Relocation, LayerInfo[LayerIndex].Name);
+		AsepriteValidateUserData(Relocation, File, &LayerInfo[LayerIndex].UserData);
+	}
+
+	AsepriteRelocatedTable(Relocation, File->Palette.Colors, File->Palette.NumColors, sizeof(aseprite_color));
+	AsepriteRelocatedTable(Relocation, File->SliceKeys, File->NumSliceKeys, sizeof(aseprite_slice_key));
+	aseprite_slice *Slices = (aseprite_slice *)AsepriteRelocatedTable(Relocation, File->Slices, File->NumSlices, sizeof(aseprite_slice));
+	for (int SliceIndex = 0; Slices && SliceIndex < File->NumSlices; SliceIndex++)
+	{
+		aseprite_slice *Slice = Slices + SliceIndex;
+		AsepriteValidateString(Relocation, Slice->Name);
+		AsepriteValidateUserData(Relocation, File, &Slice->UserData);
+		if (Slice->FirstKey < 0 || Slice->NumKeys < 0 || Slice->NumKeys > File->NumSliceKeys - Slice->FirstKey)
+			Relocation->Failed = true;
+	}
+
+	aseprite_tag *Tags = (aseprite_tag *)AsepriteRelocatedTable(Relocation, File->Tags, File->NumTags, sizeof(aseprite_tag));
+	for (int TagIndex = 0; Tags && TagIndex < File->NumTags; TagIndex++)
+	{
+		AsepriteValidateString(Relocation, Tags[TagIndex].Name);
+		AsepriteValidateUserData(Relocation, File, &Tags[TagIndex].UserData);
+	}
+
+	aseprite_tileset *Tilesets = (aseprite_tileset *)AsepriteRelocatedTable(Relocation, File->Tilesets, File->NumTilesets, sizeof(aseprite_tileset));
+	for (int TilesetIndex = 0; Tilesets && TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		aseprite_tileset *Tileset = Tilesets + TilesetIndex;
+		AsepriteValidateString(Relocation, Tileset->Name);
+		if (Tileset->NumTiles < 0 || Tileset->TileWidth < 0 || Tileset->TileHeight < 0 || Tileset->TileWidth > 0xFFFF || Tileset->TileHeight > 0xFFFF)
+			Relocation->Failed = true;
+		else
+			AsepriteRelocatedTable(Relocation, Tileset->Pixels, (int64_t)Tileset->NumTiles*Tileset->TileWidth*Tileset->TileHeight, BytesPerPixel);
+	}
+
+	//Cels last, since tilemap cels are measured in the tiles of their tileset
+	aseprite_frame *Frames = (aseprite_frame *)AsepriteRelocatedTable(Relocation, File->Frames, File->NumFrames, sizeof(aseprite_frame));
+	for (int FrameIndex = 0; Frames && FrameIndex < File->NumFrames && !Relocation->Failed; FrameIndex++)
+	{
+		aseprite_frame *Frame = Frames + FrameIndex;
+		aseprite_layer *Layers = (aseprite_layer *)AsepriteRelocatedTable(Relocation, Frame->Layers, Frame->NumLayers, sizeof(aseprite_layer));
+		for (int LayerIndex = 0; Layers && LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			aseprite_layer *Layer = Layers + LayerIndex;
+			size_t DataSize = AsepriteValidateCelData(Relocation, Layer->Data);
+			AsepriteRelocatedTable(Relocation, Layer->CompressedData, Layer->CompressedSize, 1);
+			AsepriteValidateUserData(Relocation, File, &Layer->UserData);
+			if (!AsepriteValidateBool(&Layer->IsRunLength) || !AsepriteValidateBool(&Layer->IsTiled) ||
+				!AsepriteValidateBool(&Layer->Stats.IsEmpty) || !AsepriteValidateBool(&Layer->Stats.IsOpaque) ||
+				Layer->DataWidth < 0 || Layer->DataHeight < 0)
+			{
+				Relocation->Failed = true;
+				continue;
+			}
+			if (!Layer->Data && !Layer->CompressedData)
+				continue;
+			if (Layer->Header.LayerIndex >= File->NumLayers)
+			{
+				Relocation->Failed = true;
+				continue;
+			}
+
+			//The cel's bounds are read as is, so they must stay inside it
+			int64_t ExtentX = Layer->DataWidth, ExtentY = Layer->DataHeight;
+			bool IsTilemap = (Layer->Header.CelType == AsepriteCelType_CompressedTilemap);
+			if (IsTilemap)
+			{
+				int64_t TilesX = ExtentX, TilesY = ExtentY;
+				ExtentX = ExtentY = 0;
+				for (int TilesetIndex = 0; Tilesets && TilesetIndex < File->NumTilesets; TilesetIndex++)
+				{
+					if (Tilesets[TilesetIndex].ID == LayerInfo[Layer->Header.LayerIndex].TilesetIndex)
+					{
+						ExtentX = TilesX*Tilesets[TilesetIndex].TileWidth;
+						ExtentY = TilesY*Tilesets[TilesetIndex].TileHeight;
+						break;
+					}
+				}
+			}
+			aseprite_cel_stats *Stats = &Layer->Stats;
+			if (!Stats->IsEmpty && (Stats->MinX < 0 || Stats->MinY < 0 || Stats->MinX > Stats->MaxX || Stats->MinY > Stats->MaxY ||
+									Stats->MaxX > ExtentX || Stats->MaxY > ExtentY))
+				Relocation->Failed = true;
+
+			if (Layer->IsRunLength || Layer->IsTiled)
+			{
+				//Runs and tiles are found through their own offsets
+				const uint8_t *Data = (const uint8_t *)AsepriteRelocatedTable(Relocation, Layer->Data, DataSize, 1);
+				bool Valid = Data && (Layer->IsRunLength ?
+									  AsepriteValidateCelRuns(Data, DataSize, Layer->DataWidth, Layer->DataHeight, BytesPerPixel) :
+									  AsepriteValidateCelTiles(Data, DataSize, Layer->DataWidth, Layer->DataHeight, BytesPerPixel));
+				if (!Valid)
+					Relocation->Failed = true;
+			}
+			//Pixel and tilemap cels are read by position, so they must be whole
+			else if (Layer->Data)
+			{
+				int ElementSize = IsTilemap ? (int)sizeof(uint32_t) : BytesPerPixel;
+				if ((uint64_t)Layer->DataWidth*Layer->DataHeight*ElementSize > DataSize)
+					Relocation->Failed = true;
+			}
+		}
+	}
+}
+
+// Rewrites every pointer in a serialized file (the struct itself is at File).
+// Deserializing validates the file first, so this never stops half way there.
+
+void
+AsepriteRelocateFile(aseprite_relocation *Relocation, aseprite_file *File)
+{
+	aseprite_cel_buffer *Block = (aseprite_cel_buffer *)AsepriteRelocatedTarget(Relocation, File->Block);
+	void *NewBlock = AsepriteRelocated(Relocation, File->Block);
+	if (!Block)
+	{
+		Relocation->Failed = true;
+		return;
+	}
+
+	aseprite_frame *Frames = (aseprite_frame *)AsepriteRelocatedTarget(Relocation, File->Frames);
+	for (int FrameIndex = 0; Frames && FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = Frames + FrameIndex;
+		aseprite_layer *Layers = (aseprite_layer *)AsepriteRelocatedTarget(Relocation, Frame->Layers);
+		for (int LayerIndex = 0; Layers && LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			aseprite_layer *Layer = Layers + LayerIndex;
+			uint8_t *Data = (uint8_t *)AsepriteRelocatedTarget(Relocation, Layer->Data);
+			if (Data)
+			{
+				//Shared cels come through here more than once, so this is set rather than moved
+				aseprite_cel_buffer *Buffer = AsepriteGetCelBuffer(Data);
+				Buffer->Owner = (aseprite_cel_buffer *)NewBlock;
+			}
+			Layer->Data = AsepriteRelocated(Relocation, Layer->Data);
+			Layer->CompressedData = AsepriteRelocated(Relocation, Layer->CompressedData);
+		}
+		Frame->Layers = (aseprite_layer *)AsepriteRelocated(Relocation, Frame->Layers);
+	}
+
+	aseprite_layer_info *LayerInfo = (aseprite_layer_info *)AsepriteRelocatedTarget(Relocation, File->LayerInfo);
+	for (int LayerIndex = 0; LayerInfo && LayerIndex < File->NumLayers; LayerIndex++)
+		LayerInfo[LayerIndex].Name = (char *)AsepriteRelocated(Relocation, LayerInfo[LayerIndex].Name);
+
+	aseprite_slice *Slices = (aseprite_slice *)AsepriteRelocatedTarget(Relocation, File->Slices);
+	for (int SliceIndex = 0; Slices && SliceIndex < File->NumSlices; SliceIndex++)
+		Slices[SliceIndex].Name = (char *)AsepriteRelocated(Relocation, Slices[SliceIndex].Name);
+
+	aseprite_tag *Tags = (aseprite_tag *)AsepriteRelocatedTarget(Relocation, File->Tags);
+	for (int TagIndex = 0; Tags && TagIndex < File->NumTags; TagIndex++)
+		Tags[TagIndex].Name = (char *)AsepriteRelocated(Relocation, Tags[TagIndex].Name);
+
+	aseprite_tileset *Tilesets = (aseprite_tileset *)AsepriteRelocatedTarget(Relocation, File->Tilesets);
+	for (int TilesetIndex = 0; Tilesets && TilesetIndex < File->NumTilesets; TilesetIndex++)
+	{
+		Tilesets[TilesetIndex].Name = (char *)AsepriteRelocated(Relocation, Tilesets[TilesetIndex].Name);
+		Tilesets[TilesetIndex].Pixels = AsepriteRelocated(Relocation, Tilesets[TilesetIndex].Pixels);
+	}
+
+	File->Frames = (aseprite_frame *)AsepriteRelocated(Relocation, File->Frames);
+	File->LayerInfo = (aseprite_layer_info *)AsepriteRelocated(Relocation, File->LayerInfo);
+	File->Palette.Colors = (aseprite_color *)AsepriteRelocated(Relocation, File->Palette.Colors);
+	File->Slices = (aseprite_slice *)AsepriteRelocated(Relocation, File->Slices);
+	File->SliceKeys = (aseprite_slice_key *)AsepriteRelocated(Relocation, File->SliceKeys);
+	File->Tags = (aseprite_tag *)AsepriteRelocated(Relocation, File->Tags);
+	File->Tilesets = (aseprite_tileset *)AsepriteRelocated(Relocation, File->Tilesets);
+	File->Strings.Data = (char *)AsepriteRelocated(Relocation, File->Strings.Data);
+	File->Block = NewBlock;
+}
+
+// Writes File to Dest if DestSize is big enough, and returns the size needed
+// either way (0 on failure).  Call it with a DestSize of 0 to measure.
+
+size_t
+AsepriteSerialize(aseprite_file *File, void *Dest, size_t DestSize)
+{
+	int NumCels = 0;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+		NumCels += File->Frames[FrameIndex].NumLayers;
+	aseprite_compactor Compactor = {0};
+	Compactor.CelSlots = 16;
+	while (Compactor.CelSlots < NumCels*2)
+		Compactor.CelSlots *= 2;
+	Compactor.CelsFrom = (void **)calloc(Compactor.CelSlots*2, sizeof(void *));
+	if (!Compactor.CelsFrom)
+		return 0;
+	Compactor.CelsTo = Compactor.CelsFrom + Compactor.CelSlots;
+
+	//The header, then the compacted file, then the aseprite_file struct
+	size_t BlockOffset = AsepriteCompactAlign(sizeof(aseprite_serialized_header));
+	aseprite_file Serialized;
+	AsepriteCompactLayout(&Compactor, File, &Serialized);
+	size_t FileOffset = BlockOffset + AsepriteCompactAlign(Compactor.Used);
+	size_t Size = FileOffset + sizeof(aseprite_file);
+	if (!Dest || DestSize < Size)
+	{
+		free(Compactor.CelsFrom);
+		return Size;
+	}
+
+	uint8_t *Data = (uint8_t *)Dest;
+	memset(Data, 0, Size);
+	Compactor.Block = Data + BlockOffset;
+	Compactor.Used = 0;
+	memset(Compactor.CelsFrom, 0, sizeof(void *)*Compactor.CelSlots*2);
+	AsepriteCompactLayout(&Compactor, File, &Serialized);
+	free(Compactor.CelsFrom);
+
+	//The block isn't owned by anyone, so it is never freed
+	aseprite_cel_buffer *BlockHeader = (aseprite_cel_buffer *)Compactor.Block;
+	BlockHeader->RefCount = 1;
+	BlockHeader->Size = Compactor.Used;
+
+	aseprite_relocation Relocation = {(uintptr_t)Data, 0, Data, Size, false};
+	AsepriteRelocateFile(&Relocation, &Serialized);
+	if (Relocation.Failed)
+		return 0;
+	memcpy(Data + FileOffset, &Serialized, sizeof(aseprite_file));
+
+	aseprite_serialized_header *Header = (aseprite_serialized_header *)Data;
+	memcpy(Header->Magic, "ASEC", 4);
+	Header->Version = ASEPRITE_SERIALIZED_VERSION;
+	Header->Layout = AsepriteSerializedLayout();
+	Header->Size = Size;
+	Header->FileOffset = FileOffset;
+	Header->Base = 0;
+	return Size;
+}
+
+// Makes serialized data usable where it is.  Returns 0 if the data is not a
+// serialized file from a build with the same layout, or is damaged; every
+// count, pointer, cel bound, run and tile is checked before anything is
+// rewritten, so the data is left as it was in that case.  The result points
+// into Data; don't call AsepriteFreeFile on it, just release
+// Data when done (after any cel references taken from it).  Calling this
+// again on the same data is cheap, and data that moved since is fixed up again.
+
+aseprite_file *
+AsepriteDeserializeInPlace(void *Data, size_t Size)
+{
+	aseprite_serialized_header *Header = (aseprite_serialized_header *)Data;
+	if (Size < sizeof(aseprite_serialized_header) || memcmp(Header->Magic, "ASEC", 4) != 0 ||
+		Header->Version != ASEPRITE_SERIALIZED_VERSION || Header->Layout != AsepriteSerializedLayout() ||
+		Header->Size > Size || Header->FileOffset + sizeof(aseprite_file) > Header->Size)
+	{
+		return 0;
+	}
+
+	aseprite_file *File = (aseprite_file *)((uint8_t *)Data + Header->FileOffset);
+	if (Header->Base == (uintptr_t)Data)
+		return File;
+
+	aseprite_relocation Relocation = {(uintptr_t)Header->Base, (uintptr_t)Data, (uint8_t *)Data, (size_t)Header->Size, false};
+	AsepriteValidateSerializedFile(&Relocation, File);
+	if (Relocation.Failed)
+		return 0;
+	AsepriteRelocateFile(&Relocation, File);
+	if (Relocation.Failed)
+		return 0;
+	Header->Base = (uintptr_t)Data;
+	return File;
+}
+
+// Owning handle for C++ callers.  It can be moved but not copied (copying an
+// aseprite_file would alias its buffers), and it frees the file when it goes
+// out of scope.  Anything that wants to outlive it, or share pixels with it,
+// retains the cel data instead of copying it:
+//
+//   AsepriteFile Sprite(FileData);
+//   void *Pixels = Sprite.RetainCelData(FrameIndex, LayerIndex);
+//   ...
+//   AsepriteReleaseCelData(Pixels);
+//
+// The plain aseprite_file functions all work on Sprite.Get().
+
+class AsepriteFile
+{
+public:
+	AsepriteFile()
+	{
+		memset(&File, 0, sizeof(File));
+	}
+
+	explicit AsepriteFile(void *FileData, aseprite_parse_options *Options = 0)
+	{
+		File = AsepriteParseFileEx(FileData, Options);
+	}
+
+	//Takes ownership of a file parsed with the C functions
+	explicit AsepriteFile(aseprite_file *Parsed)
+	{
+		File = *Parsed;
+		memset(Parsed, 0, sizeof(aseprite_file));
+	}
+
+	AsepriteFile(AsepriteFile &&Other)
+	{
+		File = Other.File;
+		memset(&Other.File, 0, sizeof(aseprite_file));
+	}
+
+	AsepriteFile &operator=(AsepriteFile &&Other)
+	{
+		if (this != &Other)
+		{
+			AsepriteFreeFile(&File);
+			File = Other.File;
+			memset(&Other.File, 0, sizeof(aseprite_file));
+		}
+		return *this;
+	}
+
+	~AsepriteFile()
+	{
+		AsepriteFreeFile(&File);
+	}
+
+	AsepriteFile(const AsepriteFile &) = delete;
+	AsepriteFile &operator=(const AsepriteFile &) = delete;
+
+	aseprite_file *Get() { return &File; }
+	const aseprite_file *Get() const { return &File; }
+	aseprite_file *operator->() { return &File; }
+	const aseprite_file *operator->() const { return &File; }
+
+	//Hands the file back to the C functions; free it with AsepriteFreeFile
+	aseprite_file Release()
+	{
+		aseprite_file Result = File;
+		memset(&File, 0, sizeof(aseprite_file));
+		return Result;
+	}
+
+	//Shared reference to a cel's pixels (0 if the cel has none, runs or tiles
+	//if it is IsRunLength or IsTiled), release it with AsepriteReleaseCelData
+	void *RetainCelData(int FrameIndex, int LayerIndex) const
+	{
+		if (FrameIndex < 0 || FrameIndex >= File.NumFrames)
+			return 0;
+		aseprite_frame *Frame = File.Frames + FrameIndex;
+		if (LayerIndex < 0 || LayerIndex >= Frame->NumLayers)
+			return 0;
+		return AsepriteRetainCelData(Frame->Layers[LayerIndex].Data);
+	}
+
+private:
+	aseprite_file File;
+};
+
+inline const char *
+AsepriteGetString(aseprite_file *File, uint32_t Offset)
+{
+	//The pool is only missing if memory ran out before the first string
+	return File->Strings.Data ? File->Strings.Data + Offset : "";
+}
+
+// Returns the user data text, or an empty string when there is none.  The
+// text belongs to the file and may contain anything the artist typed.
+
+inline const char *
+AsepriteGetUserDataText(aseprite_file *File, aseprite_user_data *UserData)
+{
+	return AsepriteGetString(File, UserData->TextOffset);
+}
+
+// Returns the index of the layer with the given name, or -1.
+
+int
+AsepriteFindLayer(aseprite_file *File, const char *Name)
+{
+	for (int LayerIndex = 0; LayerIndex < File->NumLayers; LayerIndex++)
+	{
+		if (File->LayerInfo[LayerIndex].Name && strcmp(File->LayerInfo[LayerIndex].Name, Name) == 0)
+			return LayerIndex;
+	}
+	return -1;
+}
+
+// Returns the index of the slice with the given name, or -1.
+
+int
+AsepriteFindSlice(aseprite_file *File, const char *Name)
+{
+	for (int SliceIndex = 0; SliceIndex < File->NumSlices; SliceIndex++)
+	{
+		if (strcmp(File->Slices[SliceIndex].Name, Name) == 0)
+			return SliceIndex;
+	}
+	return -1;
+}
+
+// Returns the key that is active for a slice on the given frame (the last key
+// at or before it), or 0 if the slice has no key yet or is hidden (zero size)
+// on that frame.  Binary searches the slice's keys.
+
+aseprite_slice_key *
+AsepriteGetSliceKey(aseprite_file *File, int SliceIndex, int FrameNumber)
+{
+	Assert(SliceIndex < File->NumSlices);
+	aseprite_slice *Slice = File->Slices + SliceIndex;
+	aseprite_slice_key *Keys = File->SliceKeys + Slice->FirstKey;
+
+	int Low = 0;
+	int High = Slice->NumKeys;
+	while (Low < High)
+	{
+		int Middle = (Low + High) / 2;
+		if (Keys[Middle].FrameNumber <= FrameNumber)
+			Low = Middle + 1;
+		else
+			High = Middle;
+	}
+
+	aseprite_slice_key *Result = 0;
+	if (Low > 0 && Keys[Low - 1].Width != 0 && Keys[Low - 1].Height != 0)
+		Result = &Keys[Low - 1];
+	return Result;
+}
+
+inline float
+AsepriteMin(float A, float B)
+{
+	float Result = A;
+	if (B < A)
+		Result = B;
+	return Result;
+}
+
+inline float
+AsepriteAbs(float A)
+{
+	float Result = A;
+	if (A < 0)
+		Result = -A;
+	return Result;
+}
+
+inline aseprite_color
+AsepriteCombineColors(aseprite_color *Src, aseprite_color *Dest, aseprite_blend_mode BlendMode)
+{
+	aseprite_color Result;
+
+	float OutAlpha = Src->A + Dest->A*(1 - Src->A);
+	if (OutAlpha == 0)
+	{
+		Result = AsepriteColorFromRGBA(0,0,0,0);
+	} 
+	else
+	{
+		float OutRed, OutGreen, OutBlue;
+		switch (BlendMode)
+		{
+			case AsepriteBlendMode_Multiply:
+			{
+				OutRed = Src->R*Dest->R;
+				OutGreen = Src->G*Dest->G;
+				OutBlue = Src->B*Dest->B;
+			} break;
+			case AsepriteBlendMode_Screen:
+			{
+				OutRed = 1 - (1 - Src->R)*(1 - Dest->R);
+				OutGreen = 1 - (1 - Src->G)*(1 - Dest->G);
+				OutBlue = 1 - (1 - Src->B)*(1 - Dest->B);
+			} break;
+			case AsepriteBlendMode_Overlay:
+			{
+				OutRed = (Dest->R < 0.5f) ? (2*Src->R*Dest->R) : (1 - 2*(1 - Src->R)*(1 - Dest->R));
+				OutGreen = (Dest->G < 0.5f) ? (2*Src->G*Dest->G) : (1 - 2*(1 - Src->G)*(1 - Dest->G));
+				OutBlue = (Dest->B < 0.5f) ? (2*Src->B*Dest->B) : (1 - 2*(1 - Src->B)*(1 - Dest->B));
+			} break;
+			case AsepriteBlendMode_Darken:
+			{
+				OutRed = (Dest->R < Src->R) ? (Dest->R) : (Src->R);
+				OutGreen = (Dest->G < Src->G) ? (Dest->G) : (Src->G);
+				OutBlue = (Dest->B < Src->B) ? (Dest->B) : (Src->B);
+			} break;
+			case AsepriteBlendMode_Lighten:
+			{
+				OutRed = (Dest->R > Src->R) ? (Dest->R) : (Src->R);
+				OutGreen = (Dest->G > Src->G) ? (Dest->G) : (Src->G);
+				OutBlue = (Dest->B > Src->B) ? (Dest->B) : (Src->B);
+			} break;
+			case AsepriteBlendMode_ColorDodge:
+			{
+				OutRed = (Src->R == 1) ? (1) : (Dest->R / (1 - Src->R));
+				OutRed = AsepriteMin(OutRed, 1);
+				OutGreen = (Src->G == 1) ? (1) : (Dest->G / (1 - Src->G));
+				OutGreen = AsepriteMin(OutGreen, 1);
+				OutBlue = (Src->B == 1) ? (1) : (Dest->B / (1 - Src->B));
+				OutBlue = AsepriteMin(OutBlue, 1);
+			} break;
+			case AsepriteBlendMode_ColorBurn:
+			{
+				OutRed = (Src->R == 0) ? 0 : (1 - AsepriteMin((1 - Dest->R)/(Src->R), 1));
+				OutGreen = (Src->G == 0) ? 0 : (1 - AsepriteMin((1 - Dest->G)/(Src->G), 1));
+				OutBlue = (Src->B == 0) ? 0 : (1 - AsepriteMin((1 - Dest->B)/(Src->B), 1));
+			} break;
+			case AsepriteBlendMode_HardLight:
+			{
+				OutRed = (Src->R < 0.5f) ? (2*Src->R*Dest->R) : (1 - 2*(1 - Src->R)*(1 - Dest->R));
+				OutGreen = (Src->G < 0.5f) ? (2*Src->G*Dest->G) : (1 - 2*(1 - Src->G)*(1 - Dest->G));
+				OutBlue = (Src->B < 0.5f) ? (2*Src->B*Dest->B) : (1 - 2*(1 - Src->B)*(1 - Dest->B));
+			} break;
+			case AsepriteBlendMode_SoftLight:
+			{
+				OutRed = (1 - 2*Src->R)*Dest->R*Dest->R + 2*Dest->R*Src->R;
+				OutGreen = (1 - 2*Src->G)*Dest->G*Dest->G + 2*Dest->G*Src->G;
+				OutBlue = (1 - 2*Src->B)*Dest->B*Dest->B + 2*Dest->B*Src->B;
+			} break;
+			case AsepriteBlendMode_Difference:
+			{
+				OutRed = AsepriteAbs(Dest->R - Src->R);
+				OutGreen = AsepriteAbs(Dest->G - Src->G);
+				OutBlue = AsepriteAbs(Dest->B - Src->B);
+			} break;
+			case AsepriteBlendMode_Exclusion:
+			{
+				OutRed = 0.5f - 2*(Dest->R - 0.5f)*(Src->R - 0.5f);
+				OutGreen = 0.5f - 2*(Dest->G - 0.5f)*(Src->G - 0.5f);
+				OutBlue = 0.5f - 2*(Dest->B - 0.5f)*(Src->B - 0.5f);
+			} break;
+			default:
+			{
+				//Defaults to normal blend mode
+				OutRed = Src->R;
+				OutGreen = Src->G;
+				OutBlue = Src->B;
+			} break;
+		}
+		//Alpha compositing
+		float OneOverOutAlpha = 1.0f / OutAlpha;
+		OutRed = (OutRed*Src->A + Dest->R*Dest->A*(1-Src->A)) * OneOverOutAlpha;
+		OutGreen = (OutGreen*Src->A + Dest->G*Dest->A*(1-Src->A)) * OneOverOutAlpha;
+		OutBlue = (OutBlue*Src->A + Dest->B*Dest->A*(1-Src->A)) * OneOverOutAlpha;
+		Result = AsepriteColorFromRGBA(OutRed, OutGreen, OutBlue, OutAlpha);
+	}
+
+	return Result;
+}
+
+// Lookup tables for linear-light compositing: 8-bit sRGB to linear float, and
+// linear (quantized to 12 bits) back to 8-bit sRGB.  Built on first use by
+// whichever thread gets there first; any others wait for it to finish.
+
+static float AsepriteSRGBToLinearTable[256];
+static uint8_t AsepriteLinearToSRGBTable[4096];
+enum aseprite_color_tables_state
+{
+	AsepriteColorTables_Missing,
+	AsepriteColorTables_Building,
+	AsepriteColorTables_Ready,
+};
+static volatile int32_t AsepriteColorTablesState;
+
+void
+AsepriteInitColorTables()
+{
+	if (AsepriteAtomicLoad(&AsepriteColorTablesState) == AsepriteColorTables_Ready)
+		return;
+	if (AsepriteAtomicCompareExchange(&AsepriteColorTablesState, AsepriteColorTables_Missing, AsepriteColorTables_Building) != AsepriteColorTables_Missing)
+	{
+		//The tables take microseconds to build
+		while (AsepriteAtomicLoad(&AsepriteColorTablesState) != AsepriteColorTables_Ready)
+			;
+		return;
+	}
+
+	for (int Index = 0; Index < 256; Index++)
+	{
+		float Value = Index / 255.0f;
+		if (Value <= 0.04045f)
+			Value = Value / 12.92f;
+		else
+			Value = powf((Value + 0.055f) / 1.055f, 2.4f);
+		AsepriteSRGBToLinearTable[Index] = Value;
+	}
+	for (int Index = 0; Index < 4096; Index++)
+	{
+		float Value = Index / 4095.0f;
+		if (Value <= 0.0031308f)
+			Value = Value*12.92f;
+		else
+			Value = 1.055f*powf(Value, 1.0f / 2.4f) - 0.055f;
+		AsepriteLinearToSRGBTable[Index] = (uint8_t)(Value*255.0f + 0.5f);
+	}
+	AsepriteAtomicStore(&AsepriteColorTablesState, AsepriteColorTables_Ready);
+}
+
+inline uint8_t
+AsepriteLinearToSRGB8(float Value)
+{
+	int Index = (int)(Value*4095.0f + 0.5f);
+	if (Index < 0)
+		Index = 0;
+	if (Index > 4095)
+		Index = 4095;
+	return AsepriteLinearToSRGBTable[Index];
+}
+
+inline void
+AsepriteColorToLinear(aseprite_color *Color)
+{
+	Color->R = AsepriteSRGBToLinearTable[Color->R8];
+	Color->G = AsepriteSRGBToLinearTable[Color->G8];
+	Color->B = AsepriteSRGBToLinearTable[Color->B8];
+}
+
+// A file whose profile has a fixed gamma of 1 already stores linear values, so
+// linear-light compositing is the same as plain compositing for it.  Other
+// fixed gammas and ICC profiles are treated as sRGB.
+
+inline bool
+AsepriteFileIsLinear(aseprite_file *File)
+{
+	return ((File->ColorProfile.Flags & AsepriteColorProfileFlags_FixedGamma) && File->ColorProfile.Gamma == 1.0f);
+}
+
+// Caller owned scratch memory for the render functions.  Allocations are
+// bumped off Base and given back when the function returns, so the same block
+// can be reused for every call.  Each function that needs temporary memory has
+// a matching *ScratchSize function; when it is handed no scratch (or one with
+// no Base) it falls back to malloc.
+
+struct aseprite_scratch
+{
+	void *Base;
+	size_t Size;
+	size_t Used;
+};
+
+#define ASEPRITE_SCRATCH_ALIGN 16
+
+inline size_t
+AsepriteScratchRound(size_t Size)
+{
+	return (Size + ASEPRITE_SCRATCH_ALIGN - 1) & ~(size_t)(ASEPRITE_SCRATCH_ALIGN - 1);
+}
+
+// Returns 0 if the scratch is too small.
+
+void *
+AsepriteScratchAlloc(aseprite_scratch *Scratch, size_t Size)
+{
+	if (!Scratch || !Scratch->Base)
+		return malloc(Size);
+
+	uintptr_t Base = (uintptr_t)Scratch->Base;
+	uintptr_t At = (Base + Scratch->Used + ASEPRITE_SCRATCH_ALIGN - 1) & ~(uintptr_t)(ASEPRITE_SCRATCH_ALIGN - 1);
+	if (At + Size > Base + Scratch->Size)
+		return 0;
+	Scratch->Used = (At + Size) - Base;
+	return (void *)At;
+}
+
+void
+AsepriteScratchFree(aseprite_scratch *Scratch, void *Memory)
+{
+	if (!Scratch || !Scratch->Base)
+		free(Memory);
+}
+
+enum aseprite_render_flags
+{
+	//Blend layers in linear light instead of on the raw (sRGB) values
+	AsepriteRenderFlags_LinearLight = 1,
+};
+
+struct aseprite_render_options
+{
+	uint32_t Flags;
+	//Temporary memory for the render, may be 0 (see aseprite_scratch)
+	aseprite_scratch *Scratch;
+	//Threads used by AsepriteRenderAllFrames, 0 for one per CPU
+	int NumThreads;
+	//Bit per layer index of the layers to draw, 0 for every layer.  Layers
+	//past the 64th are always drawn.  Hidden layers are never drawn.
+	uint64_t LayerMask;
+};
+
+inline bool
+AsepriteLayerMaskedOut(aseprite_render_options *Options, int LayerIndex)
+{
+	return (Options && Options->LayerMask && LayerIndex < 64 && !(Options->LayerMask & ((uint64_t)1 << LayerIndex)));
+}
+
+// Everything needed to blend the pixels of one layer onto the frame.
+
+struct aseprite_blend_info
+{
+	aseprite_palette *Palette;
+	uint16_t ColorDepth;
+	uint8_t TransparentPaletteEntry;
+	float LayerOpacity;
+	aseprite_blend_mode BlendMode;
+	bool LinearLight;
+	int BytesPerPixel;
+	//Opaque cel, normal blend, full opacity: rows can be copied as is
+	bool CopyRows;
+	//The cel is stored as runs
+	bool RunLength;
+	//The cel is stored as tiles
+	bool Tiled;
+	//Only for tilemap cels
+	aseprite_tileset *Tileset;
+};
+
+// Blends Count source pixels onto a row of the destination.  SourceStep is the
+// distance in bytes between consecutive source pixels, which lets flipped
+// tiles be read backwards or down a column.
+
+// The color of one source pixel with the layer opacity applied.
+
+inline aseprite_color
+AsepriteGetSourceColor(aseprite_blend_info *Blend, uint8_t *Source)
+{
+	aseprite_color SourceColor = {0};
+	switch (Blend->ColorDepth)
+	{
+		case 8:
+		{
+			uint8_t PaletteIndex = *Source;
+			if (PaletteIndex != Blend->TransparentPaletteEntry)
+				SourceColor = Blend->Palette->Colors[PaletteIndex];
+		} break;
+		case 32:
+		{
+			SourceColor = AsepriteColorFromRGBA8((uint32_t *)Source);
+		} break;
+	}
+	if (Blend->LayerOpacity != 1)
+	{
+		SourceColor.A *= Blend->LayerOpacity;
+		SourceColor.A8 = (uint8_t)(SourceColor.A * 255);
+	}
+	return SourceColor;
+}
+
+// Blends a source color onto a destination pixel that isn't empty.
+
+inline uint32_t
+AsepriteBlendOver(aseprite_blend_info *Blend, aseprite_color SourceColor, uint32_t *Dest)
+{
+	aseprite_color DestColor = AsepriteColorFromRGBA8(Dest);
+	if (Blend->LinearLight)
+	{
+		AsepriteColorToLinear(&SourceColor);
+		AsepriteColorToLinear(&DestColor);
+	}
+	aseprite_color FinalColor = AsepriteCombineColors(&SourceColor, &DestColor, Blend->BlendMode);
+	if (Blend->LinearLight)
+	{
+		FinalColor.R8 = AsepriteLinearToSRGB8(FinalColor.R);
+		FinalColor.G8 = AsepriteLinearToSRGB8(FinalColor.G);
+		FinalColor.B8 = AsepriteLinearToSRGB8(FinalColor.B);
+	}
+	return *((uint32_t *)FinalColor.RGBA8);
+}
+
+void
+AsepriteCompositeSpan(aseprite_blend_info *Blend, uint32_t *Dest, uint8_t *Source, int SourceStep, int Count)
+{
+	for (int X = 0; X < Count; X++, Source += SourceStep, Dest++)
+	{
+		aseprite_color SourceColor = AsepriteGetSourceColor(Blend, Source);
+		if (*Dest == 0)
+			*Dest = *((uint32_t *)SourceColor.RGBA8);
+		else if (SourceColor.A8 != 0)
+			*Dest = AsepriteBlendOver(Blend, SourceColor, Dest);
+	}
+}
+
+// Blends Count copies of one source pixel onto a row of the destination.  The
+// result over a given destination value is the same all along the run, so it
+// is only worked out again where the destination changes.
+
+void
+AsepriteCompositeRun(aseprite_blend_info *Blend, uint32_t *Dest, uint8_t *Source, int Count)
+{
+	aseprite_color SourceColor = AsepriteGetSourceColor(Blend, Source);
+	uint32_t SourceValue = *((uint32_t *)SourceColor.RGBA8);
+	if (SourceColor.A8 == 0)
+	{
+		for (int X = 0; X < Count; X++)
+		{
+			if (Dest[X] == 0)
+				Dest[X] = SourceValue;
+		}
+		return;
+	}
+
+	uint32_t Under = 0;
+	uint32_t Over = 0;
+	for (int X = 0; X < Count; X++)
+	{
+		if (Dest[X] == 0)
+		{
+			Dest[X] = SourceValue;
+			continue;
+		}
+		if (Dest[X] != Under)
+		{
+			Under = Dest[X];
+			Over = AsepriteBlendOver(Blend, SourceColor, Dest + X);
+		}
+		Dest[X] = Over;
+	}
+}
+
+// Returns the pixels of a tilemap entry starting at column U of row V of the
+// tile as it appears in the tilemap, and the step between them, taking the
+// flip bits into account.  X/Y flips are applied first, then the diagonal flip
+// swaps the axes (square tiles only).  Returns 0 for empty tiles.
+
+uint8_t *
+AsepriteGetTileRow(aseprite_tileset *Tileset, aseprite_tile_masks *Masks, uint32_t Tile, int U, int V, int BytesPerPixel, int *Step)
+{
+	uint32_t TileID = Tile & Masks->TileID;
+	if (TileID == 0 || TileID >= (uint32_t)Tileset->NumTiles || !Tileset->Pixels)
+		return 0;
+
+	int Pitch = Tileset->TileWidth*BytesPerPixel;
+	uint8_t *TilePixels = (uint8_t *)Tileset->Pixels + (size_t)TileID*Tileset->TileHeight*Pitch;
+	bool XFlip = (Tile & Masks->XFlip) != 0;
+	bool YFlip = (Tile & Masks->YFlip) != 0;
+	bool DiagonalFlip = (Tile & Masks->DiagonalFlip) != 0 && Tileset->TileWidth == Tileset->TileHeight;
+	if (XFlip)
+		U = Tileset->TileWidth - 1 - U;
+	if (YFlip)
+		V = Tileset->TileHeight - 1 - V;
+
+	if (DiagonalFlip)
+	{
+		*Step = XFlip ? -Pitch : Pitch;
+		return TilePixels + U*Pitch + V*BytesPerPixel;
+	}
+	*Step = XFlip ? -BytesPerPixel : BytesPerPixel;
+	return TilePixels + V*Pitch + U*BytesPerPixel;
+}
+
+// Writes Count pixels of one row of a tilemap cel (in pixels, relative to the
+// cel position) into Out, in the file's color depth.  Empty tiles come out
+// transparent.
+
+void
+AsepriteExpandTilemapRow(aseprite_file *File, aseprite_layer *Layer, int CelRow, int CelColumn, int Count, uint8_t *Out)
+{
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	aseprite_tileset *Tileset = AsepriteGetTileset(File, File->LayerInfo[Layer->Header.LayerIndex].TilesetIndex);
+	uint8_t Transparent = (File->Header.ColorDepth == 8) ? File->Header.TransparentPaletteEntry : 0;
+	memset(Out, Transparent, (size_t)Count*BytesPerPixel);
+	if (!Tileset)
+		return;
+
+	uint32_t *TileRow = (uint32_t *)Layer->Data + (CelRow / Tileset->TileHeight)*Layer->DataWidth;
+	int V = CelRow % Tileset->TileHeight;
+	while (Count > 0)
+	{
+		int U = CelColumn % Tileset->TileWidth;
+		int SpanCount = AsepriteMinInt(Tileset->TileWidth - U, Count);
+		int Step;
+		uint8_t *Source = AsepriteGetTileRow(Tileset, &Layer->TileMasks, TileRow[CelColumn / Tileset->TileWidth], U, V, BytesPerPixel, &Step);
+		if (Source)
+		{
+			for (int X = 0; X < SpanCount; X++, Source += Step)
+				memcpy(Out + X*BytesPerPixel, Source, BytesPerPixel);
+		}
+		Out += SpanCount*BytesPerPixel;
+		CelColumn += SpanCount;
+		Count -= SpanCount;
+	}
+}
+
+// Turns a tilemap cel into an ordinary image cel, for code that would rather
+// not deal with tiles.  Tilemap cels are otherwise kept as tile grids and the
+// compositor draws them a tile at a time.  Compacted files can't be changed.
+
+bool
+AsepriteExpandTilemapCel(aseprite_file *File, aseprite_layer *Layer)
+{
+	if (Layer->Header.CelType != AsepriteCelType_CompressedTilemap || !Layer->Data || File->Block)
+		return false;
+	aseprite_tileset *Tileset = AsepriteGetTileset(File, File->LayerInfo[Layer->Header.LayerIndex].TilesetIndex);
+	if (!Tileset)
+		return false;
+
+	int Width = Layer->DataWidth*Tileset->TileWidth;
+	int Height = Layer->DataHeight*Tileset->TileHeight;
+	int Pitch = Width*AsepriteBytesPerPixel(File->Header.ColorDepth);
+	uint8_t *Pixels = (uint8_t *)AsepriteAllocCelData((size_t)Pitch*Height);
+	if (!Pixels)
+		return false;
+
+	AsepriteBeginCelStats(&Layer->Stats);
+	for (int Y = 0; Y < Height; Y++)
+	{
+		AsepriteExpandTilemapRow(File, Layer, Y, 0, Width, Pixels + (size_t)Y*Pitch);
+		AsepriteAccumulateCelStats(&Layer->Stats, Pixels + (size_t)Y*Pitch, Y, 1, Width, File->Header.ColorDepth, File->Header.TransparentPaletteEntry);
+	}
+	AsepriteEndCelStats(&Layer->Stats);
+
+	AsepriteReleaseCelData(Layer->Data);
+	Layer->Data = Pixels;
+	Layer->DataWidth = Width;
+	Layer->DataHeight = Height;
+	Layer->Header.CelType = AsepriteCelType_Raw;
+	return true;
+}
+
+// Fills in the blend info for a layer's cel.  Returns false if the cel can't
+// be drawn (a tilemap whose tileset is missing).
+
+bool
+AsepriteSetupBlend(aseprite_file *File, aseprite_layer_info *LayerInfo, aseprite_layer *Layer, bool LinearLight, aseprite_blend_info *Blend)
+{
+	Blend->Palette = &File->Palette;
+	Blend->ColorDepth = File->Header.ColorDepth;
+	Blend->TransparentPaletteEntry = File->Header.TransparentPaletteEntry;
+	Blend->LayerOpacity = LayerInfo->Header.Opacity / 255.0f;
+	Blend->BlendMode = (aseprite_blend_mode)LayerInfo->Header.BlendMode;
+	Blend->LinearLight = LinearLight;
+	Blend->BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	Blend->CopyRows = (Blend->ColorDepth == 32 && Layer->Stats.IsOpaque && Blend->LayerOpacity == 1 && Blend->BlendMode == AsepriteBlendMode_Normal);
+	Blend->RunLength = Layer->IsRunLength;
+	if (Blend->RunLength)
+		Blend->CopyRows = false;
+	Blend->Tiled = Layer->IsTiled;
+	Blend->Tileset = 0;
+	if (Layer->Header.CelType == AsepriteCelType_CompressedTilemap)
+	{
+		Blend->Tileset = AsepriteGetTileset(File, LayerInfo->TilesetIndex);
+		Blend->CopyRows = false;
+		if (!Blend->Tileset)
+			return false;
+	}
+	return true;
+}
+
+// Composites the canvas pixels [MinX, MaxX) of canvas row Y from one cel.
+// DestRow points at canvas pixel 0 of that row in the destination.  CelRow is
+// the cel's decoded row for image cels; tilemap, run length and tiled cels
+// read their tiles or runs instead.
+
+void
+AsepriteCompositeCelRow(aseprite_blend_info *Blend, aseprite_layer *Layer, uint32_t *DestRow, int Y, int MinX, int MaxX, uint8_t *CelRow)
+{
+	int CelX = Layer->Header.XPos;
+	int CelY = Layer->Header.YPos;
+	int BytesPerPixel = Blend->BytesPerPixel;
+
+	aseprite_tileset *Tileset = Blend->Tileset;
+	if (Tileset)
+	{
+		uint32_t *TileRow = (uint32_t *)Layer->Data + ((Y - CelY) / Tileset->TileHeight)*Layer->DataWidth;
+		int V = (Y - CelY) % Tileset->TileHeight;
+		for (int X = MinX; X < MaxX;)
+		{
+			int U = (X - CelX) % Tileset->TileWidth;
+			int Count = AsepriteMinInt(Tileset->TileWidth - U, MaxX - X);
+			int Step;
+			uint8_t *Source = AsepriteGetTileRow(Tileset, &Layer->TileMasks, TileRow[(X - CelX) / Tileset->TileWidth], U, V, BytesPerPixel, &Step);
+			if (Source)
+				AsepriteCompositeSpan(Blend, DestRow + X, Source, Step, Count);
+			X += Count;
+		}
+		return;
+	}
+
+	if (Blend->RunLength)
+	{
+		const uint8_t *Run = AsepriteGetCelRunRow(Layer, Y - CelY);
+		int RunStart = CelX;
+		while (RunStart < MaxX)
+		{
+			int RunEnd = RunStart + AsepriteGetRunLength(Run);
+			int From = AsepriteMaxInt(RunStart, MinX);
+			int To = AsepriteMinInt(RunEnd, MaxX);
+			if (From < To)
+				AsepriteCompositeRun(Blend, DestRow + From, (uint8_t *)Run + ASEPRITE_RUN_HEADER_SIZE, To - From);
+			RunStart = RunEnd;
+			Run += ASEPRITE_RUN_HEADER_SIZE + BytesPerPixel;
+		}
+		return;
+	}
+
+	if (Blend->Tiled)
+	{
+		int Shift = AsepriteGetCelTileShift(Layer);
+		int TileY = (Y - CelY) >> Shift;
+		int V = (Y - CelY) - (TileY << Shift);
+		for (int X = MinX; X < MaxX;)
+		{
+			int TileX = (X - CelX) >> Shift;
+			int TileWidth = AsepriteGetTileSpan(Layer->DataWidth, Shift, TileX);
+			int U = (X - CelX) - (TileX << Shift);
+			int Count = AsepriteMinInt(TileWidth - U, MaxX - X);
+			bool Uniform;
+			uint8_t *Tile = AsepriteGetCelTile(Layer, Shift, TileX, TileY, &Uniform);
+			if (Tile && Uniform)
+			{
+				if (Blend->CopyRows)
+				{
+					uint32_t Value;
+					memcpy(&Value, Tile, sizeof(Value));
+					for (int Index = 0; Index < Count; Index++)
+						DestRow[X + Index] = Value;
+				}
+				else
+					AsepriteCompositeRun(Blend, DestRow + X, Tile, Count);
+			}
+			else if (Tile)
+			{
+				uint8_t *Source = Tile + ((size_t)V*TileWidth + U)*BytesPerPixel;
+				if (Blend->CopyRows)
+					memcpy(DestRow + X, Source, Count*4);
+				else
+					AsepriteCompositeSpan(Blend, DestRow + X, Source, BytesPerPixel, Count);
+			}
+			X += Count;
+		}
+		return;
+	}
+
+	uint8_t *Source = CelRow + (MinX - CelX)*BytesPerPixel;
+	if (Blend->CopyRows)
+		memcpy(DestRow + MinX, Source, (MaxX - MinX)*4);
+	else
+		AsepriteCompositeSpan(Blend, DestRow + MinX, Source, BytesPerPixel, MaxX - MinX);
+}
+
+// Layers are only composited over the area their cel's stats say is covered,
+// so empty cels cost nothing and the destination is cleared up front.  Fully
+// opaque cels with normal blending and full opacity are copied row by row.
+// Tilemap cels are drawn straight from the tileset a tile span at a time, and
+// the empty tiles of tiled cels are skipped a tile span at a time.
+// Options may be 0.  Nothing is allocated, so Options->Scratch is not used.
+
+void
+AsepriteGetEntireFrameRGBAEx(aseprite_file *File, int FrameNumber, void *DestTexture, int DestWidth, int DestHeight, int DestX, int DestY, aseprite_render_options *Options)
+{
+	Assert(FrameNumber < File->NumFrames);
+	
+	bool LinearLight = (Options && (Options->Flags & AsepriteRenderFlags_LinearLight) && !AsepriteFileIsLinear(File));
+	if (LinearLight)
+		AsepriteInitColorTables();
+
+	aseprite_frame *Frame = File->Frames + FrameNumber;
+	int DestPitch = DestWidth*4;
+
+	//The part of the canvas that lands inside the destination texture
+	int CanvasMinX = AsepriteMaxInt(0, -DestX);
+	int CanvasMinY = AsepriteMaxInt(0, -DestY);
+	int CanvasMaxX = AsepriteMinInt(File->Header.WidthInPixels, DestWidth - DestX);
+	int CanvasMaxY = AsepriteMinInt(File->Header.HeightInPixels, DestHeight - DestY);
+	if (CanvasMinX >= CanvasMaxX || CanvasMinY >= CanvasMaxY)
+		return;
+
+	for (int Y = CanvasMinY; Y < CanvasMaxY; Y++)
+	{
+		uint32_t *Dest = (uint32_t *)((uint8_t *)DestTexture + (DestY + Y)*DestPitch) + DestX + CanvasMinX;
+		memset(Dest, 0, (CanvasMaxX - CanvasMinX)*4);
+	}
+
+	for (int LayerIndex = 0; LayerIndex < File->NumLayers && LayerIndex < Frame->NumLayers; LayerIndex++)
+	{
+		aseprite_layer_info *LayerInfo = File->LayerInfo + LayerIndex;
+		if (LayerInfo->Header.Opacity == 0 || (LayerInfo->Header.Flags & AsepriteLayerFlags_Visible) == 0 ||
+			AsepriteLayerMaskedOut(Options, LayerIndex))
+			continue;
+
+		aseprite_layer *Layer = Frame->Layers + LayerIndex;
+		if (!Layer->Data || Layer->Stats.IsEmpty)
+			continue;
+
+		aseprite_blend_info Blend;
+		if (!AsepriteSetupBlend(File, LayerInfo, Layer, LinearLight, &Blend))
+			continue;
+
+		int CelX = Layer->Header.XPos;
+		int CelY = Layer->Header.YPos;
+		int MinX = AsepriteMaxInt(CanvasMinX, CelX + Layer->Stats.MinX);
+		int MinY = AsepriteMaxInt(CanvasMinY, CelY + Layer->Stats.MinY);
+		int MaxX = AsepriteMinInt(CanvasMaxX, CelX + Layer->Stats.MaxX);
+		int MaxY = AsepriteMinInt(CanvasMaxY, CelY + Layer->Stats.MaxY);
+		if (MinX >= MaxX || MinY >= MaxY)
+			continue;
+
+		int DataPitch = Layer->DataWidth*Blend.BytesPerPixel;
+		for (int Y = MinY; Y < MaxY; Y++)
+		{
+			uint32_t *Dest = (uint32_t *)((uint8_t *)DestTexture + (DestY + Y)*DestPitch) + DestX;
+			uint8_t *CelRow = 0;
+			if (!Blend.Tileset && !Blend.RunLength && !Blend.Tiled)
+				CelRow = (uint8_t *)Layer->Data + (Y - CelY)*DataPitch;
+			AsepriteCompositeCelRow(&Blend, Layer, Dest, Y, MinX, MaxX, CelRow);
+		}
+	}
+}
+
+void
+AsepriteGetEntireFrameRGBA(aseprite_file *File, int FrameNumber, void *DestTexture, int DestWidth, int DestHeight, int DestX, int DestY)
+{
+	AsepriteGetEntireFrameRGBAEx(File, FrameNumber, DestTexture, DestWidth, DestHeight, DestX, DestY, 0);
+}
+
+// Inflates a cel that was kept compressed (AsepriteParseFlags_KeepCompressedCels)
+// and computes its real stats, after which it is like any other cel.  Cels of
+// compacted files stay compressed; draw them with AsepriteStreamFrameRGBA.
+
+bool
+AsepriteInflateKeptCel(aseprite_file *File, aseprite_layer *Layer)
+{
+	if (!Layer->CompressedData || File->Block)
+		return false;
+
+	uint16_t ColorDepth = File->Header.ColorDepth;
+	int Pitch = Layer->DataWidth*AsepriteBytesPerPixel(ColorDepth);
+	uint8_t *Data = (uint8_t *)AsepriteAllocCelData((size_t)Pitch*Layer->DataHeight);
+	if (!Data)
+		return false;
+	if (!AsepriteInflateCel(Layer->CompressedData, Layer->CompressedSize, Data, Layer->DataWidth, Layer->DataHeight,
+							ColorDepth, File->Header.TransparentPaletteEntry, &Layer->Stats))
+	{
+		AsepriteReleaseCelData(Data);
+		AsepriteBeginCelStats(&Layer->Stats);
+		AsepriteEndCelStats(&Layer->Stats);
+		Data = 0;
+	}
+
+	free(Layer->CompressedData);
+	Layer->CompressedData = 0;
+	Layer->CompressedSize = 0;
+	Layer->Data = Data;
+	return (Data != 0);
+}
+
+// Incremental inflate of one compressed cel.  tinfl writes into a circular
+// window the size of the deflate dictionary, and rows are copied out of it as
+// they complete, so the decoded cel never exists in full.
+
+struct aseprite_cel_stream
+{
+	tinfl_decompressor Inflator;
+	const uint8_t *In;
+	size_t InRemaining;
+	uint8_t *Window;
+	size_t Produced;
+	size_t Consumed;
+	uint8_t *Row;
+	int Pitch;
+	int NextRow;
+	bool Failed;
+	bool Done;
+};
+
+void
+AsepriteBeginCelStream(aseprite_cel_stream *Stream, aseprite_layer *Layer, int BytesPerPixel, uint8_t *Window, uint8_t *Row)
+{
+	tinfl_init(&Stream->Inflator);
+	Stream->In = (const uint8_t *)Layer->CompressedData;
+	Stream->InRemaining = Layer->CompressedSize;
+	Stream->Window = Window;
+	Stream->Produced = 0;
+	Stream->Consumed = 0;
+	Stream->Row = Row;
+	Stream->Pitch = Layer->DataWidth*BytesPerPixel;
+	Stream->NextRow = 0;
+	Stream->Failed = false;
+	Stream->Done = false;
+}
+
+// Decodes the next row of the cel into Stream->Row.  On a corrupt stream the
+// rest of the cel comes out as zeroes.
+
+void
+AsepriteStreamNextRow(aseprite_cel_stream *Stream)
+{
+	int Filled = 0;
+	while (Filled < Stream->Pitch)
+	{
+		if (Stream->Consumed == Stream->Produced)
+		{
+			if (Stream->Done || Stream->Failed)
+			{
+				memset(Stream->Row + Filled, 0, Stream->Pitch - Filled);
+				break;
+			}
+
+			//Everything decoded so far has been copied out, so tinfl is free to
+			//write up to the end of the window
+			size_t WindowPos = Stream->Produced & (TINFL_LZ_DICT_SIZE - 1);
+			size_t InSize = Stream->InRemaining;
+			size_t OutSize = TINFL_LZ_DICT_SIZE - WindowPos;
+			tinfl_status Status = tinfl_decompress(&Stream->Inflator, Stream->In, &InSize, Stream->Window, Stream->Window + WindowPos, &OutSize,
+												   TINFL_FLAG_PARSE_ZLIB_HEADER);
+			Stream->In += InSize;
+			Stream->InRemaining -= InSize;
+			Stream->Produced += OutSize;
+			if (Status == TINFL_STATUS_DONE)
+				Stream->Done = true;
+			else if (Status < TINFL_STATUS_DONE || (Status == TINFL_STATUS_NEEDS_MORE_INPUT && OutSize == 0))
+				Stream->Failed = true;
+			continue;
+		}
+
+		size_t WindowPos = Stream->Consumed & (TINFL_LZ_DICT_SIZE - 1);
+		size_t Available = Stream->Produced - Stream->Consumed;
+		if (Available > TINFL_LZ_DICT_SIZE - WindowPos)
+			Available = TINFL_LZ_DICT_SIZE - WindowPos;
+		int Count = AsepriteMinInt((int)Available, Stream->Pitch - Filled);
+		memcpy(Stream->Row + Filled, Stream->Window + WindowPos, Count);
+		Stream->Consumed += Count;
+		Filled += Count;
+	}
+	Stream->NextRow++;
+}
+
+// Inflates a cel that was kept compressed straight into 32x32 tiles (see
+// AsepriteEncodeCelTiles), a strip of tile rows at a time, so only one strip
+// of its pixels is ever decoded at once.  Computes its real stats like
+// AsepriteInflateKeptCel, which is what cels go through instead when they are
+// too small or too large to tile, their tiles would be no smaller than their
+// pixels, or memory runs out on the way.  Compacted files can't be changed.
+
+bool
+AsepriteInflateKeptCelTiles(aseprite_file *File, aseprite_layer *Layer)
+{
+	if (!Layer->CompressedData || File->Block)
+		return false;
+	int Shift = ASEPRITE_TILE_MIN_SHIFT;
+	int Width = Layer->DataWidth;
+	int Height = Layer->DataHeight;
+	if (Width < (1 << Shift) || Height < (1 << Shift))
+		return AsepriteInflateKeptCel(File, Layer);
+
+	uint16_t ColorDepth = File->Header.ColorDepth;
+	int BytesPerPixel = AsepriteBytesPerPixel(ColorDepth);
+	uint8_t Transparent = (ColorDepth == 8) ? File->Header.TransparentPaletteEntry : 0;
+	size_t Pitch = (size_t)Width*BytesPerPixel;
+	int TilesY = AsepriteCountTiles(Height, Shift);
+	size_t At = ASEPRITE_TILE_HEADER_SIZE + (size_t)AsepriteCountTiles(Width, Shift)*TilesY*sizeof(uint32_t);
+	size_t Capacity = At*2;
+	uint8_t *Window = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE + (Pitch << Shift));
+	uint8_t *Tiles = (uint8_t *)malloc(Capacity);
+	if (!Window || !Tiles)
+	{
+		free(Window);
+		free(Tiles);
+		return AsepriteInflateKeptCel(File, Layer);
+	}
+	uint32_t ShiftValue = (uint32_t)Shift;
+	memcpy(Tiles, &ShiftValue, sizeof(ShiftValue));
+
+	uint8_t *Strip = Window + TINFL_LZ_DICT_SIZE;
+	aseprite_cel_stream Stream;
+	AsepriteBeginCelStream(&Stream, Layer, BytesPerPixel, Window, Strip);
+	aseprite_cel_stats Stats;
+	AsepriteBeginCelStats(&Stats);
+	bool Failed = false;
+	for (int TileY = 0; TileY < TilesY && !Failed; TileY++)
+	{
+		int StripHeight = AsepriteGetTileSpan(Height, Shift, TileY);
+		for (int Y = 0; Y < StripHeight; Y++)
+		{
+			Stream.Row = Strip + Y*Pitch;
+			AsepriteStreamNextRow(&Stream);
+		}
+		AsepriteAccumulateCelStats(&Stats, Strip, TileY << Shift, StripHeight, Width, ColorDepth, File->Header.TransparentPaletteEntry);
+
+		size_t End = AsepriteWriteTileRow(Strip, Width, StripHeight, BytesPerPixel, Transparent, Shift, TileY, 0, At);
+		if (End > Capacity)
+		{
+			Capacity = (End > Capacity*2) ? End : Capacity*2;
+			uint8_t *Grown = (uint8_t *)realloc(Tiles, Capacity);
+			if (!Grown)
+			{
+				Failed = true;
+				break;
+			}
+			Tiles = Grown;
+		}
+		AsepriteWriteTileRow(Strip, Width, StripHeight, BytesPerPixel, Transparent, Shift, TileY, Tiles, At);
+		At = End;
+		//Offsets have to fit in an entry, and tiles that end up no smaller than
+		//the pixels aren't worth it
+		Failed = (At > ~ASEPRITE_TILE_UNIFORM || At >= Pitch*Height);
+	}
+	AsepriteEndCelStats(&Stats);
+	//A stream that ended early came out as zeroes.  Only a stream that was
+	//read to the end can tell.
+	bool Corrupt = !Failed && (Stream.Failed || Stream.Consumed != Pitch*Height);
+	free(Window);
+
+	uint8_t *Data = 0;
+	if (!Failed && !Corrupt)
+	{
+		Data = (uint8_t *)AsepriteAllocCelData(At);
+		if (Data)
+			memcpy(Data, Tiles, At);
+	}
+	free(Tiles);
+	//The compressed data is still there, so the cel can be inflated as usual
+	if (!Data && !Corrupt)
+		return AsepriteInflateKeptCel(File, Layer);
+
+	if (Corrupt)
+	{
+		AsepriteBeginCelStats(&Stats);
+		AsepriteEndCelStats(&Stats);
+	}
+	free(Layer->CompressedData);
+	Layer->CompressedData = 0;
+	Layer->CompressedSize = 0;
+	Layer->Data = Data;
+	Layer->Stats = Stats;
+	Layer->IsTiled = (Data != 0);
+	return (Data != 0);
+}
+
+struct aseprite_stream_layer
+{
+	aseprite_blend_info Blend;
+	aseprite_cel_stream *Stream;
+	int MinX, MinY, MaxX, MaxY;
+	bool Active;
+};
+
+// Scratch needed by AsepriteStreamFrameRGBA for this frame: the layer table
+// plus a window and a row for every cel that was kept compressed.
+
+size_t
+AsepriteStreamFrameScratchSize(aseprite_file *File, int FrameNumber)
+{
+	aseprite_frame *Frame = File->Frames + FrameNumber;
+	int NumLayers = AsepriteMinInt(File->NumLayers, Frame->NumLayers);
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+
+	//Extra alignment slack so a scratch block that isn't aligned still fits
+	size_t Size = ASEPRITE_SCRATCH_ALIGN + AsepriteScratchRound(sizeof(aseprite_stream_layer)*NumLayers);
+	for (int LayerIndex = 0; LayerIndex < NumLayers; LayerIndex++)
+	{
+		aseprite_layer *Layer = Frame->Layers + LayerIndex;
+		if (Layer->CompressedData)
+			Size += AsepriteScratchRound(sizeof(aseprite_cel_stream)) + TINFL_LZ_DICT_SIZE + AsepriteScratchRound((size_t)Layer->DataWidth*BytesPerPixel);
+	}
+	return Size;
+}
+
+// Composites a frame one destination row at a time.  Cels that were kept
+// compressed (see AsepriteParseFlags_KeepCompressedCels) are inflated as the
+// rows are needed, through a 32KB window per layer, so the working memory is a
+// few windows and rows no matter how large the frame is.  Cels that are
+// already decoded are read as usual.  Options may be 0.  The working memory
+// comes from Options->Scratch when there is one (AsepriteStreamFrameScratchSize
+// bytes); the frame is left untouched if that is too small.
+
+void
+AsepriteStreamFrameRGBA(aseprite_file *File, int FrameNumber, void *DestTexture, int DestWidth, int DestHeight, int DestX, int DestY, aseprite_render_options *Options)
+{
+	Assert(FrameNumber < File->NumFrames);
+
+	bool LinearLight = (Options && (Options->Flags & AsepriteRenderFlags_LinearLight) && !AsepriteFileIsLinear(File));
+	if (LinearLight)
+		AsepriteInitColorTables();
+
+	aseprite_frame *Frame = File->Frames + FrameNumber;
+	int DestPitch = DestWidth*4;
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+
+	int CanvasMinX = AsepriteMaxInt(0, -DestX);
+	int CanvasMinY = AsepriteMaxInt(0, -DestY);
+	int CanvasMaxX = AsepriteMinInt(File->Header.WidthInPixels, DestWidth - DestX);
+	int CanvasMaxY = AsepriteMinInt(File->Header.HeightInPixels, DestHeight - DestY);
+	if (CanvasMinX >= CanvasMaxX || CanvasMinY >= CanvasMaxY)
+		return;
+
+	//Per layer state: which rows it covers and, for kept cels, the stream
+	int NumLayers = AsepriteMinInt(File->NumLayers, Frame->NumLayers);
+	aseprite_scratch *Scratch = Options ? Options->Scratch : 0;
+	size_t ScratchMark = Scratch ? Scratch->Used : 0;
+	size_t WorkingSize = AsepriteStreamFrameScratchSize(File, FrameNumber) - ASEPRITE_SCRATCH_ALIGN;
+	aseprite_stream_layer *Layers = (aseprite_stream_layer *)AsepriteScratchAlloc(Scratch, WorkingSize);
+	if (!Layers)
+		return;
+	uint8_t *NextStreamMemory = (uint8_t *)Layers + AsepriteScratchRound(sizeof(aseprite_stream_layer)*NumLayers);
+
+	for (int LayerIndex = 0; LayerIndex < NumLayers; LayerIndex++)
+	{
+		aseprite_layer_info *LayerInfo = File->LayerInfo + LayerIndex;
+		aseprite_layer *Layer = Frame->Layers + LayerIndex;
+		aseprite_stream_layer *Rows = Layers + LayerIndex;
+		Rows->Active = false;
+		Rows->Stream = 0;
+		if (LayerInfo->Header.Opacity == 0 || (LayerInfo->Header.Flags & AsepriteLayerFlags_Visible) == 0 ||
+			AsepriteLayerMaskedOut(Options, LayerIndex))
+			continue;
+		if ((!Layer->Data && !Layer->CompressedData) || Layer->Stats.IsEmpty)
+			continue;
+		if (!AsepriteSetupBlend(File, LayerInfo, Layer, LinearLight, &Rows->Blend))
+			continue;
+
+		Rows->MinX = AsepriteMaxInt(CanvasMinX, Layer->Header.XPos + Layer->Stats.MinX);
+		Rows->MinY = AsepriteMaxInt(CanvasMinY, Layer->Header.YPos + Layer->Stats.MinY);
+		Rows->MaxX = AsepriteMinInt(CanvasMaxX, Layer->Header.XPos + Layer->Stats.MaxX);
+		Rows->MaxY = AsepriteMinInt(CanvasMaxY, Layer->Header.YPos + Layer->Stats.MaxY);
+		Rows->Active = (Rows->MinX < Rows->MaxX && Rows->MinY < Rows->MaxY);
+		if (Rows->Active && Layer->CompressedData)
+		{
+			Rows->Stream = (aseprite_cel_stream *)NextStreamMemory;
+			uint8_t *Window = NextStreamMemory + AsepriteScratchRound(sizeof(aseprite_cel_stream));
+			uint8_t *Row = Window + TINFL_LZ_DICT_SIZE;
+			NextStreamMemory = Row + AsepriteScratchRound((size_t)Layer->DataWidth*BytesPerPixel);
+			AsepriteBeginCelStream(Rows->Stream, Layer, BytesPerPixel, Window, Row);
+		}
+	}
+
+	for (int Y = CanvasMinY; Y < CanvasMaxY; Y++)
+	{
+		uint32_t *Dest = (uint32_t *)((uint8_t *)DestTexture + (DestY + Y)*DestPitch) + DestX;
+		memset(Dest + CanvasMinX, 0, (CanvasMaxX - CanvasMinX)*4);
+
+		for (int LayerIndex = 0; LayerIndex < NumLayers; LayerIndex++)
+		{
+			aseprite_stream_layer *Rows = Layers + LayerIndex;
+			if (!Rows->Active || Y < Rows->MinY || Y >= Rows->MaxY)
+				continue;
+
+			aseprite_layer *Layer = Frame->Layers + LayerIndex;
+			int CelRowIndex = Y - Layer->Header.YPos;
+			uint8_t *CelRow = 0;
+			if (Rows->Stream)
+			{
+				//Rows above the visible area still have to be decoded to get past them
+				while (Rows->Stream->NextRow <= CelRowIndex)
+					AsepriteStreamNextRow(Rows->Stream);
+				CelRow = Rows->Stream->Row;
+			}
+			else if (!Rows->Blend.Tileset && !Rows->Blend.RunLength && !Rows->Blend.Tiled)
+			{
+				CelRow = (uint8_t *)Layer->Data + (size_t)CelRowIndex*Layer->DataWidth*BytesPerPixel;
+			}
+			AsepriteCompositeCelRow(&Rows->Blend, Layer, Dest, Y, Rows->MinX, Rows->MaxX, CelRow);
+		}
+	}
+
+	AsepriteScratchFree(Scratch, Layers);
+	if (Scratch)
+		Scratch->Used = ScratchMark;
+}
+
+struct aseprite_thumbnail
+{
+	int Width;
+	int Height;
+	uint32_t *Pixels;
+};
+
+// Makes an RGBA thumbnail of the first frame that fits in MaxDim x MaxDim
+// (sprites that already fit keep their size).  Only the header and the first
+// frame are read, so only that frame's cels are inflated.  The frame is
+// composited a band of rows at a time, and each band is box filtered down to
+// one thumbnail row (with alpha weighting) as soon as it is drawn.  Pixels is
+// 0 if the data can't be read.  Release it with AsepriteFreeThumbnail.
+//
+// With a Scratch (AsepriteThumbnailScratchSize bytes) the thumbnail pixels and
+// the band are taken from it instead, and the pixels stay valid until the
+// scratch is reused; don't call AsepriteFreeThumbnail then.  Reading the
+// frame itself still allocates its cels.
+
+aseprite_thumbnail
+AsepriteExtractThumbnailEx(void *FileData, size_t FileSize, int MaxDim, aseprite_scratch *Scratch)
+{
+	aseprite_thumbnail Result = {0};
+
+	aseprite_parse_options Options = {0};
+	Options.FileSize = FileSize;
+	Options.MaxFrames = 1;
+	aseprite_file File = AsepriteParseFileEx(FileData, &Options);
+
+	int Width = File.Header.WidthInPixels;
+	int Height = File.Header.HeightInPixels;
+	if (File.NumFrames < 1 || MaxDim <= 0 || Width == 0 || Height == 0)
+	{
+		AsepriteFreeFile(&File);
+		return Result;
+	}
+
+	int LargestDim = AsepriteMaxInt(Width, Height);
+	Result.Width = Width;
+	Result.Height = Height;
+	if (LargestDim > MaxDim)
+	{
+		Result.Width = AsepriteMaxInt(1, (int)((int64_t)Width*MaxDim / LargestDim));
+		Result.Height = AsepriteMaxInt(1, (int)((int64_t)Height*MaxDim / LargestDim));
+	}
+
+	int MaxBandRows = (Height + Result.Height - 1) / Result.Height;
+	size_t ScratchMark = Scratch ? Scratch->Used : 0;
+	Result.Pixels = (uint32_t *)AsepriteScratchAlloc(Scratch, (size_t)Result.Width*Result.Height*4);
+	size_t BandMark = Scratch ? Scratch->Used : 0;
+	uint32_t *Band = Result.Pixels ? (uint32_t *)AsepriteScratchAlloc(Scratch, (size_t)Width*MaxBandRows*4) : 0;
+	if (!Band)
+	{
+		if (Result.Pixels)
+			AsepriteScratchFree(Scratch, Result.Pixels);
+		if (Scratch)
+			Scratch->Used = ScratchMark;
+		Result.Pixels = 0;
+		AsepriteFreeFile(&File);
+		return Result;
+	}
+
+	for (int OutY = 0; OutY < Result.Height; OutY++)
+	{
+		int SourceY = (int)((int64_t)OutY*Height / Result.Height);
+		int EndY = (int)((int64_t)(OutY + 1)*Height / Result.Height);
+		int BandRows = EndY - SourceY;
+		AsepriteGetEntireFrameRGBA(&File, 0, Band, Width, BandRows, 0, -SourceY);
+
+		uint8_t *Out = (uint8_t *)(Result.Pixels + OutY*Result.Width);
+		for (int OutX = 0; OutX < Result.Width; OutX++, Out += 4)
+		{
+			int SourceX = (int)((int64_t)OutX*Width / Result.Width);
+			int EndX = (int)((int64_t)(OutX + 1)*Width / Result.Width);
+
+			uint64_t Red = 0, Green = 0, Blue = 0, Alpha = 0;
+			for (int Y = 0; Y < BandRows; Y++)
+			{
+				uint8_t *Pixel = (uint8_t *)(Band + Y*Width + SourceX);
+				for (int X = SourceX; X < EndX; X++, Pixel += 4)
+				{
+					Red += Pixel[0]*Pixel[3];
+					Green += Pixel[1]*Pixel[3];
+					Blue += Pixel[2]*Pixel[3];
+					Alpha += Pixel[3];
+				}
+			}
+
+			uint64_t Count = (uint64_t)(EndX - SourceX)*BandRows;
+			if (Alpha == 0)
+			{
+				*((uint32_t *)Out) = 0;
+				continue;
+			}
+			Out[0] = (uint8_t)((Red + Alpha/2) / Alpha);
+			Out[1] = (uint8_t)((Green + Alpha/2) / Alpha);
+			Out[2] = (uint8_t)((Blue + Alpha/2) / Alpha);
+			Out[3] = (uint8_t)((Alpha + Count/2) / Count);
+		}
+	}
+
+	AsepriteScratchFree(Scratch, Band);
+	if (Scratch)
+		Scratch->Used = BandMark;
+	AsepriteFreeFile(&File);
+	return Result;
+}
+
+aseprite_thumbnail
+AsepriteExtractThumbnail(void *FileData, size_t FileSize, int MaxDim)
+{
+	return AsepriteExtractThumbnailEx(FileData, FileSize, MaxDim, 0);
+}
+
+// Scratch needed by AsepriteExtractThumbnailEx, from the file header alone.
+
+size_t
+AsepriteThumbnailScratchSize(void *FileData, size_t FileSize, int MaxDim)
+{
+	if (FileSize < ASEPRITE_HEADER_SIZE || MaxDim <= 0)
+		return 0;
+	aseprite_header Header = AsepriteReadHeader(FileData);
+	int Width = Header.WidthInPixels;
+	int Height = Header.HeightInPixels;
+	int LargestDim = AsepriteMaxInt(AsepriteMaxInt(Width, Height), 1);
+	int ThumbWidth = Width, ThumbHeight = Height;
+	if (LargestDim > MaxDim)
+	{
+		ThumbWidth = AsepriteMaxInt(1, (int)((int64_t)Width*MaxDim / LargestDim));
+		ThumbHeight = AsepriteMaxInt(1, (int)((int64_t)Height*MaxDim / LargestDim));
+	}
+	int MaxBandRows = (Height + ThumbHeight - 1) / AsepriteMaxInt(ThumbHeight, 1);
+	return ASEPRITE_SCRATCH_ALIGN + AsepriteScratchRound((size_t)ThumbWidth*ThumbHeight*4) + (size_t)Width*MaxBandRows*4;
+}
+
+void
+AsepriteFreeThumbnail(aseprite_thumbnail *Thumbnail)
+{
+	free(Thumbnail->Pixels);
+	Thumbnail->Pixels = 0;
+}
+
+// Alpha masks hold 1 bit per canvas pixel (set where alpha is above the
+// threshold), least significant bit first.  Each row is padded out to whole
+// 64-bit words and the padding is always clear, so two masks can be tested
+// against each other with AND and popcount a word at a time.
+
+struct aseprite_mask
+{
+	int Width;
+	int Height;
+	int WordsPerRow;
+	uint64_t *Bits;
+};
+
+inline int
+AsepritePopCount64(uint64_t Value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(Value);
+#else
+	Value = Value - ((Value >> 1) & 0x5555555555555555ULL);
+	Value = (Value & 0x3333333333333333ULL) + ((Value >> 2) & 0x3333333333333333ULL);
+	Value = (Value + (Value >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((Value * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// ORs the low Count bits of Bits into Row, starting at bit index Bit.  The
+// caller guarantees every set bit falls inside the row.
+
+inline void
+AsepriteOrMaskBits(uint64_t *Row, int Bit, uint64_t Bits, int Count)
+{
+	int Word = Bit >> 6;
+	int Shift = Bit & 63;
+	Row[Word] |= Bits << Shift;
+	if (Shift && Shift + Count > 64)
+		Row[Word + 1] |= Bits >> (64 - Shift);
+}
+
+void
+AsepriteSetMaskBitRange(uint64_t *Row, int FirstBit, int EndBit)
+{
+	while (FirstBit < EndBit)
+	{
+		int Shift = FirstBit & 63;
+		int Count = AsepriteMinInt(64 - Shift, EndBit - FirstBit);
+		uint64_t Bits = (Count == 64) ? ~0ULL : (((1ULL << Count) - 1) << Shift);
+		Row[FirstBit >> 6] |= Bits;
+		FirstBit += Count;
+	}
+}
+
+void
+AsepriteMaskRowRGBA(uint64_t *Row, int DestBit, uint8_t *Source, int Count, uint8_t Threshold)
+{
+	int X = 0;
+#ifdef ASEPRITE_SSE2
+	__m128i Thresh = _mm_set1_epi32(Threshold);
+	for (; X + 16 <= Count; X += 16)
+	{
+		uint32_t Bits = 0;
+		for (int Group = 0; Group < 4; Group++)
+		{
+			__m128i Pixels = _mm_loadu_si128((__m128i *)(Source + (X + Group*4)*4));
+			__m128i Hit = _mm_cmpgt_epi32(_mm_srli_epi32(Pixels, 24), Thresh);
+			Bits |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(Hit)) << (Group*4);
+		}
+		if (Bits)
+			AsepriteOrMaskBits(Row, DestBit + X, Bits, 16);
+	}
+#endif
+	for (; X < Count; X++)
+	{
+		if (Source[X*4 + 3] > Threshold)
+			AsepriteOrMaskBits(Row, DestBit + X, 1, 1);
+	}
+}
+
+// Indexed cels go through a per-palette-entry table.  When the only entry that
+// fails the threshold is the transparent one (the usual case) the row is
+// compared 16 indices at a time instead.
+
+void
+AsepriteMaskRowIndexed(uint64_t *Row, int DestBit, uint8_t *Source, int Count, bool *PassTable, int TransparentIndex)
+{
+	int X = 0;
+#ifdef ASEPRITE_SSE2
+	if (TransparentIndex >= 0)
+	{
+		__m128i Transparent = _mm_set1_epi8((char)TransparentIndex);
+		for (; X + 16 <= Count; X += 16)
+		{
+			__m128i Indices = _mm_loadu_si128((__m128i *)(Source + X));
+			uint32_t Bits = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(Indices, Transparent)) & 0xFFFF;
+			if (Bits)
+				AsepriteOrMaskBits(Row, DestBit + X, Bits, 16);
+		}
+	}
+#endif
+	for (; X < Count; X++)
+	{
+		if (PassTable[Source[X]])
+			AsepriteOrMaskBits(Row, DestBit + X, 1, 1);
+	}
+}
+
+// Whether one pixel in the file's color depth passes the threshold.
+
+inline bool
+AsepriteMaskPixelPasses(const uint8_t *Pixel, uint16_t ColorDepth, bool *PassTable, uint8_t Threshold)
+{
+	return (ColorDepth == 8) ? PassTable[Pixel[0]] : (Pixel[AsepriteBytesPerPixel(ColorDepth) - 1] > Threshold);
+}
+
+// Sets the bits of the canvas columns [MinX, MaxX) covered by runs that pass.
+// The row's runs start at canvas column CelX.
+
+void
+AsepriteMaskRunRow(uint64_t *Row, const uint8_t *Run, int CelX, int MinX, int MaxX, uint16_t ColorDepth, bool *PassTable, uint8_t Threshold)
+{
+	int BytesPerPixel = AsepriteBytesPerPixel(ColorDepth);
+	int RunStart = CelX;
+	while (RunStart < MaxX)
+	{
+		int RunEnd = RunStart + AsepriteGetRunLength(Run);
+		if (AsepriteMaskPixelPasses(Run + ASEPRITE_RUN_HEADER_SIZE, ColorDepth, PassTable, Threshold))
+		{
+			int From = AsepriteMaxInt(RunStart, MinX);
+			int To = AsepriteMinInt(RunEnd, MaxX);
+			if (From < To)
+				AsepriteSetMaskBitRange(Row, From, To);
+		}
+		RunStart = RunEnd;
+		Run += ASEPRITE_RUN_HEADER_SIZE + BytesPerPixel;
+	}
+}
+
+void
+AsepriteMaskRowGrayscale(uint64_t *Row, int DestBit, uint8_t *Source, int Count, uint8_t Threshold)
+{
+	for (int X = 0; X < Count; X++)
+	{
+		if (Source[X*2 + 1] > Threshold)
+			AsepriteOrMaskBits(Row, DestBit + X, 1, 1);
+	}
+}
+
+void
+AsepriteMaskRowPixels(uint64_t *Row, int DestBit, uint8_t *Source, int Count, uint16_t ColorDepth, bool *PassTable, int TransparentIndex, uint8_t Threshold)
+{
+	switch (ColorDepth)
+	{
+		case 8: AsepriteMaskRowIndexed(Row, DestBit, Source, Count, PassTable, TransparentIndex); break;
+		case 16: AsepriteMaskRowGrayscale(Row, DestBit, Source, Count, Threshold); break;
+		case 32: AsepriteMaskRowRGBA(Row, DestBit, Source, Count, Threshold); break;
+	}
+}
+
+// Sets the bits of the canvas columns [MinX, MaxX) from row CelRow of a tiled
+// cel at canvas column CelX.  Empty tiles are skipped and uniform tiles set
+// their whole span or nothing.
+
+void
+AsepriteMaskTiledRow(uint64_t *Row, aseprite_layer *Layer, int CelRow, int CelX, int MinX, int MaxX, uint16_t ColorDepth, bool *PassTable, int TransparentIndex, uint8_t Threshold)
+{
+	int BytesPerPixel = AsepriteBytesPerPixel(ColorDepth);
+	int Shift = AsepriteGetCelTileShift(Layer);
+	int TileY = CelRow >> Shift;
+	int V = CelRow - (TileY << Shift);
+	for (int X = MinX; X < MaxX;)
+	{
+		int TileX = (X - CelX) >> Shift;
+		int TileWidth = AsepriteGetTileSpan(Layer->DataWidth, Shift, TileX);
+		int U = (X - CelX) - (TileX << Shift);
+		int Count = AsepriteMinInt(TileWidth - U, MaxX - X);
+		bool Uniform;
+		uint8_t *Tile = AsepriteGetCelTile(Layer, Shift, TileX, TileY, &Uniform);
+		if (Tile && Uniform)
+		{
+			if (AsepriteMaskPixelPasses(Tile, ColorDepth, PassTable, Threshold))
+				AsepriteSetMaskBitRange(Row, X, X + Count);
+		}
+		else if (Tile)
+		{
+			uint8_t *Source = Tile + ((size_t)V*TileWidth + U)*BytesPerPixel;
+			AsepriteMaskRowPixels(Row, X, Source, Count, ColorDepth, PassTable, TransparentIndex, Threshold);
+		}
+		X += Count;
+	}
+}
+
+// Scratch needed by AsepriteGetFrameAlphaMaskEx: the mask bits and then either
+// one expanded tilemap row or the stream of the widest cel that was kept
+// compressed.
+
+size_t
+AsepriteMaskScratchSize(aseprite_file *File)
+{
+	int Width = File->Header.WidthInPixels;
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	size_t WordsPerRow = (Width + 63) / 64;
+	size_t LayerSize = (size_t)Width*BytesPerPixel;
+	for (int FrameIndex = 0; FrameIndex < File->NumFrames; FrameIndex++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameIndex;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			aseprite_layer *Layer = Frame->Layers + LayerIndex;
+			if (Layer->CompressedData)
+				LayerSize = AsepriteMaxSize(LayerSize, AsepriteScratchRound(sizeof(aseprite_cel_stream)) + TINFL_LZ_DICT_SIZE +
+												   (size_t)Layer->DataWidth*BytesPerPixel);
+		}
+	}
+	return ASEPRITE_SCRATCH_ALIGN + AsepriteScratchRound(WordsPerRow*File->Header.HeightInPixels*sizeof(uint64_t)) + LayerSize;
+}
+
+// Builds the alpha mask of one frame straight from the decoded cel data.  Cels
+// that were kept compressed are inflated a row at a time through a 32KB
+// window, as AsepriteStreamFrameRGBA does.  Pass
+// a LayerIndex of -1 to combine every visible layer, otherwise only that layer
+// is used (whether it is visible or not).  A pixel is set when its alpha is
+// greater than Threshold; the layer opacity is not taken into account.
+// When Scratch is given the mask bits live in it (AsepriteMaskScratchSize
+// bytes) and stay there after the call, so don't call AsepriteFreeMask on the
+// result; it is valid until the scratch is reused.  Otherwise Mask->Bits is
+// allocated here, release it with AsepriteFreeMask.  Returns false, with no
+// mask, if memory runs out or the scratch is too small.
+
+bool
+AsepriteGetFrameAlphaMaskEx(aseprite_file *File, int FrameNumber, int LayerIndex, uint8_t Threshold, aseprite_mask *Mask, aseprite_scratch *Scratch)
+{
+	Assert(FrameNumber < File->NumFrames);
+	Assert(LayerIndex < File->NumLayers);
+
+	int Width = File->Header.WidthInPixels;
+	int Height = File->Header.HeightInPixels;
+	Mask->Width = Width;
+	Mask->Height = Height;
+	Mask->WordsPerRow = (Width + 63) / 64;
+	size_t BitsSize = (size_t)Mask->WordsPerRow*Height*sizeof(uint64_t);
+	size_t BitsMark = Scratch ? Scratch->Used : 0;
+	Mask->Bits = (uint64_t *)AsepriteScratchAlloc(Scratch, BitsSize);
+	if (!Mask->Bits)
+		return false;
+	memset(Mask->Bits, 0, BitsSize);
+	size_t ScratchMark = Scratch ? Scratch->Used : 0;
+
+	aseprite_frame *Frame = File->Frames + FrameNumber;
+	uint16_t ColorDepth = File->Header.ColorDepth;
+	int BytesPerPixel = AsepriteBytesPerPixel(ColorDepth);
+
+	bool PassTable[256] = {0};
+	int TransparentIndex = File->Header.TransparentPaletteEntry;
+	if (ColorDepth == 8)
+	{
+		for (int ColorIndex = 0; ColorIndex < 256; ColorIndex++)
+		{
+			if (ColorIndex == File->Header.TransparentPaletteEntry || ColorIndex >= File->Palette.NumColors)
+				continue;
+			PassTable[ColorIndex] = (File->Palette.Colors[ColorIndex].A8 > Threshold);
+			if (!PassTable[ColorIndex])
+				TransparentIndex = -1;
+		}
+	}
+
+	int FirstLayer = (LayerIndex < 0) ? 0 : LayerIndex;
+	int EndLayer = (LayerIndex < 0) ? File->NumLayers : LayerIndex + 1;
+	for (int Index = FirstLayer; Index < EndLayer && Index < Frame->NumLayers; Index++)
+	{
+		aseprite_layer_info *LayerInfo = File->LayerInfo + Index;
+		if (LayerIndex < 0 && (LayerInfo->Header.Opacity == 0 || (LayerInfo->Header.Flags & AsepriteLayerFlags_Visible) == 0))
+			continue;
+
+		aseprite_layer *Layer = Frame->Layers + Index;
+		if ((!Layer->Data && !Layer->CompressedData) || Layer->Stats.IsEmpty)
+			continue;
+
+		int CelX = Layer->Header.XPos;
+		int CelY = Layer->Header.YPos;
+		int MinX = AsepriteMaxInt(0, CelX + Layer->Stats.MinX);
+		int MinY = AsepriteMaxInt(0, CelY + Layer->Stats.MinY);
+		int MaxX = AsepriteMinInt(Width, CelX + Layer->Stats.MaxX);
+		int MaxY = AsepriteMinInt(Height, CelY + Layer->Stats.MaxY);
+		if (MinX >= MaxX || MinY >= MaxY)
+			continue;
+
+		//Opaque cels pass any threshold below 255 without looking at the pixels
+		bool FillRows = (Layer->Stats.IsOpaque && Threshold < 255 && ColorDepth != 8);
+
+		//Tilemap rows are expanded into a temporary row first and kept cels are
+		//streamed, runs and tiles are read as is
+		bool IsTilemap = (Layer->Header.CelType == AsepriteCelType_CompressedTilemap);
+		bool IsKept = (!Layer->Data && !FillRows);
+		uint8_t *LayerMemory = 0;
+		aseprite_cel_stream *Stream = 0;
+		if ((IsTilemap && !FillRows) || IsKept)
+		{
+			size_t LayerSize = (size_t)(MaxX - MinX)*BytesPerPixel;
+			if (IsKept)
+				LayerSize = AsepriteScratchRound(sizeof(aseprite_cel_stream)) + TINFL_LZ_DICT_SIZE + (size_t)Layer->DataWidth*BytesPerPixel;
+			LayerMemory = (uint8_t *)AsepriteScratchAlloc(Scratch, LayerSize);
+			if (!LayerMemory)
+			{
+				//A mask missing a layer would be wrong, so there is none
+				AsepriteScratchFree(Scratch, Mask->Bits);
+				Mask->Bits = 0;
+				if (Scratch)
+					Scratch->Used = BitsMark;
+				return false;
+			}
+			if (IsKept)
+			{
+				Stream = (aseprite_cel_stream *)LayerMemory;
+				uint8_t *Window = LayerMemory + AsepriteScratchRound(sizeof(aseprite_cel_stream));
+				AsepriteBeginCelStream(Stream, Layer, BytesPerPixel, Window, Window + TINFL_LZ_DICT_SIZE);
+			}
+		}
+
+		int DataPitch = Layer->DataWidth*BytesPerPixel;
+		for (int Y = MinY; Y < MaxY; Y++)
+		{
+			uint64_t *Row = Mask->Bits + (size_t)Y*Mask->WordsPerRow;
+			if (FillRows)
+			{
+				AsepriteSetMaskBitRange(Row, MinX, MaxX);
+				continue;
+			}
+
+			if (Layer->IsRunLength)
+			{
+				AsepriteMaskRunRow(Row, AsepriteGetCelRunRow(Layer, Y - CelY), CelX, MinX, MaxX, ColorDepth, PassTable, Threshold);
+				continue;
+			}
+			if (Layer->IsTiled)
+			{
+				AsepriteMaskTiledRow(Row, Layer, Y - CelY, CelX, MinX, MaxX, ColorDepth, PassTable, TransparentIndex, Threshold);
+				continue;
+			}
+
+			uint8_t *Source = LayerMemory;
+			if (Stream)
+			{
+				//Rows above the canvas still have to be decoded to get past them
+				while (Stream->NextRow <= Y - CelY)
+					AsepriteStreamNextRow(Stream);
+				Source = Stream->Row + (MinX - CelX)*BytesPerPixel;
+			}
+			else if (IsTilemap)
+				AsepriteExpandTilemapRow(File, Layer, Y - CelY, MinX - CelX, MaxX - MinX, LayerMemory);
+			else
+				Source = (uint8_t *)Layer->Data + (Y - CelY)*DataPitch + (MinX - CelX)*BytesPerPixel;
+			AsepriteMaskRowPixels(Row, MinX, Source, MaxX - MinX, ColorDepth, PassTable, TransparentIndex, Threshold);
+		}
+		if (LayerMemory)
+			AsepriteScratchFree(Scratch, LayerMemory);
+		if (Scratch)
+			Scratch->Used = ScratchMark;
+	}
+
+	return true;
+}
+
+bool
+AsepriteGetFrameAlphaMask(aseprite_file *File, int FrameNumber, int LayerIndex, uint8_t Threshold, aseprite_mask *Mask)
+{
+	return AsepriteGetFrameAlphaMaskEx(File, FrameNumber, LayerIndex, Threshold, Mask, 0);
+}
+
+void
+AsepriteFreeMask(aseprite_mask *Mask)
+{
+	free(Mask->Bits);
+	Mask->Bits = 0;
+}
+
+// Returns the 64 bits of a mask row starting at bit index Bit (which may be
+// negative or past the end), with anything outside of the row reading as clear.
+
+inline uint64_t
+AsepriteMaskWordAt(uint64_t *Row, int WordsPerRow, int Bit)
+{
+	int Word = (Bit >= 0) ? (Bit / 64) : -((63 - Bit) / 64);
+	int Shift = Bit - Word*64;
+	uint64_t Low = (Word >= 0 && Word < WordsPerRow) ? Row[Word] : 0;
+	uint64_t High = (Word + 1 >= 0 && Word + 1 < WordsPerRow) ? Row[Word + 1] : 0;
+	uint64_t Result = Low;
+	if (Shift)
+		Result = (Low >> Shift) | (High << (64 - Shift));
+	return Result;
+}
+
+// Counts the pixels set in both masks with mask A placed at (AX, AY) and mask B
+// at (BX, BY).  Stops at the first overlapping word if StopAtFirst is set.
+
+int
+AsepriteMaskOverlapCountInternal(aseprite_mask *A, int AX, int AY, aseprite_mask *B, int BX, int BY, bool StopAtFirst)
+{
+	//Overlapping rectangle, in A's coordinates
+	int MinX = AsepriteMaxInt(0, BX - AX);
+	int MinY = AsepriteMaxInt(0, BY - AY);
+	int MaxX = AsepriteMinInt(A->Width, BX + B->Width - AX);
+	int MaxY = AsepriteMinInt(A->Height, BY + B->Height - AY);
+	if (MinX >= MaxX || MinY >= MaxY)
+		return 0;
+
+	int Result = 0;
+	int FirstWord = MinX / 64;
+	int EndWord = (MaxX + 63) / 64;
+	for (int Y = MinY; Y < MaxY; Y++)
+	{
+		uint64_t *RowA = A->Bits + (size_t)Y*A->WordsPerRow;
+		uint64_t *RowB = B->Bits + (size_t)(Y + AY - BY)*B->WordsPerRow;
+		for (int Word = FirstWord; Word < EndWord; Word++)
+		{
+			uint64_t Both = RowA[Word] & AsepriteMaskWordAt(RowB, B->WordsPerRow, Word*64 + AX - BX);
+			if (Both)
+			{
+				if (StopAtFirst)
+					return 1;
+				Result += AsepritePopCount64(Both);
+			}
+		}
+	}
+	return Result;
+}
+
+bool
+AsepriteMasksOverlap(aseprite_mask *A, int AX, int AY, aseprite_mask *B, int BX, int BY)
+{
+	return AsepriteMaskOverlapCountInternal(A, AX, AY, B, BX, BY, true) != 0;
+}
+
+int
+AsepriteMaskOverlapCount(aseprite_mask *A, int AX, int AY, aseprite_mask *B, int BX, int BY)
+{
+	return AsepriteMaskOverlapCountInternal(A, AX, AY, B, BX, BY, false);
+}
+
+/*
+ * Asynchronous loading
+ *
+ * AsepriteLoadAsync reads (or takes) the file data, parses and inflates it
+ * off the calling thread, then hands the result to a callback on that same
+ * worker.  The work runs on the caller's executor if one is given, otherwise
+ * on a thread of its own.  The returned handle can cancel the load, and must
+ * be released with AsepriteReleaseLoad whether or not the load has finished.
+ */
+
+typedef void aseprite_task_proc(void *Data);
+
+// Lets the caller run the library's background work on their own job system.
+// Submit must eventually call Proc(Data) exactly once, on any thread, or return
+// false if the task couldn't be queued (and then never call it).
+
+struct aseprite_executor
+{
+	bool (*Submit)(aseprite_executor *Executor, aseprite_task_proc *Proc, void *Data);
+	void *UserData;
+};
+
+struct aseprite_thread_start
+{
+	aseprite_task_proc *Proc;
+	void *Data;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI
+AsepriteThreadEntry(LPVOID Param)
+#else
+static void *
+AsepriteThreadEntry(void *Param)
+#endif
+{
+	aseprite_thread_start Start = *((aseprite_thread_start *)Param);
+	free(Param);
+	Start.Proc(Start.Data);
+	return 0;
+}
+
+#ifdef _WIN32
+typedef HANDLE aseprite_thread;
+#else
+typedef pthread_t aseprite_thread;
+#endif
+
+bool
+AsepriteStartThread(aseprite_thread *Thread, aseprite_task_proc *Proc, void *Data)
+{
+	aseprite_thread_start *Start = (aseprite_thread_start *)malloc(sizeof(aseprite_thread_start));
+	if (!Start)
+		return false;
+	Start->Proc = Proc;
+	Start->Data = Data;
+#ifdef _WIN32
+	*Thread = CreateThread(0, 0, AsepriteThreadEntry, Start, 0, 0);
+	if (!*Thread)
+	{
+		free(Start);
+		return false;
+	}
+#else
+	if (pthread_create(Thread, 0, AsepriteThreadEntry, Start) != 0)
+	{
+		free(Start);
+		return false;
+	}
+#endif
+	return true;
+}
+
+void
+AsepriteJoinThread(aseprite_thread Thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(Thread, INFINITE);
+	CloseHandle(Thread);
+#else
+	pthread_join(Thread, 0);
+#endif
+}
+
+bool
+AsepriteStartDetachedThread(aseprite_task_proc *Proc, void *Data)
+{
+	aseprite_thread Thread;
+	if (!AsepriteStartThread(&Thread, Proc, Data))
+		return false;
+#ifdef _WIN32
+	CloseHandle(Thread);
+#else
+	pthread_detach(Thread);
+#endif
+	return true;
+}
+
+int
+AsepriteCountCPUs()
+{
+#ifdef _WIN32
+	SYSTEM_INFO Info;
+	GetSystemInfo(&Info);
+	int Count = (int)Info.dwNumberOfProcessors;
+#else
+	int Count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return (Count > 0) ? Count : 1;
+}
+
+enum aseprite_load_status
+{
+	AsepriteLoadStatus_Done,
+	AsepriteLoadStatus_Cancelled,
+	AsepriteLoadStatus_ReadFailed,
+	AsepriteLoadStatus_ParseFailed,
+};
+
+// Either Path is read from disk, or FileData/FileSize is parsed (and must stay
+// valid until the callback runs).  MaxFrames works as in
+// aseprite_parse_options.  Executor may be 0.
+
+struct aseprite_load_request
+{
+	const char *Path;
+	void *FileData;
+	size_t FileSize;
+	int MaxFrames;
+	aseprite_executor *Executor;
+	void *UserData;
+};
+
+// The callback owns File when Status is AsepriteLoadStatus_Done and must free
+// it with AsepriteFreeFile.  File is empty for every other status.  The
+// callback is called exactly once per load, cancelled or not.
+
+struct aseprite_load_result
+{
+	aseprite_load_status Status;
+	aseprite_file File;
+	void *UserData;
+};
+
+typedef void aseprite_load_callback(aseprite_load_result *Result);
+
+struct aseprite_load
+{
+	volatile int32_t RefCount;
+	volatile int32_t Cancel;
+	aseprite_load_request Request;
+	char *Path;
+	aseprite_load_callback *Callback;
+};
+
+void
+AsepriteReleaseLoad(aseprite_load *Load)
+{
+	if (AsepriteAtomicAdd(&Load->RefCount, -1) == 0)
+	{
+		free(Load->Path);
+		free(Load);
+	}
+}
+
+// Asks a load to stop.  The parse checks between chunks, so this returns
+// right away and the callback follows with AsepriteLoadStatus_Cancelled
+// (unless the load already got past the point of no return).
+
+void
+AsepriteCancelLoad(aseprite_load *Load)
+{
+	AsepriteAtomicStore(&Load->Cancel, 1);
+}
+
+void *
+AsepriteReadEntireFile(const char *Path, size_t *Size, volatile int32_t *Cancel)
+{
+	FILE *Handle = fopen(Path, "rb");
+	if (!Handle)
+		return 0;
+
+	void *Result = 0;
+	if (fseek(Handle, 0, SEEK_END) == 0)
+	{
+		long Length = ftell(Handle);
+		if (Length > 0 && fseek(Handle, 0, SEEK_SET) == 0)
+		{
+			Result = malloc(Length);
+			//Read in pieces so a cancel doesn't have to wait for a large file
+			size_t Read = 0;
+			while (Result && Read < (size_t)Length)
+			{
+				size_t Piece = (size_t)Length - Read;
+				if (Piece > (1 << 20))
+					Piece = 1 << 20;
+				if ((Cancel && AsepriteAtomicLoad(Cancel)) || fread((char *)Result + Read, 1, Piece, Handle) != Piece)
+				{
+					free(Result);
+					Result = 0;
+					break;
+				}
+				Read += Piece;
+			}
+			*Size = Read;
+		}
+	}
+	fclose(Handle);
+	return Result;
+}
+
+void
+AsepriteLoadTask(void *Data)
+{
+	aseprite_load *Load = (aseprite_load *)Data;
+	aseprite_load_result Result = {};
+	Result.UserData = Load->Request.UserData;
+	Result.Status = AsepriteLoadStatus_Done;
+
+	void *FileData = Load->Request.FileData;
+	size_t FileSize = Load->Request.FileSize;
+	if (!AsepriteAtomicLoad(&Load->Cancel) && Load->Path)
+	{
+		FileData = AsepriteReadEntireFile(Load->Path, &FileSize, &Load->Cancel);
+		if (!FileData)
+			Result.Status = AsepriteLoadStatus_ReadFailed;
+	}
+
+	if (Result.Status == AsepriteLoadStatus_Done && !AsepriteAtomicLoad(&Load->Cancel))
+	{
+		if (FileSize < ASEPRITE_HEADER_SIZE || AsepriteReadHeader(FileData).MagicNumber != 0xA5E0)
+		{
+			Result.Status = AsepriteLoadStatus_ParseFailed;
+		}
+		else
+		{
+			aseprite_parse_options Options = {0};
+			Options.FileSize = FileSize;
+			Options.MaxFrames = Load->Request.MaxFrames;
+			Options.Cancel = &Load->Cancel;
+			Result.File = AsepriteParseFileEx(FileData, &Options);
+			if (Result.File.NumFrames == 0)
+				Result.Status = AsepriteLoadStatus_ParseFailed;
+		}
+	}
+	if (Load->Path)
+		free(FileData);
+
+	if (AsepriteAtomicLoad(&Load->Cancel))
+		Result.Status = AsepriteLoadStatus_Cancelled;
+	if (Result.Status != AsepriteLoadStatus_Done)
+		AsepriteFreeFile(&Result.File);
+
+	Load->Callback(&Result);
+	AsepriteReleaseLoad(Load);
+}
+
+// Starts loading a file in the background.  Returns 0 (without calling the
+// callback) if the work couldn't be started.
+
+aseprite_load *
+AsepriteLoadAsync(aseprite_load_request *Request, aseprite_load_callback *Callback)
+{
+	aseprite_load *Load = (aseprite_load *)calloc(1, sizeof(aseprite_load));
+	if (!Load)
+		return 0;
+
+	Load->RefCount = 2;
+	Load->Request = *Request;
+	Load->Callback = Callback;
+	if (Request->Path)
+	{
+		size_t Length = strlen(Request->Path);
+		Load->Path = (char *)malloc(Length + 1);
+		if (!Load->Path)
+		{
+			free(Load);
+			return 0;
+		}
+		memcpy(Load->Path, Request->Path, Length + 1);
+	}
+
+	bool Started = Request->Executor ? Request->Executor->Submit(Request->Executor, AsepriteLoadTask, Load) :
+									   AsepriteStartDetachedThread(AsepriteLoadTask, Load);
+	if (!Started)
+	{
+		free(Load->Path);
+		free(Load);
+		Load = 0;
+	}
+	return Load;
+}
+
+/*
+ * Rendering every frame at once
+ *
+ * Frames don't depend on each other and the cels are only read, so
+ * AsepriteRenderAllFrames hands frames out to worker threads one at a time.
+ * The calling thread works too.  Each worker gets its own scratch, which is
+ * only needed when cels were kept compressed.
+ */
+
+struct aseprite_render_all_job
+{
+	aseprite_file *File;
+	void **Outputs;
+	bool Stream;
+	volatile int32_t NextFrame;
+};
+
+struct aseprite_render_worker
+{
+	aseprite_render_all_job *Job;
+	aseprite_render_options Options;
+	aseprite_scratch Scratch;
+	aseprite_thread Thread;
+	bool Started;
+};
+
+static void
+AsepriteRenderWorker(void *Data)
+{
+	aseprite_render_worker *Worker = (aseprite_render_worker *)Data;
+	aseprite_render_all_job *Job = Worker->Job;
+	aseprite_file *File = Job->File;
+	int Width = File->Header.WidthInPixels;
+	int Height = File->Header.HeightInPixels;
+	for (;;)
+	{
+		int FrameNumber = AsepriteAtomicAdd(&Job->NextFrame, 1) - 1;
+		if (FrameNumber >= File->NumFrames)
+			break;
+		if (Job->Stream)
+			AsepriteStreamFrameRGBA(File, FrameNumber, Job->Outputs[FrameNumber], Width, Height, 0, 0, &Worker->Options);
+		else
+			AsepriteGetEntireFrameRGBAEx(File, FrameNumber, Job->Outputs[FrameNumber], Width, Height, 0, 0, &Worker->Options);
+	}
+}
+
+// Composites every frame of File into Outputs[FrameNumber], each of which must
+// hold Header.WidthInPixels*Header.HeightInPixels RGBA pixels.  Options may be
+// 0; if it has a Scratch, the workers' scratch is taken from it (and fewer
+// workers are used if it is too small for all of them).  Returns false if
+// nothing could be rendered.
+
+bool
+AsepriteRenderAllFrames(aseprite_file *File, void **Outputs, aseprite_render_options *Options)
+{
+	if (File->NumFrames == 0)
+		return true;
+
+	aseprite_render_all_job Job;
+	Job.File = File;
+	Job.Outputs = Outputs;
+	Job.Stream = false;
+	Job.NextFrame = 0;
+
+	size_t ScratchSize = 0;
+	for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameNumber;
+		bool HasKeptCels = false;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+			HasKeptCels |= (Frame->Layers[LayerIndex].CompressedData != 0);
+		if (HasKeptCels)
+		{
+			Job.Stream = true;
+			size_t FrameScratchSize = AsepriteStreamFrameScratchSize(File, FrameNumber);
+			if (FrameScratchSize > ScratchSize)
+				ScratchSize = FrameScratchSize;
+		}
+	}
+
+	int NumThreads = (Options && Options->NumThreads > 0) ? Options->NumThreads : AsepriteCountCPUs();
+	NumThreads = AsepriteMinInt(NumThreads, File->NumFrames);
+
+	//The color tables are filled in on first use, which isn't safe to race on
+	if (Options && (Options->Flags & AsepriteRenderFlags_LinearLight))
+		AsepriteInitColorTables();
+
+	aseprite_render_worker *Workers = (aseprite_render_worker *)calloc(NumThreads, sizeof(aseprite_render_worker));
+	if (!Workers)
+		return false;
+
+	aseprite_scratch *SharedScratch = Options ? Options->Scratch : 0;
+	size_t SharedMark = SharedScratch ? SharedScratch->Used : 0;
+	int NumWorkers = 0;
+	for (; NumWorkers < NumThreads; NumWorkers++)
+	{
+		aseprite_render_worker *Worker = Workers + NumWorkers;
+		Worker->Job = &Job;
+		if (Options)
+			Worker->Options = *Options;
+		Worker->Options.Scratch = 0;
+		if (Job.Stream)
+		{
+			void *Memory = AsepriteScratchAlloc(SharedScratch, ScratchSize);
+			if (!Memory)
+				break;
+			Worker->Scratch.Base = Memory;
+			Worker->Scratch.Size = ScratchSize;
+			Worker->Options.Scratch = &Worker->Scratch;
+		}
+	}
+	if (NumWorkers == 0)
+	{
+		free(Workers);
+		return false;
+	}
+
+	for (int WorkerIndex = 1; WorkerIndex < NumWorkers; WorkerIndex++)
+		Workers[WorkerIndex].Started = AsepriteStartThread(&Workers[WorkerIndex].Thread, AsepriteRenderWorker, Workers + WorkerIndex);
+	AsepriteRenderWorker(Workers);
+	for (int WorkerIndex = 1; WorkerIndex < NumWorkers; WorkerIndex++)
+	{
+		if (Workers[WorkerIndex].Started)
+			AsepriteJoinThread(Workers[WorkerIndex].Thread);
+	}
+
+	for (int WorkerIndex = 0; WorkerIndex < NumWorkers; WorkerIndex++)
+	{
+		if (Workers[WorkerIndex].Scratch.Base)
+			AsepriteScratchFree(SharedScratch, Workers[WorkerIndex].Scratch.Base);
+	}
+	if (SharedScratch)
+		SharedScratch->Used = SharedMark;
+	free(Workers);
+	return true;
+}
+
+/*
+ * Batch export pipeline
+ *
+ * AsepriteRunBatch loads and renders many files at once.  Every file goes
+ * through the stages read -> chunk walk -> inflate (a task per cel) ->
+ * composite (a task per frame) -> encode (the caller's EncodeFrame, a task per
+ * frame) -> finish (the caller's FinishFile, where the frames can be packed).
+ * A task is queued as soon as the tasks it depends on are done, so the stages
+ * of different files interleave and one large file doesn't hold up the rest.
+ *
+ * The tasks run on a work-stealing pool: each worker pushes and pops at the
+ * back of its own deque, and steals from the front of the other workers'
+ * deques when its own is empty.
+ */
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION aseprite_mutex;
+typedef CONDITION_VARIABLE aseprite_cond;
+#else
+typedef pthread_mutex_t aseprite_mutex;
+typedef pthread_cond_t aseprite_cond;
+#endif
+
+void
+AsepriteInitMutex(aseprite_mutex *Mutex)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(Mutex);
+#else
+	pthread_mutex_init(Mutex, 0);
+#endif
+}
+
+void
+AsepriteDestroyMutex(aseprite_mutex *Mutex)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(Mutex);
+#else
+	pthread_mutex_destroy(Mutex);
+#endif
+}
+
+void
+AsepriteLock(aseprite_mutex *Mutex)
+{
+#ifdef _WIN32
+	EnterCriticalSection(Mutex);
+#else
+	pthread_mutex_lock(Mutex);
+#endif
+}
+
+void
+AsepriteUnlock(aseprite_mutex *Mutex)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(Mutex);
+#else
+	pthread_mutex_unlock(Mutex);
+#endif
+}
+
+void
+AsepriteInitCond(aseprite_cond *Cond)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(Cond);
+#else
+	pthread_cond_init(Cond, 0);
+#endif
+}
+
+void
+AsepriteDestroyCond(aseprite_cond *Cond)
+{
+#ifndef _WIN32
+	pthread_cond_destroy(Cond);
+#endif
+}
+
+void
+AsepriteWaitCond(aseprite_cond *Cond, aseprite_mutex *Mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableCS(Cond, Mutex, INFINITE);
+#else
+	pthread_cond_wait(Cond, Mutex);
+#endif
+}
+
+void
+AsepriteWakeOne(aseprite_cond *Cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable(Cond);
+#else
+	pthread_cond_signal(Cond);
+#endif
+}
+
+void
+AsepriteWakeAll(aseprite_cond *Cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(Cond);
+#else
+	pthread_cond_broadcast(Cond);
+#endif
+}
+
+struct aseprite_pool;
+struct aseprite_pool_worker;
+
+typedef void aseprite_pool_task_proc(aseprite_pool_worker *Worker, void *Data);
+
+struct aseprite_pool_task
+{
+	aseprite_pool_task_proc *Proc;
+	void *Data;
+};
+
+// Ring buffer of tasks.  The owning worker uses the back, thieves the front.
+
+struct aseprite_task_deque
+{
+	aseprite_mutex Lock;
+	aseprite_pool_task *Tasks;
+	int Capacity;
+	int Front;
+	int Count;
+};
+
+struct aseprite_pool_worker
+{
+	aseprite_pool *Pool;
+	int Index;
+	aseprite_task_deque Deque;
+	aseprite_thread Thread;
+	bool Started;
+};
+
+struct aseprite_pool
+{
+	aseprite_pool_worker *Workers;
+	int NumWorkers;
+	//Tasks sitting in deques, so idle workers know when to wake
+	volatile int32_t Queued;
+	aseprite_mutex Lock;
+	aseprite_cond Wake;
+	bool Stop;
+};
+
+bool
+AsepritePushTask(aseprite_task_deque *Deque, aseprite_pool_task Task)
+{
+	AsepriteLock(&Deque->Lock);
+	if (Deque->Count == Deque->Capacity)
+	{
+		int NewCapacity = Deque->Capacity ? Deque->Capacity*2 : 64;
+		aseprite_pool_task *Tasks = (aseprite_pool_task *)malloc(NewCapacity*sizeof(aseprite_pool_task));
+		if (!Tasks)
+		{
+			AsepriteUnlock(&Deque->Lock);
+			return false;
+		}
+		for (int TaskIndex = 0; TaskIndex < Deque->Count; TaskIndex++)
+			Tasks[TaskIndex] = Deque->Tasks[(Deque->Front + TaskIndex) % Deque->Capacity];
+		free(Deque->Tasks);
+		Deque->Tasks = Tasks;
+		Deque->Capacity = NewCapacity;
+		Deque->Front = 0;
+	}
+	Deque->Tasks[(Deque->Front + Deque->Count) % Deque->Capacity] = Task;
+	Deque->Count++;
+	AsepriteUnlock(&Deque->Lock);
+	return true;
+}
+
+bool
+AsepritePopTask(aseprite_task_deque *Deque, aseprite_pool_task *Task, bool FromFront)
+{
+	AsepriteLock(&Deque->Lock);
+	bool Found = (Deque->Count > 0);
+	if (Found)
+	{
+		Deque->Count--;
+		if (FromFront)
+		{
+			*Task = Deque->Tasks[Deque->Front];
+			Deque->Front = (Deque->Front + 1) % Deque->Capacity;
+		}
+		else
+		{
+			*Task = Deque->Tasks[(Deque->Front + Deque->Count) % Deque->Capacity];
+		}
+	}
+	AsepriteUnlock(&Deque->Lock);
+	return Found;
+}
+
+// Queues a task on the worker's own deque.  If the deque can't grow the task
+// runs right away instead.
+
+void
+AsepritePoolPush(aseprite_pool_worker *Worker, aseprite_pool_task_proc *Proc, void *Data)
+{
+	aseprite_pool_task Task = {Proc, Data};
+	if (!AsepritePushTask(&Worker->Deque, Task))
+	{
+		Proc(Worker, Data);
+		return;
+	}
+	aseprite_pool *Pool = Worker->Pool;
+	AsepriteLock(&Pool->Lock);
+	AsepriteAtomicAdd(&Pool->Queued, 1);
+	AsepriteWakeOne(&Pool->Wake);
+	AsepriteUnlock(&Pool->Lock);
+}
+
+// Makes the workers return once the deques are empty.
+
+void
+AsepritePoolStop(aseprite_pool *Pool)
+{
+	AsepriteLock(&Pool->Lock);
+	Pool->Stop = true;
+	AsepriteWakeAll(&Pool->Wake);
+	AsepriteUnlock(&Pool->Lock);
+}
+
+void
+AsepritePoolWork(void *Data)
+{
+	aseprite_pool_worker *Worker = (aseprite_pool_worker *)Data;
+	aseprite_pool *Pool = Worker->Pool;
+	for (;;)
+	{
+		aseprite_pool_task Task;
+		bool Found = AsepritePopTask(&Worker->Deque, &Task, false);
+		for (int Offset = 1; !Found && Offset < Pool->NumWorkers; Offset++)
+			Found = AsepritePopTask(&Pool->Workers[(Worker->Index + Offset) % Pool->NumWorkers].Deque, &Task, true);
+		if (Found)
+		{
+			AsepriteAtomicAdd(&Pool->Queued, -1);
+			Task.Proc(Worker, Task.Data);
+			continue;
+		}
+
+		AsepriteLock(&Pool->Lock);
+		while (AsepriteAtomicLoad(&Pool->Queued) <= 0 && !Pool->Stop)
+			AsepriteWaitCond(&Pool->Wake, &Pool->Lock);
+		bool Stop = (Pool->Stop && AsepriteAtomicLoad(&Pool->Queued) <= 0);
+		AsepriteUnlock(&Pool->Lock);
+		if (Stop)
+			break;
+	}
+}
+
+// Runs Start on a pool of NumWorkers workers (the calling thread being one of
+// them) and returns when some task has called AsepritePoolStop and all the
+// queued work is done.
+
+bool
+AsepriteRunPool(aseprite_pool *Pool, int NumWorkers, aseprite_pool_task_proc *Start, void *Data)
+{
+	Pool->Workers = (aseprite_pool_worker *)calloc(NumWorkers, sizeof(aseprite_pool_worker));
+	if (!Pool->Workers)
+		return false;
+	Pool->NumWorkers = NumWorkers;
+	Pool->Queued = 0;
+	Pool->Stop = false;
+	AsepriteInitMutex(&Pool->Lock);
+	AsepriteInitCond(&Pool->Wake);
+	for (int WorkerIndex = 0; WorkerIndex < NumWorkers; WorkerIndex++)
+	{
+		Pool->Workers[WorkerIndex].Pool = Pool;
+		Pool->Workers[WorkerIndex].Index = WorkerIndex;
+		AsepriteInitMutex(&Pool->Workers[WorkerIndex].Deque.Lock);
+	}
+
+	AsepritePoolPush(Pool->Workers, Start, Data);
+	for (int WorkerIndex = 1; WorkerIndex < NumWorkers; WorkerIndex++)
+		Pool->Workers[WorkerIndex].Started = AsepriteStartThread(&Pool->Workers[WorkerIndex].Thread, AsepritePoolWork, Pool->Workers + WorkerIndex);
+	AsepritePoolWork(Pool->Workers);
+
+	for (int WorkerIndex = 1; WorkerIndex < NumWorkers; WorkerIndex++)
+	{
+		if (Pool->Workers[WorkerIndex].Started)
+			AsepriteJoinThread(Pool->Workers[WorkerIndex].Thread);
+	}
+	for (int WorkerIndex = 0; WorkerIndex < NumWorkers; WorkerIndex++)
+	{
+		AsepriteDestroyMutex(&Pool->Workers[WorkerIndex].Deque.Lock);
+		free(Pool->Workers[WorkerIndex].Deque.Tasks);
+	}
+	AsepriteDestroyCond(&Pool->Wake);
+	AsepriteDestroyMutex(&Pool->Lock);
+	free(Pool->Workers);
+	Pool->Workers = 0;
+	return true;
+}
+
+// What the batch callbacks see of one file.  Status is
+// AsepriteLoadStatus_ReadFailed or AsepriteLoadStatus_ParseFailed if the file
+// couldn't be used (including when one of its cels couldn't be inflated), or
+// AsepriteLoadStatus_Cancelled, in which case File is empty and Frames is 0.  Otherwise
+// Frames[FrameNumber] holds Header.WidthInPixels*Header.HeightInPixels RGBA
+// pixels.  Everything is freed after FinishFile returns.
+
+struct aseprite_batch_file
+{
+	int Index;
+	const char *Path;
+	aseprite_load_status Status;
+	aseprite_file File;
+	void **Frames;
+	void *UserData;
+};
+
+typedef void aseprite_batch_frame_proc(aseprite_batch_file *File, int FrameNumber);
+typedef void aseprite_batch_file_proc(aseprite_batch_file *File);
+
+// The callbacks can run on any of the pool's threads, several at once.
+// EncodeFrame may be 0; FinishFile is called exactly once per path, after
+// every frame of the file has been encoded.
+//
+// A new file is only started while the memory held by the files already in
+// flight (file data, cels and frames) is under MemoryBudget, so the budget is
+// soft: a file bigger than the budget still runs, on its own.  0 means no
+// limit.  NumThreads is 0 for one thread per CPU.
+
+struct aseprite_batch_request
+{
+	const char **Paths;
+	int NumPaths;
+	int NumThreads;
+	size_t MemoryBudget;
+	uint32_t RenderFlags;
+	aseprite_batch_frame_proc *EncodeFrame;
+	aseprite_batch_file_proc *FinishFile;
+	void *UserData;
+	//If set, files still being read or parsed once this becomes non-zero, and
+	//every file after them, finish as AsepriteLoadStatus_Cancelled
+	volatile int32_t *Cancel;
+};
+
+struct aseprite_batch;
+struct aseprite_batch_job;
+
+// A frame to composite or encode (LayerIndex -1), or a cel to inflate.  A
+// job's items are its frames followed by its kept cels.
+
+struct aseprite_batch_item
+{
+	aseprite_batch_job *Job;
+	int FrameNumber;
+	int LayerIndex;
+};
+
+struct aseprite_batch_job
+{
+	aseprite_batch *Batch;
+	aseprite_batch_file Result;
+	void *FileData;
+	size_t FileSize;
+	size_t Charged;
+	aseprite_batch_item *Items;
+	volatile int32_t *CelsPending;
+	volatile int32_t FramesPending;
+	volatile int32_t CelsFailed;
+};
+
+struct aseprite_batch
+{
+	aseprite_batch_request *Request;
+	aseprite_batch_job *Jobs;
+	aseprite_pool Pool;
+	aseprite_mutex Lock;
+	int NextPath;
+	int FilesLeft;
+	int Active;
+	//Files that are started but whose memory isn't known yet
+	int Unmeasured;
+	size_t InFlight;
+};
+
+void AsepriteBatchRead(aseprite_pool_worker *Worker, void *Data);
+
+// Starts as many files as the memory budget allows.
+
+void
+AsepriteBatchAdmit(aseprite_pool_worker *Worker, aseprite_batch *Batch)
+{
+	aseprite_batch_request *Request = Batch->Request;
+	for (;;)
+	{
+		int PathIndex = -1;
+		AsepriteLock(&Batch->Lock);
+		bool UnderBudget = (!Request->MemoryBudget || Batch->InFlight < Request->MemoryBudget);
+		if (Batch->NextPath < Request->NumPaths && Batch->Unmeasured < Batch->Pool.NumWorkers &&
+			(UnderBudget || Batch->Active == 0))
+		{
+			PathIndex = Batch->NextPath++;
+			Batch->Unmeasured++;
+			Batch->Active++;
+		}
+		AsepriteUnlock(&Batch->Lock);
+		if (PathIndex < 0)
+			break;
+
+		aseprite_batch_job *Job = Batch->Jobs + PathIndex;
+		Job->Batch = Batch;
+		Job->Result.Index = PathIndex;
+		Job->Result.Path = Request->Paths[PathIndex];
+		Job->Result.Status = AsepriteLoadStatus_Done;
+		Job->Result.UserData = Request->UserData;
+		AsepritePoolPush(Worker, AsepriteBatchRead, Job);
+	}
+}
+
+// Changes what a file holds against the budget.  Measured is set once the
+// file's full size is known.
+
+void
+AsepriteBatchCharge(aseprite_batch_job *Job, size_t Charged, bool Measured)
+{
+	aseprite_batch *Batch = Job->Batch;
+	AsepriteLock(&Batch->Lock);
+	Batch->InFlight = Batch->InFlight - Job->Charged + Charged;
+	Job->Charged = Charged;
+	if (Measured)
+		Batch->Unmeasured--;
+	AsepriteUnlock(&Batch->Lock);
+}
+
+void
+AsepriteBatchFreeResult(aseprite_batch_job *Job)
+{
+	if (Job->Result.Frames)
+	{
+		for (int FrameNumber = 0; FrameNumber < Job->Result.File.NumFrames; FrameNumber++)
+			free(Job->Result.Frames[FrameNumber]);
+		free(Job->Result.Frames);
+		Job->Result.Frames = 0;
+	}
+	AsepriteFreeFile(&Job->Result.File);
+}
+
+void
+AsepriteBatchFinish(aseprite_pool_worker *Worker, void *Data)
+{
+	aseprite_batch_job *Job = (aseprite_batch_job *)Data;
+	aseprite_batch *Batch = Job->Batch;
+	if (AsepriteAtomicLoad(&Job->CelsFailed) && Job->Result.Status == AsepriteLoadStatus_Done)
+		Job->Result.Status = AsepriteLoadStatus_ParseFailed;
+	if (Job->Result.Status != AsepriteLoadStatus_Done)
+		AsepriteBatchFreeResult(Job);
+	if (Batch->Request->FinishFile)
+		Batch->Request->FinishFile(&Job->Result);
+
+	AsepriteBatchFreeResult(Job);
+	free(Job->Items);
+	free((void *)Job->CelsPending);
+
+	AsepriteLock(&Batch->Lock);
+	Batch->InFlight -= Job->Charged;
+	Batch->Active--;
+	bool Done = (--Batch->FilesLeft == 0);
+	AsepriteUnlock(&Batch->Lock);
+	if (Done)
+		AsepritePoolStop(&Batch->Pool);
+	else
+		AsepriteBatchAdmit(Worker, Batch);
+}
+
+void
+AsepriteBatchFrameDone(aseprite_pool_worker *Worker, aseprite_batch_job *Job)
+{
+	if (AsepriteAtomicAdd(&Job->FramesPending, -1) == 0)
+		AsepritePoolPush(Worker, AsepriteBatchFinish, Job);
+}
+
+void
+AsepriteBatchEncode(aseprite_pool_worker *Worker, void *Data)
+{
+	aseprite_batch_item *Item = (aseprite_batch_item *)Data;
+	Item->Job->Batch->Request->EncodeFrame(&Item->Job->Result, Item->FrameNumber);
+	AsepriteBatchFrameDone(Worker, Item->Job);
+}
+
+void
+AsepriteBatchComposite(aseprite_pool_worker *Worker, void *Data)
+{
+	aseprite_batch_item *Item = (aseprite_batch_item *)Data;
+	aseprite_batch_job *Job = Item->Job;
+	aseprite_file *File = &Job->Result.File;
+	//The file is reported as failed, so don't hand out a frame missing cels
+	if (AsepriteAtomicLoad(&Job->CelsFailed))
+	{
+		AsepriteBatchFrameDone(Worker, Job);
+		return;
+	}
+	aseprite_render_options Options = {0};
+	Options.Flags = Job->Batch->Request->RenderFlags;
+	AsepriteGetEntireFrameRGBAEx(File, Item->FrameNumber, Job->Result.Frames[Item->FrameNumber],
+								 File->Header.WidthInPixels, File->Header.HeightInPixels, 0, 0, &Options);
+	if (Job->Batch->Request->EncodeFrame)
+		AsepritePoolPush(Worker, AsepriteBatchEncode, Item);
+	else
+		AsepriteBatchFrameDone(Worker, Job);
+}
+
+void
+AsepriteBatchInflate(aseprite_pool_worker *Worker, void *Data)
+{
+	aseprite_batch_item *Item = (aseprite_batch_item *)Data;
+	aseprite_batch_job *Job = Item->Job;
+	aseprite_frame *Frame = Job->Result.File.Frames + Item->FrameNumber;
+	if (!AsepriteInflateKeptCel(&Job->Result.File, Frame->Layers + Item->LayerIndex))
+		AsepriteAtomicStore(&Job->CelsFailed, 1);
+	if (AsepriteAtomicAdd(&Job->CelsPending[Item->FrameNumber], -1) == 0)
+		AsepritePoolPush(Worker, AsepriteBatchComposite, Job->Items + Item->FrameNumber);
+}
+
+// Walks the chunks with the cels left compressed, then queues a task per cel
+// and lets each frame's composite go once the last of its cels is inflated.
+
+void
+AsepriteBatchWalk(aseprite_pool_worker *Worker, void *Data)
+{
+	aseprite_batch_job *Job = (aseprite_batch_job *)Data;
+	aseprite_file *File = &Job->Result.File;
+	if (Job->FileSize >= ASEPRITE_HEADER_SIZE && AsepriteReadHeader(Job->FileData).MagicNumber == 0xA5E0)
+	{
+		aseprite_parse_options Options = {0};
+		Options.FileSize = Job->FileSize;
+		Options.Flags = AsepriteParseFlags_KeepCompressedCels;
+		Options.Cancel = Job->Batch->Request->Cancel;
+		*File = AsepriteParseFileEx(Job->FileData, &Options);
+	}
+	free(Job->FileData);
+	Job->FileData = 0;
+	volatile int32_t *Cancel = Job->Batch->Request->Cancel;
+	bool Cancelled = (Cancel && AsepriteAtomicLoad(Cancel));
+
+	int NumKept = 0;
+	int BytesPerPixel = AsepriteBytesPerPixel(File->Header.ColorDepth);
+	size_t FrameSize = (size_t)File->Header.WidthInPixels*File->Header.HeightInPixels*4;
+	size_t Charged = FrameSize*File->NumFrames;
+	for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameNumber;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			aseprite_layer *Layer = Frame->Layers + LayerIndex;
+			if (Layer->CompressedData)
+			{
+				NumKept++;
+				Charged += Layer->CompressedSize + (size_t)Layer->DataWidth*Layer->DataHeight*BytesPerPixel;
+			}
+		}
+	}
+
+	bool Ok = (File->NumFrames > 0 && !Cancelled);
+	if (Ok)
+	{
+		Job->Items = (aseprite_batch_item *)malloc((NumKept + File->NumFrames)*sizeof(aseprite_batch_item));
+		Job->CelsPending = (volatile int32_t *)calloc(File->NumFrames, sizeof(int32_t));
+		Job->Result.Frames = (void **)calloc(File->NumFrames, sizeof(void *));
+		Ok = (Job->Items && Job->CelsPending && Job->Result.Frames);
+		for (int FrameNumber = 0; Ok && FrameNumber < File->NumFrames; FrameNumber++)
+		{
+			Job->Result.Frames[FrameNumber] = calloc(FrameSize ? FrameSize : 1, 1);
+			Ok = (Job->Result.Frames[FrameNumber] != 0);
+		}
+	}
+	AsepriteBatchCharge(Job, Ok ? Charged : 0, true);
+	AsepriteBatchAdmit(Worker, Job->Batch);
+	if (!Ok)
+	{
+		Job->Result.Status = Cancelled ? AsepriteLoadStatus_Cancelled : AsepriteLoadStatus_ParseFailed;
+		AsepriteBatchFinish(Worker, Job);
+		return;
+	}
+
+	//All the counts are set before any task is queued, since the tasks can
+	//finish right away on other workers
+	aseprite_batch_item *Frames = Job->Items;
+	aseprite_batch_item *Cels = Job->Items + File->NumFrames;
+	int CelIndex = 0;
+	Job->FramesPending = File->NumFrames;
+	for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+	{
+		aseprite_frame *Frame = File->Frames + FrameNumber;
+		Frames[FrameNumber].Job = Job;
+		Frames[FrameNumber].FrameNumber = FrameNumber;
+		Frames[FrameNumber].LayerIndex = -1;
+		for (int LayerIndex = 0; LayerIndex < Frame->NumLayers; LayerIndex++)
+		{
+			if (Frame->Layers[LayerIndex].CompressedData)
+			{
+				Cels[CelIndex].Job = Job;
+				Cels[CelIndex].FrameNumber = FrameNumber;
+				Cels[CelIndex].LayerIndex = LayerIndex;
+				CelIndex++;
+				Job->CelsPending[FrameNumber]++;
+			}
+		}
+	}
+	for (int FrameNumber = 0; FrameNumber < File->NumFrames; FrameNumber++)
+	{
+		if (Job->CelsPending[FrameNumber] == 0)
+			AsepritePoolPush(Worker, AsepriteBatchComposite, Frames + FrameNumber);
+	}
+	for (CelIndex = 0; CelIndex < NumKept; CelIndex++)
+		AsepritePoolPush(Worker, AsepriteBatchInflate, Cels + CelIndex);
+}
+
+void
+AsepriteBatchRead(aseprite_pool_worker *Worker, void *Data)
+{
+	aseprite_batch_job *Job = (aseprite_batch_job *)Data;
+	volatile int32_t *Cancel = Job->Batch->Request->Cancel;
+	Job->FileData = (Cancel && AsepriteAtomicLoad(Cancel)) ? 0 : AsepriteReadEntireFile(Job->Result.Path, &Job->FileSize, Cancel);
+	if (!Job->FileData)
+	{
+		bool Cancelled = (Cancel && AsepriteAtomicLoad(Cancel));
+		Job->Result.Status = Cancelled ? AsepriteLoadStatus_Cancelled : AsepriteLoadStatus_ReadFailed;
+		AsepriteBatchCharge(Job, 0, true);
+		AsepriteBatchAdmit(Worker, Job->Batch);
+		AsepriteBatchFinish(Worker, Job);
+		return;
+	}
+	AsepriteBatchCharge(Job, Job->FileSize, false);
+	AsepritePoolPush(Worker, AsepriteBatchWalk, Job);
+}
+
+void
+AsepriteBatchStart(aseprite_pool_worker *Worker, void *Data)
+{
+	AsepriteBatchAdmit(Worker, (aseprite_batch *)Data);
+}
+
+// Runs the whole batch and returns when FinishFile has been called for every
+// path.  Returns false (without calling anything) if the batch couldn't start.
+
+bool
+AsepriteRunBatch(aseprite_batch_request *Request)
+{
+	if (Request->NumPaths <= 0)
+		return true;
+
+	aseprite_batch Batch = {};
+	Batch.Request = Request;
+	Batch.FilesLeft = Request->NumPaths;
+	Batch.Jobs = (aseprite_batch_job *)calloc(Request->NumPaths, sizeof(aseprite_batch_job));
+	if (!Batch.Jobs)
+		return false;
+
+	//The color tables are filled in on first use, which isn't safe to race on
+	if (Request->RenderFlags & AsepriteRenderFlags_LinearLight)
+		AsepriteInitColorTables();
+
+	int NumThreads = (Request->NumThreads > 0) ? Request->NumThreads : AsepriteCountCPUs();
+	AsepriteInitMutex(&Batch.Lock);
+	bool Result = AsepriteRunPool(&Batch.Pool, NumThreads, AsepriteBatchStart, &Batch);
+	AsepriteDestroyMutex(&Batch.Lock);
+	free(Batch.Jobs);
+	return Result;
+}
+
+/*
+ * Exporting frames, and the export cache
+ *
+ * AsepriteExportFrame renders one frame the way an exporter writes it out:
+ * some of the layers, scaled up and in a given pixel format.
+ *
+ * The cache keeps such outputs in a directory, one file per output, named by
+ * a hash of the .ase bytes and the export options.  A hit maps the file and
+ * never parses the .ase.  Cache files are in host byte order and meant for
+ * the machine that wrote them.  The hash isn't cryptographic; it only needs
+ * to tell apart the versions of a sprite.
+ */
+
+enum aseprite_export_format
+{
+	AsepriteExportFormat_RGBA8,
+	AsepriteExportFormat_BGRA8,
+	//RGBA with the colors multiplied by alpha
+	AsepriteExportFormat_PremultipliedRGBA8,
+};
+
+// Scale is a whole number upscale (0 and 1 both mean none).  LayerMask and
+// RenderFlags are as in aseprite_render_options.
+
+struct aseprite_export_options
+{
+	int FrameNumber;
+	uint64_t LayerMask;
+	int Scale;
+	aseprite_export_format Format;
+	uint32_t RenderFlags;
+	//Temporary memory for the export, may be 0 (see aseprite_scratch).  Not
+	//part of the cache key.
+	aseprite_scratch *Scratch;
+};
+
+size_t
+AsepriteExportFrameSize(aseprite_file *File, aseprite_export_options *Options, int *Width, int *Height)
+{
+	int Scale = AsepriteMaxInt(Options->Scale, 1);
+	*Width = File->Header.WidthInPixels*Scale;
+	*Height = File->Header.HeightInPixels*Scale;
+	return (size_t)*Width**Height*4;
+}
+
+// Scratch needed by AsepriteExportFrame: an unscaled canvas when scaling.
+
+size_t
+AsepriteExportFrameScratchSize(aseprite_file *File, aseprite_export_options *Options)
+{
+	if (AsepriteMaxInt(Options->Scale, 1) == 1)
+		return 0;
+	return ASEPRITE_SCRATCH_ALIGN + (size_t)File->Header.WidthInPixels*File->Header.HeightInPixels*4;
+}
+
+// Dest must hold AsepriteExportFrameSize bytes.  The working memory comes from
+// Options->Scratch when there is one (AsepriteExportFrameScratchSize bytes);
+// returns false if that is too small.
+
+bool
+AsepriteExportFrame(aseprite_file *File, aseprite_export_options *Options, void *Dest)
+{
+	if (Options->FrameNumber < 0 || Options->FrameNumber >= File->NumFrames)
+		return false;
+
+	int Width = File->Header.WidthInPixels;
+	int Height = File->Header.HeightInPixels;
+	int Scale = AsepriteMaxInt(Options->Scale, 1);
+	aseprite_scratch *Scratch = Options->Scratch;
+	size_t ScratchMark = Scratch ? Scratch->Used : 0;
+	uint8_t *Canvas = (uint8_t *)Dest;
+	if (Scale > 1)
+	{
+		Canvas = (uint8_t *)AsepriteScratchAlloc(Scratch, (size_t)Width*Height*4);
+		if (!Canvas)
+			return false;
+	}
+
+	aseprite_render_options Render = {0};
+	Render.Flags = Options->RenderFlags;
+	Render.LayerMask = Options->LayerMask;
+	AsepriteGetEntireFrameRGBAEx(File, Options->FrameNumber, Canvas, Width, Height, 0, 0, &Render);
+
+	size_t NumPixels = (size_t)Width*Height;
+	switch (Options->Format)
+	{
+		case AsepriteExportFormat_RGBA8:
+		{
+		} break;
+		case AsepriteExportFormat_BGRA8:
+		{
+			for (size_t PixelIndex = 0; PixelIndex < NumPixels; PixelIndex++)
+			{
+				uint8_t *Pixel = Canvas + PixelIndex*4;
+				uint8_t R = Pixel[0];
+				Pixel[0] = Pixel[2];
+				Pixel[2] = R;
+			}
+		} break;
+		case AsepriteExportFormat_PremultipliedRGBA8:
+		{
+			for (size_t PixelIndex = 0; PixelIndex < NumPixels; PixelIndex++)
+			{
+				uint8_t *Pixel = Canvas + PixelIndex*4;
+				for (int Channel = 0; Channel < 3; Channel++)
+					Pixel[Channel] = (uint8_t)((Pixel[Channel]*Pixel[3] + 127)/255);
+			}
+		} break;
+	}
+
+	if (Scale > 1)
+	{
+		//Nearest neighbor: widen each row once, then repeat it
+		int DestPitch = Width*Scale*4;
+		for (int Y = 0; Y < Height; Y++)
+		{
+			uint32_t *Source = (uint32_t *)(Canvas + (size_t)Y*Width*4);
+			uint8_t *Row = (uint8_t *)Dest + (size_t)Y*Scale*DestPitch;
+			uint32_t *Out = (uint32_t *)Row;
+			for (int X = 0; X < Width; X++)
+			{
+				for (int Repeat = 0; Repeat < Scale; Repeat++)
+					*Out++ = Source[X];
+			}
+			for (int Repeat = 1; Repeat < Scale; Repeat++)
+				memcpy(Row + (size_t)Repeat*DestPitch, Row, DestPitch);
+		}
+		AsepriteScratchFree(Scratch, Canvas);
+		if (Scratch)
+			Scratch->Used = ScratchMark;
+	}
+	return true;
+}
+
+struct aseprite_cache_key
+{
+	uint64_t Hash[2];
+};
+
+inline uint64_t
+AsepriteMix64(uint64_t Value)
+{
+	Value ^= Value >> 33;
+	Value *= 0xFF51AFD7ED558CCDull;
+	Value ^= Value >> 33;
+	Value *= 0xC4CEB9FE1A85EC53ull;
+	Value ^= Value >> 33;
+	return Value;
+}
+
+// 128 bit hash of Data, chained from Seed (which may be 0), so several pieces
+// can go into one key.
+
+aseprite_cache_key
+AsepriteHashCacheKey(const void *Data, size_t Size, aseprite_cache_key *Seed)
+{
+	const uint8_t *Bytes = (const uint8_t *)Data;
+	uint64_t A = 0x9E3779B97F4A7C15ull ^ (Seed ? Seed->Hash[0] : 0);
+	uint64_t B = 0xC2B2AE3D27D4EB4Full ^ (Seed ? Seed->Hash[1] : 0) ^ Size;
+	size_t At = 0;
+	for (;; At += 16)
+	{
+		uint64_t Words[2] = {0, 0};
+		size_t Remaining = Size - At;
+		if (Remaining >= 16)
+		{
+			memcpy(Words, Bytes + At, 16);
+		}
+		else
+		{
+			//The tail is zero padded; the size is already in B
+			if (Remaining)
+				memcpy(Words, Bytes + At, Remaining);
+		}
+		A = (A ^ Words[0])*0x87C37B91114253D5ull;
+		A = (A << 31) | (A >> 33);
+		B = (B ^ Words[1])*0x4CF5AD432745937Full;
+		B = (B << 33) | (B >> 31);
+		if (Remaining <= 16)
+			break;
+	}
+	A += B;
+	B += A;
+	aseprite_cache_key Key;
+	Key.Hash[0] = AsepriteMix64(A);
+	Key.Hash[1] = AsepriteMix64(B ^ Key.Hash[0]);
+	return Key;
+}
+
+#define ASEPRITE_EXPORT_CACHE_VERSION 1
+
+// The key of one exported frame: the file's bytes and everything that changes
+// the output.
+
+aseprite_cache_key
+AsepriteExportCacheKey(const void *FileData, size_t FileSize, aseprite_export_options *Options)
+{
+	aseprite_cache_key Key = AsepriteHashCacheKey(FileData, FileSize, 0);
+	uint64_t Fields[6];
+	Fields[0] = ASEPRITE_EXPORT_CACHE_VERSION;
+	Fields[1] = (uint64_t)Options->FrameNumber;
+	Fields[2] = Options->LayerMask;
+	Fields[3] = (uint64_t)AsepriteMaxInt(Options->Scale, 1);
+	Fields[4] = (uint64_t)Options->Format;
+	Fields[5] = Options->RenderFlags;
+	return AsepriteHashCacheKey(Fields, sizeof(Fields), &Key);
+}
+
+// Each cache file is this header followed by the output, which starts on a
+// 64 byte boundary of the mapping.
+
+struct aseprite_cache_file_header
+{
+	char Magic[4];
+	uint32_t Version;
+	uint64_t Key[2];
+	uint64_t Size;
+};
+
+#define ASEPRITE_CACHE_DATA_OFFSET 64
+
+// Data points into a mapping of the cache file (or, when the output couldn't
+// be stored, a heap copy).  Release it with AsepriteReleaseCachedOutput.
+
+struct aseprite_cached_output
+{
+	void *Data;
+	size_t Size;
+	void *View;
+	size_t ViewSize;
+};
+
+void
+AsepriteReleaseCachedOutput(aseprite_cached_output *Output)
+{
+	if (Output->View)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(Output->View);
+#else
+		munmap(Output->View, Output->ViewSize);
+#endif
+	}
+	else
+	{
+		free(Output->Data);
+	}
+	memset(Output, 0, sizeof(aseprite_cached_output));
+}
+
+// Returns a malloc'd "<Directory>/<key>.<Extension>".
+
+char *
+AsepriteCachePath(const char *Directory, aseprite_cache_key Key, const char *Extension)
+{
+	size_t Length = strlen(Directory) + strlen(Extension) + 64;
+	char *Path = (char *)malloc(Length);
+	if (Path)
+		snprintf(Path, Length, "%s/%016llx%016llx.%s", Directory,
+				 (unsigned long long)Key.Hash[0], (unsigned long long)Key.Hash[1], Extension);
+	return Path;
+}
+
+// Maps the output stored under Key.  Returns false on a miss, and for cache
+// files that are truncated or were written by another version.
+
+bool
+AsepriteCacheLookup(const char *Directory, aseprite_cache_key Key, aseprite_cached_output *Output)
+{
+	memset(Output, 0, sizeof(aseprite_cached_output));
+	char *Path = AsepriteCachePath(Directory, Key, "bin");
+	if (!Path)
+		return false;
+
+	void *View = 0;
+	size_t ViewSize = 0;
+#ifdef _WIN32
+	HANDLE Handle = CreateFileA(Path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (Handle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER Length;
+		if (GetFileSizeEx(Handle, &Length) && Length.QuadPart >= ASEPRITE_CACHE_DATA_OFFSET)
+		{
+			HANDLE Mapping = CreateFileMappingA(Handle, 0, PAGE_READONLY, 0, 0, 0);
+			if (Mapping)
+			{
+				View = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+				ViewSize = (size_t)Length.QuadPart;
+				CloseHandle(Mapping);
+			}
+		}
+		CloseHandle(Handle);
+	}
+#else
+	int Handle = open(Path, O_RDONLY);
+	if (Handle >= 0)
+	{
+		struct stat Info;
+		if (fstat(Handle, &Info) == 0 && Info.st_size >= ASEPRITE_CACHE_DATA_OFFSET)
+		{
+			View = mmap(0, (size_t)Info.st_size, PROT_READ, MAP_PRIVATE, Handle, 0);
+			if (View == MAP_FAILED)
+				View = 0;
+			ViewSize = (size_t)Info.st_size;
+		}
+		close(Handle);
+	}
+#endif
+	free(Path);
+	if (!View)
+		return false;
+
+	aseprite_cache_file_header Header;
+	memcpy(&Header, View, sizeof(Header));
+	if (memcmp(Header.Magic, "ASEO", 4) != 0 || Header.Version != ASEPRITE_EXPORT_CACHE_VERSION ||
+		Header.Key[0] != Key.Hash[0] || Header.Key[1] != Key.Hash[1] ||
+		Header.Size != ViewSize - ASEPRITE_CACHE_DATA_OFFSET)
+	{
+		Output->View = View;
+		Output->ViewSize = ViewSize;
+		AsepriteReleaseCachedOutput(Output);
+		return false;
+	}
+
+	Output->Data = (uint8_t *)View + ASEPRITE_CACHE_DATA_OFFSET;
+	Output->Size = (size_t)Header.Size;
+	Output->View = View;
+	Output->ViewSize = ViewSize;
+	return true;
+}
+
+// Stores an output under Key.  It is written to a temporary file first and
+// renamed into place, so a reader (or a crash) never sees half a file, and
+// concurrent stores of the same key are harmless.
+
+bool
+AsepriteCacheStore(const char *Directory, aseprite_cache_key Key, const void *Data, size_t Size)
+{
+	static volatile int32_t TempCounter;
+	char Extension[48];
+#ifdef _WIN32
+	unsigned long ProcessID = GetCurrentProcessId();
+#else
+	unsigned long ProcessID = (unsigned long)getpid();
+#endif
+	snprintf(Extension, sizeof(Extension), "%lu.%d.tmp", ProcessID, (int)AsepriteAtomicAdd(&TempCounter, 1));
+	char *TempPath = AsepriteCachePath(Directory, Key, Extension);
+	char *Path = AsepriteCachePath(Directory, Key, "bin");
+	bool Result = false;
+	FILE *Handle = (TempPath && Path) ? fopen(TempPath, "wb") : 0;
+	if (Handle)
+	{
+		uint8_t Header[ASEPRITE_CACHE_DATA_OFFSET] = {};
+		aseprite_cache_file_header FileHeader;
+		memcpy(FileHeader.Magic, "ASEO", 4);
+		FileHeader.Version = ASEPRITE_EXPORT_CACHE_VERSION;
+		FileHeader.Key[0] = Key.Hash[0];
+		FileHeader.Key[1] = Key.Hash[1];
+		FileHeader.Size = Size;
+		memcpy(Header, &FileHeader, sizeof(FileHeader));
+		Result = (fwrite(Header, 1, sizeof(Header), Handle) == sizeof(Header) &&
+				  (Size == 0 || fwrite(Data, 1, Size, Handle) == Size));
+		Result = (fclose(Handle) == 0) && Result;
+#ifdef _WIN32
+		Result = Result && MoveFileExA(TempPath, Path, MOVEFILE_REPLACE_EXISTING);
+#else
+		Result = Result && (rename(TempPath, Path) == 0);
+#endif
+		if (!Result)
+			remove(TempPath);
+	}
+	free(TempPath);
+	free(Path);
+	return Result;
+}
+
+// Exports a frame of the .ase in FileData through the cache in Directory.
+// Only a miss parses the file; the new output is then stored for next time.
+
+bool
+AsepriteExportFrameCached(const char *Directory, void *FileData, size_t FileSize, aseprite_export_options *Options, aseprite_cached_output *Output)
+{
+	aseprite_cache_key Key = AsepriteExportCacheKey(FileData, FileSize, Options);
+	if (AsepriteCacheLookup(Directory, Key, Output))
+		return true;
+
+	if (FileSize < ASEPRITE_HEADER_SIZE || AsepriteReadHeader(FileData).MagicNumber != 0xA5E0)
+		return false;
+	aseprite_parse_options ParseOptions = {0};
+	ParseOptions.FileSize = FileSize;
+	aseprite_file File = AsepriteParseFileEx(FileData, &ParseOptions);
+
+	int Width, Height;
+	size_t Size = AsepriteExportFrameSize(&File, Options, &Width, &Height);
+	void *Pixels = malloc(Size ? Size : 1);
+	bool Exported = (Pixels && AsepriteExportFrame(&File, Options, Pixels));
+	AsepriteFreeFile(&File);
+	if (!Exported)
+	{
+		free(Pixels);
+		return false;
+	}
+
+	if (AsepriteCacheStore(Directory, Key, Pixels, Size) && AsepriteCacheLookup(Directory, Key, Output))
+	{
+		free(Pixels);
+		return true;
+	}
+	//The cache couldn't be written; the output is still good
+	Output->Data = Pixels;
+	Output->Size = Size;
+	return true;
+}
+
+/*
+ * Build manifest
+ *
+ * A manifest records, for every exported .ase, the hash of its bytes, the hash
+ * of the options it was exported with, the hashes of the outputs written for
+ * it, and an input and output hash per frame.  The next build compares
+ * against it to skip files that haven't changed and to re-export only the
+ * frames an edit touched.
+ *
+ * The manifest is a text file:
+ *
+ *   aseprite-manifest 1
+ *   file <input> <options> <frame count> <output count> <path>
+ *   frame <input> <output>			(once per frame)
+ *   output <hash> <name>			(once per output)
+ *
+ * Hashes are 32 hex digits.  Paths and names run to the end of the line.
+ */
+
+// Hashes what each frame's pixels are made from, so an edit can be traced to
+// the frames it touched.  A frame's hash covers its duration and its cels
+// (a linked cel takes in the hash of the frame it links to).  The rest of the
+// file (header bar its size and frame count, layers, palettes, tilesets, tags,
+// user data...) goes into every frame's hash, since changing it can change any frame.  Returns the
+// number of frames hashed, at most MaxFrames, or -1 if the file is damaged.
+
+int
+AsepriteHashFrameInputs(const void *FileData, size_t FileSize, aseprite_cache_key *FrameHashes, int MaxFrames)
+{
+	if (FileSize < ASEPRITE_HEADER_SIZE)
+		return -1;
+	aseprite_header Header = AsepriteReadHeader(FileData);
+	if (Header.MagicNumber != 0xA5E0)
+		return -1;
+
+	int NumFrames = AsepriteMinInt(Header.Frames, MaxFrames);
+	const uint8_t *At = (const uint8_t *)FileData + ASEPRITE_HEADER_SIZE;
+	const uint8_t *End = (const uint8_t *)FileData + FileSize;
+	//Past the file size and frame count, which change with any edit (and the
+	//caller compares frame counts anyway)
+	aseprite_cache_key Shared = AsepriteHashCacheKey((const uint8_t *)FileData + 8, ASEPRITE_HEADER_SIZE - 8, 0);
+	for (int FrameNumber = 0; FrameNumber < NumFrames; FrameNumber++)
+	{
+		if (End - At < ASEPRITE_FRAME_HEADER_SIZE)
+			return -1;
+		aseprite_frame_header FrameHeader = AsepriteReadFrameHeader(At);
+		if (FrameHeader.BytesInFrame < ASEPRITE_FRAME_HEADER_SIZE || FrameHeader.BytesInFrame > (size_t)(End - At))
+			return -1;
+		const uint8_t *FrameEnd = At + FrameHeader.BytesInFrame;
+		At += ASEPRITE_FRAME_HEADER_SIZE;
+
+		uint16_t Duration = FrameHeader.FrameDuration;
+		aseprite_cache_key Frame = AsepriteHashCacheKey(&Duration, sizeof(Duration), 0);
+		while (FrameEnd - At >= ASEPRITE_CHUNK_HEADER_SIZE)
+		{
+			aseprite_chunk_header ChunkHeader = AsepriteReadChunkHeader(At);
+			if (ChunkHeader.ChunkSize < ASEPRITE_CHUNK_HEADER_SIZE || ChunkHeader.ChunkSize > (size_t)(FrameEnd - At))
+				return -1;
+			if (ChunkHeader.ChunkType == AsepriteChunk_Cel || ChunkHeader.ChunkType == AsepriteChunk_CelExtra)
+			{
+				Frame = AsepriteHashCacheKey(At, ChunkHeader.ChunkSize, &Frame);
+				if (ChunkHeader.ChunkType == AsepriteChunk_Cel &&
+					ChunkHeader.ChunkSize >= ASEPRITE_CHUNK_HEADER_SIZE + ASEPRITE_CEL_HEADER_SIZE + 2)
+				{
+					const uint8_t *CelData = At + ASEPRITE_CHUNK_HEADER_SIZE;
+					int LinkedFrame = AsepriteReadU16(CelData + ASEPRITE_CEL_HEADER_SIZE);
+					if (AsepriteReadCelHeader(CelData).CelType == AsepriteCelType_Linked && LinkedFrame < FrameNumber)
+						Frame = AsepriteHashCacheKey(FrameHashes + LinkedFrame, sizeof(aseprite_cache_key), &Frame);
+				}
+			}
+			else
+			{
+				Shared = AsepriteHashCacheKey(At, ChunkHeader.ChunkSize, &Shared);
+			}
+			At += ChunkHeader.ChunkSize;
+		}
+		FrameHashes[FrameNumber] = Frame;
+		At = FrameEnd;
+	}
+
+	//The shared part can come from any frame, so it goes in once all are read
+	for (int FrameNumber = 0; FrameNumber < NumFrames; FrameNumber++)
+		FrameHashes[FrameNumber] = AsepriteHashCacheKey(&Shared, sizeof(Shared), FrameHashes + FrameNumber);
+	return NumFrames;
+}
+
+struct aseprite_manifest_frame
+{
+	aseprite_cache_key Input;
+	aseprite_cache_key Output;
+};
+
+struct aseprite_manifest_output
+{
+	char *Name;
+	aseprite_cache_key Hash;
+};
+
+struct aseprite_manifest_entry
+{
+	char *Path;
+	aseprite_cache_key Input;
+	aseprite_cache_key Options;
+	int NumFrames;
+	aseprite_manifest_frame *Frames;
+	int NumOutputs;
+	aseprite_manifest_output *Outputs;
+};
+
+// Slots is an open addressing table of (entry index + 1) by path.
+
+struct aseprite_manifest
+{
+	int NumEntries;
+	int MaxEntries;
+	aseprite_manifest_entry *Entries;
+	int NumSlots;
+	int *Slots;
+};
+
+char *
+AsepriteCopyString(const char *String)
+{
+	size_t Length = strlen(String);
+	char *Result = (char *)malloc(Length + 1);
+	if (Result)
+		memcpy(Result, String, Length + 1);
+	return Result;
+}
+
+void
+AsepriteClearManifestEntry(aseprite_manifest_entry *Entry)
+{
+	for (int OutputIndex = 0; OutputIndex < Entry->NumOutputs; OutputIndex++)
+		free(Entry->Outputs[OutputIndex].Name);
+	free(Entry->Outputs);
+	free(Entry->Frames);
+	Entry->Outputs = 0;
+	Entry->NumOutputs = 0;
+	Entry->Frames = 0;
+	Entry->NumFrames = 0;
+}
+
+void
+AsepriteFreeManifest(aseprite_manifest *Manifest)
+{
+	for (int EntryIndex = 0; EntryIndex < Manifest->NumEntries; EntryIndex++)
+	{
+		AsepriteClearManifestEntry(Manifest->Entries + EntryIndex);
+		free(Manifest->Entries[EntryIndex].Path);
+	}
+	free(Manifest->Entries);
+	free(Manifest->Slots);
+	memset(Manifest, 0, sizeof(aseprite_manifest));
+}
+
+int *
+AsepriteFindManifestSlot(aseprite_manifest *Manifest, const char *Path)
+{
+	uint32_t SlotIndex = AsepriteHashString(Path, (uint32_t)strlen(Path)) & (Manifest->NumSlots - 1);
+	while (Manifest->Slots[SlotIndex] && strcmp(Manifest->Entries[Manifest->Slots[SlotIndex] - 1].Path, Path) != 0)
+		SlotIndex = (SlotIndex + 1) & (Manifest->NumSlots - 1);
+	return Manifest->Slots + SlotIndex;
+}
+
+aseprite_manifest_entry *
+AsepriteFindManifestEntry(aseprite_manifest *Manifest, const char *Path)
+{
+	if (!Manifest->NumSlots)
+		return 0;
+	int Slot = *AsepriteFindManifestSlot(Manifest, Path);
+	return Slot ? Manifest->Entries + Slot - 1 : 0;
+}
+
+// Adds the entry for Path, or empties the one already there, with room for
+// NumFrames frames (zeroed).  Returns 0 if out of memory.
+
+aseprite_manifest_entry *
+AsepriteAddManifestEntry(aseprite_manifest *Manifest, const char *Path, int NumFrames)
+{
+	aseprite_manifest_entry *Entry = AsepriteFindManifestEntry(Manifest, Path);
+	if (Entry)
+	{
+		AsepriteClearManifestEntry(Entry);
+	}
+	else
+	{
+		if (Manifest->NumEntries == Manifest->MaxEntries)
+		{
+			int NewMaxEntries = Manifest->MaxEntries ? Manifest->MaxEntries*2 : 64;
+			aseprite_manifest_entry *NewEntries = (aseprite_manifest_entry *)realloc(Manifest->Entries, NewMaxEntries*sizeof(aseprite_manifest_entry));
+			if (!NewEntries)
+				return 0;
+			Manifest->Entries = NewEntries;
+			Manifest->MaxEntries = NewMaxEntries;
+		}
+		//The table is kept at most half full
+		if ((Manifest->NumEntries + 1)*2 > Manifest->NumSlots)
+		{
+			int NewNumSlots = Manifest->NumSlots ? Manifest->NumSlots*2 : 128;
+			int *NewSlots = (int *)calloc(NewNumSlots, sizeof(int));
+			if (!NewSlots)
+				return 0;
+			free(Manifest->Slots);
+			Manifest->Slots = NewSlots;
+			Manifest->NumSlots = NewNumSlots;
+			for (int EntryIndex = 0; EntryIndex < Manifest->NumEntries; EntryIndex++)
+				*AsepriteFindManifestSlot(Manifest, Manifest->Entries[EntryIndex].Path) = EntryIndex + 1;
+		}
+		char *PathCopy = AsepriteCopyString(Path);
+		if (!PathCopy)
+			return 0;
+		Entry = Manifest->Entries + Manifest->NumEntries++;
+		memset(Entry, 0, sizeof(aseprite_manifest_entry));
+		Entry->Path = PathCopy;
+		*AsepriteFindManifestSlot(Manifest, Path) = Manifest->NumEntries;
+	}
+
+	if (NumFrames > 0)
+	{
+		Entry->Frames = (aseprite_manifest_frame *)calloc(NumFrames, sizeof(aseprite_manifest_frame));
+		if (!Entry->Frames)
+			return 0;
+		Entry->NumFrames = NumFrames;
+	}
+	return Entry;
+}
+
+bool
+AsepriteAddManifestOutput(aseprite_manifest_entry *Entry, const char *Name, aseprite_cache_key Hash)
+{
+	aseprite_manifest_output *NewOutputs = (aseprite_manifest_output *)realloc(Entry->Outputs, (Entry->NumOutputs + 1)*sizeof(aseprite_manifest_output));
+	if (!NewOutputs)
+		return false;
+	Entry->Outputs = NewOutputs;
+	char *NameCopy = AsepriteCopyString(Name);
+	if (!NameCopy)
+		return false;
+	Entry->Outputs[Entry->NumOutputs].Name = NameCopy;
+	Entry->Outputs[Entry->NumOutputs].Hash = Hash;
+	Entry->NumOutputs++;
+	return true;
+}
+
+// Writes through a temporary file and a rename, like AsepriteCacheStore.
+// Paths and names can't contain line breaks.
+
+bool
+AsepriteWriteManifest(aseprite_manifest *Manifest, const char *Path)
+{
+	size_t Length = strlen(Path) + 8;
+	char *TempPath = (char *)malloc(Length);
+	if (!TempPath)
+		return false;
+	snprintf(TempPath, Length, "%s.tmp", Path);
+	FILE *Handle = fopen(TempPath, "wb");
+	if (!Handle)
+	{
+		free(TempPath);
+		return false;
+	}
+
+	bool Result = (fprintf(Handle, "aseprite-manifest 1\n") > 0);
+	for (int EntryIndex = 0; Result && EntryIndex < Manifest->NumEntries; EntryIndex++)
+	{
+		aseprite_manifest_entry *Entry = Manifest->Entries + EntryIndex;
+		Result = (strpbrk(Entry->Path, "\r\n") == 0) &&
+				 fprintf(Handle, "file %016llx%016llx %016llx%016llx %d %d %s\n",
+						 (unsigned long long)Entry->Input.Hash[0], (unsigned long long)Entry->Input.Hash[1],
+						 (unsigned long long)Entry->Options.Hash[0], (unsigned long long)Entry->Options.Hash[1],
+						 Entry->NumFrames, Entry->NumOutputs, Entry->Path) > 0;
+		for (int FrameNumber = 0; Result && FrameNumber < Entry->NumFrames; FrameNumber++)
+		{
+			aseprite_manifest_frame *Frame = Entry->Frames + FrameNumber;
+			Result = fprintf(Handle, "frame %016llx%016llx %016llx%016llx\n",
+							 (unsigned long long)Frame->Input.Hash[0], (unsigned long long)Frame->Input.Hash[1],
+							 (unsigned long long)Frame->Output.Hash[0], (unsigned long long)Frame->Output.Hash[1]) > 0;
+		}
+		for (int OutputIndex = 0; Result && OutputIndex < Entry->NumOutputs; OutputIndex++)
+		{
+			aseprite_manifest_output *Output = Entry->Outputs + OutputIndex;
+			Result = (strpbrk(Output->Name, "\r\n") == 0) &&
+					 fprintf(Handle, "output %016llx%016llx %s\n",
+							 (unsigned long long)Output->Hash.Hash[0], (unsigned long long)Output->Hash.Hash[1], Output->Name) > 0;
+		}
+	}
+	Result = (fclose(Handle) == 0) && Result;
+#ifdef _WIN32
+	Result = Result && MoveFileExA(TempPath, Path, MOVEFILE_REPLACE_EXISTING);
+#else
+	Result = Result && (rename(TempPath, Path) == 0);
+#endif
+	if (!Result)
+		remove(TempPath);
+	free(TempPath);
+	return Result;
+}
+
+// Reads 32 hex digits.  Returns the text after them, or 0.
+
+char *
+AsepriteParseCacheKey(char *Text, aseprite_cache_key *Key)
+{
+	for (int Half = 0; Half < 2; Half++)
+	{
+		uint64_t Value = 0;
+		for (int Digit = 0; Digit < 16; Digit++, Text++)
+		{
+			char Char = *Text;
+			if (Char >= '0' && Char <= '9')
+				Value = (Value << 4) | (uint64_t)(Char - '0');
+			else if (Char >= 'a' && Char <= 'f')
+				Value = (Value << 4) | (uint64_t)(Char - 'a' + 10);
+			else
+				return 0;
+		}
+		Key->Hash[Half] = Value;
+	}
+	return Text;
+}
+
+// Returns the next line (without its line break) and moves At past it, or 0
+// at the end of the text.
+
+char *
+AsepriteNextLine(char **At, char *End)
+{
+	if (*At >= End)
+		return 0;
+	char *Line = *At;
+	char *LineEnd = Line;
+	while (LineEnd < End && *LineEnd != '\n')
+		LineEnd++;
+	*At = (LineEnd < End) ? LineEnd + 1 : End;
+	if (LineEnd > Line && LineEnd[-1] == '\r')
+		LineEnd--;
+	*LineEnd = '\0';
+	return Line;
+}
+
+// Reads a manifest written by AsepriteWriteManifest into an empty Manifest.
+// Returns false (leaving Manifest empty) if the file is missing or damaged,
+// which a build should treat as "everything changed".
+
+bool
+AsepriteReadManifest(const char *Path, aseprite_manifest *Manifest)
+{
+	memset(Manifest, 0, sizeof(aseprite_manifest));
+	volatile int32_t Cancel = 0;
+	size_t Size = 0;
+	char *Text = (char *)AsepriteReadEntireFile(Path, &Size, &Cancel);
+	if (!Text)
+		return false;
+
+	//One byte past the text so the last line can be terminated in place
+	char *Terminated = (char *)realloc(Text, Size + 1);
+	if (!Terminated)
+	{
+		free(Text);
+		return false;
+	}
+	Text = Terminated;
+	char *At = Text;
+	char *End = Text + Size;
+	char *Line = AsepriteNextLine(&At, End);
+	bool Result = (Line && strcmp(Line, "aseprite-manifest 1") == 0);
+	while (Result && (Line = AsepriteNextLine(&At, End)) != 0)
+	{
+		if (*Line == '\0')
+			continue;
+
+		aseprite_cache_key Input, Options;
+		int NumFrames, NumOutputs, PathStart = 0;
+		char *Keys = (strncmp(Line, "file ", 5) == 0) ? AsepriteParseCacheKey(Line + 5, &Input) : 0;
+		Keys = (Keys && *Keys == ' ') ? AsepriteParseCacheKey(Keys + 1, &Options) : 0;
+		Result = (Keys && sscanf(Keys, " %d %d %n", &NumFrames, &NumOutputs, &PathStart) == 2 && PathStart &&
+				  NumFrames >= 0 && NumOutputs >= 0);
+		aseprite_manifest_entry *Entry = Result ? AsepriteAddManifestEntry(Manifest, Keys + PathStart, NumFrames) : 0;
+		Result = (Entry != 0);
+		if (Result)
+		{
+			Entry->Input = Input;
+			Entry->Options = Options;
+		}
+
+		for (int FrameNumber = 0; Result && FrameNumber < NumFrames; FrameNumber++)
+		{
+			aseprite_manifest_frame *Frame = Entry->Frames + FrameNumber;
+			Line = AsepriteNextLine(&At, End);
+			char *Rest = (Line && strncmp(Line, "frame ", 6) == 0) ? AsepriteParseCacheKey(Line + 6, &Frame->Input) : 0;
+			Rest = (Rest && *Rest == ' ') ? AsepriteParseCacheKey(Rest + 1, &Frame->Output) : 0;
+			Result = (Rest && *Rest == '\0');
+		}
+		for (int OutputIndex = 0; Result && OutputIndex < NumOutputs; OutputIndex++)
+		{
+			aseprite_cache_key Hash;
+			Line = AsepriteNextLine(&At, End);
+			char *Rest = (Line && strncmp(Line, "output ", 7) == 0) ? AsepriteParseCacheKey(Line + 7, &Hash) : 0;
+			Result = (Rest && *Rest == ' ' && AsepriteAddManifestOutput(Entry, Rest + 1, Hash));
+		}
+	}
+	free(Text);
+	if (!Result)
+		AsepriteFreeManifest(Manifest);
+	return Result;
+}
+
+enum aseprite_export_change
+{
+	//Nothing to export again
+	AsepriteExportChange_None,
+	//Only the frames marked in FrameChanged
+	AsepriteExportChange_Frames,
+	//A new file, new options or a different frame count: export everything
+	AsepriteExportChange_All,
+};
+
+// Compares a file's current hashes with its entry from the previous build
+// (Previous may be 0 for a file that wasn't in it).  FrameChanged gets a flag
+// per frame.  Input and Options are hashes of the .ase bytes and of whatever
+// options the caller exports with (see AsepriteHashCacheKey).
+
+aseprite_export_change
+AsepriteCompareManifestEntry(aseprite_manifest_entry *Previous, aseprite_cache_key Input, aseprite_cache_key Options,
+							 aseprite_cache_key *FrameInputs, int NumFrames, bool *FrameChanged)
+{
+	if (!Previous || Previous->NumFrames != NumFrames ||
+		memcmp(&Previous->Options, &Options, sizeof(Options)) != 0)
+	{
+		for (int FrameNumber = 0; FrameNumber < NumFrames; FrameNumber++)
+			FrameChanged[FrameNumber] = true;
+		return AsepriteExportChange_All;
+	}
+
+	bool InputSame = (memcmp(&Previous->Input, &Input, sizeof(Input)) == 0);
+	aseprite_export_change Result = AsepriteExportChange_None;
+	for (int FrameNumber = 0; FrameNumber < NumFrames; FrameNumber++)
+	{
+		FrameChanged[FrameNumber] = !InputSame &&
+									memcmp(&Previous->Frames[FrameNumber].Input, FrameInputs + FrameNumber, sizeof(aseprite_cache_key)) != 0;
+		if (FrameChanged[FrameNumber])
+			Result = AsepriteExportChange_Frames;
+	}
+	return Result;
+}
+
+// Checks that the outputs recorded for an entry are still on disk as they
+// were written.  A build should export everything again if they aren't.
+
+bool
+AsepriteCheckManifestOutputs(aseprite_manifest_entry *Entry)
+{
+	for (int OutputIndex = 0; OutputIndex < Entry->NumOutputs; OutputIndex++)
+	{
+		volatile int32_t Cancel = 0;
+		size_t Size = 0;
+		void *Data = AsepriteReadEntireFile(Entry->Outputs[OutputIndex].Name, &Size, &Cancel);
+		if (!Data)
+			return false;
+		aseprite_cache_key Hash = AsepriteHashCacheKey(Data, Size, 0);
+		free(Data);
+		if (memcmp(&Hash, &Entry->Outputs[OutputIndex].Hash, sizeof(Hash)) != 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Trimming
+ */
+
+struct aseprite_rect
+{
+	int X;
+	int Y;
+	int Width;
+	int Height;
+};
+
+// Finds the smallest rect that holds every pixel of an RGBA image whose alpha
+// isn't zero.  The rect is empty (Width and Height 0) if there are none.
+// Pitch is in bytes.  RowMinX and RowEndX may be 0; otherwise they get, for
+// each of the Height rows, the columns [RowMinX, RowEndX) holding its
+// visible pixels (RowEndX is 0 for empty rows).  AsepriteBuildSpriteMesh
+// takes those.
+
+aseprite_rect
+AsepriteTrimRGBAEx(const void *Pixels, int Width, int Height, int Pitch, int *RowMinX, int *RowEndX)
+{
+	aseprite_rect Result = {0, 0, 0, 0};
+	const uint8_t *Rows = (const uint8_t *)Pixels;
+	int MinY = Height;
+	int MaxY = 0;
+	int MinX = Width;
+	int MaxX = 0;
+	for (int Y = 0; Y < Height; Y++)
+	{
+		//Only the transparent borders of each row are read
+		const uint8_t *Row = Rows + (size_t)Y*Pitch;
+		int Left = 0;
+		while (Left < Width && Row[Left*4 + 3] == 0)
+			Left++;
+		int Right = Width;
+		while (Right > Left && Row[(Right - 1)*4 + 3] == 0)
+			Right--;
+		if (RowMinX && RowEndX)
+		{
+			RowMinX[Y] = (Left < Right) ? Left : 0;
+			RowEndX[Y] = (Left < Right) ? Right : 0;
+		}
+		if (Left < Right)
+		{
+			MinY = AsepriteMinInt(MinY, Y);
+			MaxY = Y + 1;
+			MinX = AsepriteMinInt(MinX, Left);
+			MaxX = AsepriteMaxInt(MaxX, Right);
+		}
+	}
+	if (MinY >= MaxY)
+		return Result;
+	Result.X = MinX;
+	Result.Y = MinY;
+	Result.Width = MaxX - MinX;
+	Result.Height = MaxY - MinY;
+	return Result;
+}
+
+aseprite_rect
+AsepriteTrimRGBA(const void *Pixels, int Width, int Height, int Pitch)
+{
+	return AsepriteTrimRGBAEx(Pixels, Width, Height, Pitch, 0, 0);
+}
+
+/*
+ * Sprite meshes
+ *
+ * Drawing a sprite as a quad around its trimmed rect still fills every
+ * transparent texel inside the rect.  AsepriteBuildSpriteMesh makes a convex
+ * polygon that covers every visible pixel (it never cuts into one) with at
+ * most a given number of vertices, as a triangle fan.
+ *
+ * The polygon starts as the convex hull of the corners of each row's visible
+ * span, then loses vertices one at a time: an edge is dropped by extending its
+ * two neighboring edges until they meet, which only ever grows the polygon.
+ * Each step drops the edge that adds the least area.  New corners stay inside
+ * the trimmed rect, so the UVs stay inside the sprite's rect in the atlas.
+ */
+
+#define ASEPRITE_MESH_MAX_VERTICES 32
+
+struct aseprite_mesh_point
+{
+	float X;
+	float Y;
+};
+
+// Vertices are in pixels from the top left of the trimmed rect, clockwise on
+// screen (y down).  The triangles are a fan around vertex 0.
+
+struct aseprite_sprite_mesh
+{
+	int NumVertices;
+	aseprite_mesh_point Vertices[ASEPRITE_MESH_MAX_VERTICES];
+	int NumIndices;
+	uint16_t Indices[(ASEPRITE_MESH_MAX_VERTICES - 2)*3];
+};
+
+inline float
+AsepriteCross(aseprite_mesh_point O, aseprite_mesh_point A, aseprite_mesh_point B)
+{
+	return (A.X - O.X)*(B.Y - O.Y) - (A.Y - O.Y)*(B.X - O.X);
+}
+
+int
+AsepriteCompareMeshPoints(const void *A, const void *B)
+{
+	aseprite_mesh_point *PointA = (aseprite_mesh_point *)A;
+	aseprite_mesh_point *PointB = (aseprite_mesh_point *)B;
+	if (PointA->Y != PointB->Y)
+		return (PointA->Y < PointB->Y) ? -1 : 1;
+	if (PointA->X != PointB->X)
+		return (PointA->X < PointB->X) ? -1 : 1;
+	return 0;
+}
+
+// Monotone chain hull of Points (which get sorted).  Writes the hull to Hull,
+// clockwise on screen, and returns its size.  Hull needs room for
+// NumPoints + 1 points.
+
+int
+AsepriteConvexHull(aseprite_mesh_point *Points, int NumPoints, aseprite_mesh_point *Hull)
+{
+	qsort(Points, NumPoints, sizeof(aseprite_mesh_point), AsepriteCompareMeshPoints);
+	int Count = 0;
+	for (int PointIndex = 0; PointIndex < NumPoints; PointIndex++)
+	{
+		while (Count >= 2 && AsepriteCross(Hull[Count - 2], Hull[Count - 1], Points[PointIndex]) <= 0)
+			Count--;
+		Hull[Count++] = Points[PointIndex];
+	}
+	int LowerCount = Count + 1;
+	for (int PointIndex = NumPoints - 2; PointIndex >= 0; PointIndex--)
+	{
+		while (Count >= LowerCount && AsepriteCross(Hull[Count - 2], Hull[Count - 1], Points[PointIndex]) <= 0)
+			Count--;
+		Hull[Count++] = Points[PointIndex];
+	}
+	//The last point repeats the first
+	Count--;
+
+	float Area = 0.0f;
+	for (int PointIndex = 0; PointIndex < Count; PointIndex++)
+	{
+		aseprite_mesh_point A = Hull[PointIndex];
+		aseprite_mesh_point B = Hull[(PointIndex + 1) % Count];
+		Area += A.X*B.Y - B.X*A.Y;
+	}
+	if (Area < 0.0f)
+	{
+		for (int PointIndex = 0; PointIndex < Count/2; PointIndex++)
+		{
+			aseprite_mesh_point Swap = Hull[PointIndex];
+			Hull[PointIndex] = Hull[Count - 1 - PointIndex];
+			Hull[Count - 1 - PointIndex] = Swap;
+		}
+	}
+	return Count;
+}
+
+// Builds the mesh for a sprite from the output of AsepriteTrimRGBAEx.
+// MaxVertices is clamped to [4, ASEPRITE_MESH_MAX_VERTICES]; a quad over the
+// trimmed rect is the fallback.  Returns false for an empty sprite.
+
+bool
+AsepriteBuildSpriteMesh(aseprite_rect Trim, const int *RowMinX, const int *RowEndX, int MaxVertices, aseprite_sprite_mesh *Mesh)
+{
+	Mesh->NumVertices = 0;
+	Mesh->NumIndices = 0;
+	if (Trim.Width <= 0 || Trim.Height <= 0)
+		return false;
+	MaxVertices = AsepriteMaxInt(4, AsepriteMinInt(MaxVertices, ASEPRITE_MESH_MAX_VERTICES));
+
+	//Corners of each row's span; the hull can't have more points than these
+	aseprite_mesh_point *Points = (aseprite_mesh_point *)malloc(sizeof(aseprite_mesh_point)*(Trim.Height*8 + 2));
+	int NumPoints = 0;
+	if (Points)
+	{
+		for (int Y = 0; Y < Trim.Height; Y++)
+		{
+			int Row = Trim.Y + Y;
+			if (RowEndX[Row] <= RowMinX[Row])
+				continue;
+			float Left = (float)(RowMinX[Row] - Trim.X);
+			float Right = (float)(RowEndX[Row] - Trim.X);
+			aseprite_mesh_point Corners[4] = {{Left, (float)Y}, {Right, (float)Y}, {Left, (float)Y + 1}, {Right, (float)Y + 1}};
+			memcpy(Points + NumPoints, Corners, sizeof(Corners));
+			NumPoints += 4;
+		}
+	}
+	aseprite_mesh_point *Hull = Points + NumPoints;
+	int Count = (NumPoints >= 3) ? AsepriteConvexHull(Points, NumPoints, Hull) : 0;
+
+	float MaxX = (float)Trim.Width;
+	float MaxY = (float)Trim.Height;
+	while (Count > MaxVertices)
+	{
+		int BestEdge = -1;
+		float BestArea = 0.0f;
+		aseprite_mesh_point BestPoint = {};
+		for (int Edge = 0; Edge < Count; Edge++)
+		{
+			aseprite_mesh_point Before = Hull[(Edge + Count - 1) % Count];
+			aseprite_mesh_point A = Hull[Edge];
+			aseprite_mesh_point B = Hull[(Edge + 1) % Count];
+			aseprite_mesh_point After = Hull[(Edge + 2) % Count];
+
+			//Where the edge into A, carried on past A, meets the edge out of B
+			//carried back before B
+			float DirAX = A.X - Before.X, DirAY = A.Y - Before.Y;
+			float DirBX = After.X - B.X, DirBY = After.Y - B.Y;
+			float Denominator = DirAX*DirBY - DirAY*DirBX;
+			if (Denominator <= 1e-6f)
+				continue;
+			float T = ((B.X - A.X)*DirBY - (B.Y - A.Y)*DirBX)/Denominator;
+			float S = ((B.X - A.X)*DirAY - (B.Y - A.Y)*DirAX)/Denominator;
+			if (T < 0.0f || S > 0.0f)
+				continue;
+			aseprite_mesh_point Meet = {A.X + T*DirAX, A.Y + T*DirAY};
+			if (Meet.X < -1e-3f || Meet.Y < -1e-3f || Meet.X > MaxX + 1e-3f || Meet.Y > MaxY + 1e-3f)
+				continue;
+			float Area = AsepriteCross(A, Meet, B);
+			Area = (Area < 0.0f) ? -Area : Area;
+			if (BestEdge < 0 || Area < BestArea)
+			{
+				BestEdge = Edge;
+				BestArea = Area;
+				BestPoint = Meet;
+			}
+		}
+		if (BestEdge < 0)
+		{
+			Count = 0;
+			break;
+		}
+
+		//A becomes the meeting point and B goes
+		Hull[BestEdge] = BestPoint;
+		int Removed = (BestEdge + 1) % Count;
+		memmove(Hull + Removed, Hull + Removed + 1, (Count - Removed - 1)*sizeof(aseprite_mesh_point));
+		Count--;
+	}
+
+	if (Count >= 3)
+	{
+		memcpy(Mesh->Vertices, Hull, Count*sizeof(aseprite_mesh_point));
+		Mesh->NumVertices = Count;
+	}
+	else
+	{
+		aseprite_mesh_point Quad[4] = {{0.0f, 0.0f}, {MaxX, 0.0f}, {MaxX, MaxY}, {0.0f, MaxY}};
+		memcpy(Mesh->Vertices, Quad, sizeof(Quad));
+		Mesh->NumVertices = 4;
+	}
+	free(Points);
+
+	for (int Vertex = 1; Vertex + 1 < Mesh->NumVertices; Vertex++)
+	{
+		Mesh->Indices[Mesh->NumIndices++] = 0;
+		Mesh->Indices[Mesh->NumIndices++] = (uint16_t)Vertex;
+		Mesh->Indices[Mesh->NumIndices++] = (uint16_t)(Vertex + 1);
+	}
+	return true;
+}
+
+// Texture coordinates of the mesh's vertices for a sprite placed at
+// (AtlasX, AtlasY) in a page of PageWidth by PageHeight, drawn at Scale.
+
+void
+AsepriteGetSpriteMeshUVs(aseprite_sprite_mesh *Mesh, int AtlasX, int AtlasY, int PageWidth, int PageHeight, float Scale, aseprite_mesh_point *UVs)
+{
+	for (int Vertex = 0; Vertex < Mesh->NumVertices; Vertex++)
+	{
+		UVs[Vertex].X = ((float)AtlasX + Mesh->Vertices[Vertex].X*Scale)/(float)PageWidth;
+		UVs[Vertex].Y = ((float)AtlasY + Mesh->Vertices[Vertex].Y*Scale)/(float)PageHeight;
+	}
+}
+
+/*
+ * Signed distance fields
+ *
+ * AsepriteComputeSDF turns the alpha of an RGBA image into an 8 bit signed
+ * distance field: 128 on the edge of the shape, higher inside it and lower
+ * outside, reaching 255 and 0 at Spread pixels from the edge.  Pixels whose
+ * alpha is above Threshold are inside.  Outlines, glows and smooth scaling
+ * are then a threshold or ramp on one texture channel.
+ *
+ * Distances are exact (Euclidean, between pixel centers, less half a pixel)
+ * and take linear time.  A pass down the columns gives each pixel the distance
+ * to the nearest inside and outside pixel in its column, then each row takes
+ * the lower envelope of the parabolas those make (Felzenszwalb and
+ * Huttenlocher, "Distance Transforms of Sampled Functions").  The column
+ * passes and the conversion to bytes go a whole row at a time, 4 pixels per
+ * step with SSE2.
+ */
+
+// One row of the transform, in place: Row[X] goes from a distance down its
+// column to the smallest squared distance Row[Q]^2 + (X - Q)^2 over every Q.
+// Costs and Sites hold Width entries, Bounds Width + 1.
+
+void
+AsepriteDistanceTransformRow(float *Row, int Width, float *Costs, int *Sites, double *Bounds)
+{
+	for (int X = 0; X < Width; X++)
+		Costs[X] = Row[X]*Row[X];
+	int Count = 0;
+	Sites[0] = 0;
+	Bounds[0] = -1e30;
+	Bounds[1] = 1e30;
+	for (int Q = 1; Q < Width; Q++)
+	{
+		//Where the parabola at Q starts to beat the last one on the envelope
+		double QCost = (double)Costs[Q] + (double)Q*Q;
+		int V = Sites[Count];
+		double Start = (QCost - ((double)Costs[V] + (double)V*V))/(2.0*(Q - V));
+		while (Start <= Bounds[Count])
+		{
+			V = Sites[--Count];
+			Start = (QCost - ((double)Costs[V] + (double)V*V))/(2.0*(Q - V));
+		}
+		Count++;
+		Sites[Count] = Q;
+		Bounds[Count] = Start;
+		Bounds[Count + 1] = 1e30;
+	}
+	Count = 0;
+	for (int X = 0; X < Width; X++)
+	{
+		while (Bounds[Count + 1] < (double)X)
+			Count++;
+		int Site = Sites[Count];
+		Row[X] = (float)((X - Site)*(X - Site)) + Costs[Site];
+	}
+}
+
+// Scratch needed by AsepriteComputeSDFEx: both distance planes and the rows'
+// envelope.
+
+size_t
+AsepriteSDFScratchSize(int Width, int Height)
+{
+	if (Width <= 0 || Height <= 0)
+		return 0;
+	size_t NumPixels = (size_t)Width*Height;
+	return ASEPRITE_SCRATCH_ALIGN + sizeof(float)*(NumPixels*2 + Width*2) + sizeof(int)*Width + sizeof(double)*(Width + 1);
+}
+
+// Dest gets Width bytes per row, DestPitch apart.  Pitch is in bytes.  The
+// working memory (about 8 bytes a pixel) comes from Scratch when there is one
+// (AsepriteSDFScratchSize bytes); returns false if that is too small or can't
+// be allocated.
+
+bool
+AsepriteComputeSDFEx(const void *Pixels, int Width, int Height, int Pitch, uint8_t Threshold, float Spread, uint8_t *Dest, int DestPitch, aseprite_scratch *Scratch)
+{
+	if (Width <= 0 || Height <= 0)
+		return true;
+	if (Spread < 1.0f)
+		Spread = 1.0f;
+
+	//Column distances past Limit are only ever clamped, so they stop growing
+	//there (and the squares stay small)
+	float Limit = floorf(Spread) + 2.0f;
+	size_t NumPixels = (size_t)Width*Height;
+	size_t ScratchMark = Scratch ? Scratch->Used : 0;
+	uint8_t *Memory = (uint8_t *)AsepriteScratchAlloc(Scratch, AsepriteSDFScratchSize(Width, Height) - ASEPRITE_SCRATCH_ALIGN);
+	if (!Memory)
+		return false;
+	double *Bounds = (double *)Memory;
+	float *ToInside = (float *)(Bounds + Width + 1);
+	float *ToOutside = ToInside + NumPixels;
+	float *Costs = ToOutside + NumPixels;
+	float *Far = Costs + Width;
+	int *Sites = (int *)(Far + Width);
+	for (int X = 0; X < Width; X++)
+		Far[X] = Limit;
+
+	//Down the columns: distance to the nearest pixel above of each kind
+	for (int Y = 0; Y < Height; Y++)
+	{
+		const uint8_t *Source = (const uint8_t *)Pixels + (size_t)Y*Pitch;
+		float *Inside = ToInside + (size_t)Y*Width;
+		float *Outside = ToOutside + (size_t)Y*Width;
+		float *AboveInside = Y ? Inside - Width : Far;
+		float *AboveOutside = Y ? Outside - Width : Far;
+		int X = 0;
+#ifdef ASEPRITE_SSE2
+		__m128i Thresh = _mm_set1_epi32(Threshold);
+		__m128 One = _mm_set1_ps(1.0f);
+		__m128 Cap = _mm_set1_ps(Limit);
+		for (; X + 4 <= Width; X += 4)
+		{
+			__m128i Alpha = _mm_srli_epi32(_mm_loadu_si128((__m128i *)(Source + X*4)), 24);
+			__m128 IsInside = _mm_castsi128_ps(_mm_cmpgt_epi32(Alpha, Thresh));
+			__m128 StepInside = _mm_min_ps(_mm_add_ps(_mm_loadu_ps(AboveInside + X), One), Cap);
+			__m128 StepOutside = _mm_min_ps(_mm_add_ps(_mm_loadu_ps(AboveOutside + X), One), Cap);
+			_mm_storeu_ps(Inside + X, _mm_andnot_ps(IsInside, StepInside));
+			_mm_storeu_ps(Outside + X, _mm_and_ps(IsInside, StepOutside));
+		}
+#endif
+		for (; X < Width; X++)
+		{
+			bool IsInside = (Source[X*4 + 3] > Threshold);
+			Inside[X] = IsInside ? 0.0f : AsepriteMinFloat(AboveInside[X] + 1.0f, Limit);
+			Outside[X] = IsInside ? AsepriteMinFloat(AboveOutside[X] + 1.0f, Limit) : 0.0f;
+		}
+	}
+
+	//Back up the columns, for the nearest pixel of each kind above or below
+	for (int Y = Height - 2; Y >= 0; Y--)
+	{
+		float *Inside = ToInside + (size_t)Y*Width;
+		float *Outside = ToOutside + (size_t)Y*Width;
+		int X = 0;
+#ifdef ASEPRITE_SSE2
+		__m128 One = _mm_set1_ps(1.0f);
+		for (; X + 4 <= Width; X += 4)
+		{
+			__m128 InsideBelow = _mm_add_ps(_mm_loadu_ps(Inside + Width + X), One);
+			__m128 OutsideBelow = _mm_add_ps(_mm_loadu_ps(Outside + Width + X), One);
+			_mm_storeu_ps(Inside + X, _mm_min_ps(_mm_loadu_ps(Inside + X), InsideBelow));
+			_mm_storeu_ps(Outside + X, _mm_min_ps(_mm_loadu_ps(Outside + X), OutsideBelow));
+		}
+#endif
+		for (; X < Width; X++)
+		{
+			Inside[X] = AsepriteMinFloat(Inside[X], Inside[Width + X] + 1.0f);
+			Outside[X] = AsepriteMinFloat(Outside[X], Outside[Width + X] + 1.0f);
+		}
+	}
+
+	for (int Y = 0; Y < Height; Y++)
+	{
+		AsepriteDistanceTransformRow(ToInside + (size_t)Y*Width, Width, Costs, Sites, Bounds);
+		AsepriteDistanceTransformRow(ToOutside + (size_t)Y*Width, Width, Costs, Sites, Bounds);
+	}
+
+	//Signed distance to the edge, half a pixel out from the nearest center of
+	//the other kind, mapped so Spread outside is 0 and Spread inside is 255
+	float Step = 128.0f/Spread;
+	for (int Y = 0; Y < Height; Y++)
+	{
+		float *Inside = ToInside + (size_t)Y*Width;
+		float *Outside = ToOutside + (size_t)Y*Width;
+		uint8_t *Out = Dest + (size_t)Y*DestPitch;
+		int X = 0;
+#ifdef ASEPRITE_SSE2
+		__m128 Zero = _mm_setzero_ps();
+		__m128 Half = _mm_set1_ps(0.5f);
+		__m128 Middle = _mm_set1_ps(128.0f);
+		__m128 Scale = _mm_set1_ps(Step);
+		for (; X + 16 <= Width; X += 16)
+		{
+			__m128i Values[4];
+			for (int Group = 0; Group < 4; Group++)
+			{
+				__m128 SquaredToInside = _mm_loadu_ps(Inside + X + Group*4);
+				__m128 Distance = _mm_sub_ps(_mm_sqrt_ps(SquaredToInside), _mm_sqrt_ps(_mm_loadu_ps(Outside + X + Group*4)));
+				//+0.5 for inside pixels (no distance to inside), -0.5 outside
+				__m128 Sign = _mm_and_ps(_mm_cmpeq_ps(SquaredToInside, Zero), _mm_set1_ps(-0.0f));
+				Distance = _mm_sub_ps(Distance, _mm_xor_ps(Half, Sign));
+				Values[Group] = _mm_cvtps_epi32(_mm_sub_ps(Middle, _mm_mul_ps(Distance, Scale)));
+			}
+			//Saturating packs clamp to 0..255
+			__m128i Packed = _mm_packus_epi16(_mm_packs_epi32(Values[0], Values[1]), _mm_packs_epi32(Values[2], Values[3]));
+			_mm_storeu_si128((__m128i *)(Out + X), Packed);
+		}
+#endif
+		for (; X < Width; X++)
+		{
+			float Distance = sqrtf(Inside[X]) - sqrtf(Outside[X]);
+			Distance += (Inside[X] == 0.0f) ? 0.5f : -0.5f;
+			int Value = (int)lrintf(128.0f - Distance*Step);
+			Out[X] = (uint8_t)AsepriteMaxInt(0, AsepriteMinInt(Value, 255));
+		}
+	}
+	AsepriteScratchFree(Scratch, Memory);
+	if (Scratch)
+		Scratch->Used = ScratchMark;
+	return true;
+}
+
+bool
+AsepriteComputeSDF(const void *Pixels, int Width, int Height, int Pitch, uint8_t Threshold, float Spread, uint8_t *Dest, int DestPitch)
+{
+	return AsepriteComputeSDFEx(Pixels, Width, Height, Pitch, Threshold, Spread, Dest, DestPitch, 0);
 }